@@ -0,0 +1,35 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "BinaryFile.h"
+
+#include <chrono>
+
+#define _SILENCE_EXPERIMENTAL_FILESYSTEM_DEPRECATION_WARNING
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+
+bool binary::fileStamp(std::string const &fileName, int64_t &size, int64_t &time) {
+  std::error_code ec;
+  size = fs::file_size(fileName, ec);
+  if (ec)
+    return false;
+  auto mtime = fs::last_write_time(fileName, ec);
+  if (ec)
+    return false;
+  time = std::chrono::duration_cast<std::chrono::nanoseconds>(mtime.time_since_epoch()).count();
+  return true;
+}
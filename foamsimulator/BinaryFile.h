@@ -0,0 +1,70 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef BINARYFILE_H
+#define BINARYFILE_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+   \brief This namespace groups the helpers of the binary files of the simulator (fluid caches,
+   checkpoints and farm results). Sizes are stored as int64_t, so that the files are the same
+   where long is 32-bit and they can be shared by the nodes of a cluster.
+ */
+namespace binary {
+
+  /**
+     Writes a vector preceded by its size.
+     \param out Output stream.
+     \param v Vector. Its elements must have a fixed size.
+   */
+  template <class T>
+  inline void writeVector(std::ofstream &out, std::vector<T> const& v) {
+    int64_t n = v.size();
+    out.write((const char *)&n, sizeof(n));
+    out.write((const char *)v.data(), n * sizeof(T));
+  }
+
+  /**
+     Reads a vector written by writeVector().
+     \param in Input stream.
+     \param v Receives the vector.
+     \return True if it was correctly read.
+   */
+  template <class T>
+  inline bool readVector(std::ifstream &in, std::vector<T> &v) {
+    int64_t n;
+    if (!in.read((char *)&n, sizeof(n)) || n < 0)
+      return false;
+    v.resize(n);
+    return (bool)in.read((char *)v.data(), n * sizeof(T));
+  }
+
+  /**
+     Size and modification time of a file, stored with the files computed from it so that they
+     are not used after it changes.
+     \param fileName File name.
+     \param size Receives the size in bytes.
+     \param time Receives the modification time in nanoseconds.
+     \return True if the file exists.
+   */
+  bool fileStamp(std::string const& fileName, int64_t &size, int64_t &time);
+}
+
+#endif
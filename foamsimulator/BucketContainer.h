@@ -22,6 +22,7 @@
 #include <cmath>
 #include <functional>
 #include <array>
+#include <algorithm>
 
 /**
    \brief Template class that implements a particle container.
@@ -32,6 +33,13 @@
    All the particles are inserted into these buckets. In this way, when performing the search of 
    neighbour particles of a given point, only the particles in the bucket in which this point is 
    placed and the 26 surrounding buckets are evaluated.
+   A container can store only a range of layers (buckets with the same z coordinate) of the
+   domain, so that the domain can be processed in slabs. Bucket coordinates are always those
+   of the whole domain, while bucket indices refer to the stored buckets.
+   Buckets are indexed in linear order (x fastest), but the list of non-empty buckets can be
+   sorted along a Morton curve, so that consecutive buckets of the list are close in space.
+   Once the elements are loaded, an occupancy summary can be built: the number of elements
+   around each bucket, so that empty or sparse neighbourhoods are found without visiting them.
  */
 template <class T>
 class BucketContainer {
@@ -40,6 +48,7 @@ class BucketContainer {
   //long nPoints;
   double xmin, xmax, ymin, ymax, zmin, zmax; // Maximum and minimum coordinates in space
   long nx,ny,nz; // Number of buckets on each dimension
+  long z0, z1; // Range of stored layers: [z0, z1)
   double width; // Size of each bucket
 
   const int nneig = 27;
@@ -74,6 +83,13 @@ class BucketContainer {
   std::vector<std::vector<T>> buckets; // Buckets
   std::vector<std::pair<long, std::vector<T> &>> nebuckets; // Not empty buckets
 
+  // Occupancy summary, with a border of one bucket around the stored ones. Empty if not built
+  std::vector<unsigned> around; // Elements in each bucket and its 26 surrounding buckets
+  std::vector<unsigned long long> aroundBits; // Bitmap of the buckets with some element around
+
+  // Index of some bucket coordinates in the occupancy summary. -1 if they are beyond its border
+  long occupancyIndex(std::array<long,3> const& bp) const;
+
  public:
   /**
      Class constructor. It creates an empty data structure of the given size.
@@ -89,16 +105,65 @@ class BucketContainer {
 		  double ymin, double ymax,
 		  double zmin, double zmax, double h);
 
+  /**
+     Class constructor. It creates an empty data structure that only stores some layers of the domain.
+     \param xmin Domain limits: min x value.
+     \param xmax Domain limits: max x value.
+     \param ymin Domain limits: min y value.
+     \param ymax Domain limits: max y value.
+     \param zmin Domain limits: min z value.
+     \param zmax Domain limits: max z value.
+     \param h Cell size.
+     \param firstLayer First stored layer. It is clamped to the domain.
+     \param lastLayer Layer after the last stored one. It is clamped to the domain.
+   */
+  BucketContainer(double xmin, double xmax,
+		  double ymin, double ymax,
+		  double zmin, double zmax, double h,
+		  long firstLayer, long lastLayer);
+
   /**
      Adds and element given its spatial coordinates.
      \param e Element to be inserted.
      \param x Coordinate x.
      \param y Coordinate y.
      \param z Coordinate z.
-     \return Returns true if the operation is executed correctly.
+     \return Returns true if the operation is executed correctly. False if the element is out of the domain or of the stored layers.
    */
   bool addElement(T e, double  x, double  y, double  z);
 
+  /**
+     Given some spatial coordinates, returns the index of the stored bucket to which it belongs.
+     \param x Coordinate x.
+     \param y Coordinate y.
+     \param z Coordinate z.
+     \return Bucket index. -1 if the point is out of the domain or of the stored layers.
+   */
+  long findBucket(double  x, double  y, double  z) const;
+
+  /**
+     \return Number of buckets of the whole domain on each dimension. Layers are along the z axis.
+   */
+  std::array<long,3> getDimensions() const;
+
+  /**
+     \return First stored layer.
+   */
+  long getFirstLayer() const;
+
+  /**
+     \return Layer after the last stored one.
+   */
+  long getLastLayer() const;
+
+  /**
+     Checks if the bucket of a point and its surrounding buckets are stored, so that the neighbours
+     of the point are the same as in a container of the whole domain.
+     \param pos Point coordinates.
+     \return True if all the surrounding buckets inside the domain are stored.
+   */
+  bool storesNeighbourhood(std::array<double,3> const& pos) const;
+
   /**
      Given some spatial coordinates, return the index of the bucket to which it belongs.
      \param x Coordinate x.
@@ -141,6 +206,58 @@ class BucketContainer {
   */
   std::vector<std::pair<long, std::vector<T> &>> & getNoEmptyBuckets();
 
+  /**
+     Sets the list of non-empty buckets, when the caller already knows them, so that all the
+     buckets are not scanned again.
+     \param nbuckets Indices of the non-empty buckets, in the order of the list.
+  */
+  void setNoEmptyBuckets(std::vector<long> const& nbuckets);
+
+  /**
+     Sorts the list of non-empty buckets along a Morton (Z-order) curve of their coordinates, so
+     that any range of the list is spatially compact. Bucket indices do not change.
+  */
+  void mortonOrder();
+
+  /**
+     Computes the position of a bucket along the Morton curve.
+     \param bp Bucket coordinates.
+     \return Morton code: the bits of the coordinates interleaved.
+  */
+  static unsigned long long getMortonCode(std::array<long,3> const& bp);
+
+  /**
+     Moves the elements of each non-empty bucket to memory allocated by the thread that processes
+     that bucket in the loops over getNoEmptyBuckets() with schedule(runtime). With a static
+     schedule and pinned threads, each thread finds its buckets in its NUMA node. The buckets
+     processed by a thread are allocated in the order of the list.
+  */
+  void firstTouch();
+
+  /**
+     Builds the occupancy summary: the number of elements in the 27 buckets around each bucket
+     and a bitmap of the buckets with some element around. It is discarded when elements are
+     added with addElement() or the list of non-empty buckets is set, and must be built again.
+  */
+  void buildOccupancy();
+
+  /**
+     Given the coordinates of a bucket, returns the number of elements in that bucket and the 26
+     surrounding buckets, those returned by getSurroundingBuckets(). It is taken from the occupancy
+     summary if it is built, otherwise the buckets are visited.
+     \param bp Array with the coordinates of the bucket. They can be out of the domain.
+     \return Number of elements.
+   */
+  long getSurroundingCount(std::array<long,3> const& bp) const;
+
+  /**
+     Given the coordinates of a bucket, checks if there is some element in that bucket or the 26
+     surrounding buckets. With the occupancy summary, only its bitmap is read.
+     \param bp Array with the coordinates of the bucket. They can be out of the domain.
+     \return True if there are elements around.
+   */
+  bool hasSurroundingElements(std::array<long,3> const& bp) const;
+
   /**
      Given a bucket index, return a vector with the elements in that bucket and the 26 surrounding buckets.
      \param nbucket Bucket index.
@@ -155,6 +272,13 @@ class BucketContainer {
    */
   std::vector<std::vector<T> *> getSurroundingBuckets(long nbucket);
 
+  /**
+     Given a bucket index, returns the indices of that bucket and the 26 surrounding buckets.
+     \param nbucket Bucket index.
+     \return Vector of bucket indices.
+   */
+  std::vector<long> getSurroundingBucketNumbers(long nbucket) const;
+
   /**
      Given the coordinates of a bucket, returns a vector of pointers to the pointed bucket and the 26 surrounding buckets.
      \param bp Array with the coordinates of the bucket.
@@ -194,26 +318,80 @@ BucketContainer<T>::BucketContainer(double xmin, double xmax,
   nx = std::floor((xmax - xmin) / h) + 1;
   ny = std::floor((ymax - ymin) / h) + 1;
   nz = std::floor((zmax - zmin) / h) + 1;
+  z0 = 0;
+  z1 = nz;
 
   buckets.resize(nx*ny*nz);
 }
 
+template <class T>
+BucketContainer<T>::BucketContainer(double xmin, double xmax,
+				 double ymin, double ymax,
+				 double zmin, double zmax, double h,
+				 long firstLayer, long lastLayer):
+  xmin(xmin), xmax(xmax),
+  ymin(ymin), ymax(ymax),
+  zmin(zmin), zmax(zmax), width(h){
+
+  // Make subdivisions
+  nx = std::floor((xmax - xmin) / h) + 1;
+  ny = std::floor((ymax - ymin) / h) + 1;
+  nz = std::floor((zmax - zmin) / h) + 1;
+  z0 = std::min(std::max(firstLayer, 0L), nz);
+  z1 = std::min(std::max(lastLayer, z0), nz);
+
+  buckets.resize(nx*ny*(z1 - z0));
+}
 template <class T>
 bool BucketContainer<T>::addElement(T e, double  x, double  y, double  z){
+  long nbucket = findBucket(x, y, z);
+  if(nbucket < 0)
+    return false;
+  buckets.at(nbucket).push_back(e);
+  if(!around.empty())
+    around.clear(); // Outdated summary
+  return true;
+}
+
+template <class T>
+long BucketContainer<T>::findBucket(double  x, double  y, double  z) const {
   if(x <= xmin || x >= xmax ||
      y <= ymin || y >= ymax ||
      z <= zmin || z >= zmax ){
-    return false; // Out of bounds
+    return -1; // Out of bounds
   }
-  int nbucket = getBucketNumber(x, y, z);
-  buckets.at(nbucket).push_back(e);
-  return true;
+  auto coords = getBucketCoords(x, y, z);
+  if(coords[2] < z0 || coords[2] >= z1)
+    return -1; // Layer not stored
+  return coords[0] + nx * coords[1] + nx * ny * (coords[2] - z0);
+}
+
+template <class T>
+std::array<long,3> BucketContainer<T>::getDimensions() const {
+  return std::array<long,3>{nx, ny, nz};
+}
+
+template <class T>
+long BucketContainer<T>::getFirstLayer() const {
+  return z0;
+}
+
+template <class T>
+long BucketContainer<T>::getLastLayer() const {
+  return z1;
+}
+
+template <class T>
+bool BucketContainer<T>::storesNeighbourhood(std::array<double,3> const& pos) const {
+  long vz = getBucketCoords(pos[0], pos[1], pos[2])[2];
+  long lo = std::max(vz - 1, 0L), hi = std::min(vz + 1, nz - 1);
+  return lo > hi || (lo >= z0 && hi < z1);
 }
 
 template <class T>
 long BucketContainer<T>::getBucketNumber(double  x, double  y, double  z) const{
   auto coords = getBucketCoords(x,y,z);
-  return coords[0] + nx * coords[1] + nx * ny * coords[2];
+  return coords[0] + nx * coords[1] + nx * ny * (coords[2] - z0);
 }
 
 template <class T>
@@ -227,7 +405,7 @@ template <class T>
 std::array<long,3> BucketContainer<T>::getBucketCoords(long n) const {
   return std::array<long,3>{ ((n % (nx*ny)) % nx),
     (n % (nx*ny)) / nx,
-    n / (nx*ny)
+    n / (nx*ny) + z0
   };
 }
 
@@ -244,6 +422,110 @@ std::vector<std::vector<T>> & BucketContainer<T>::getBuckets(){
   return buckets;
 }
 
+template <class T>
+void BucketContainer<T>::firstTouch(){
+  auto &ne = getNoEmptyBuckets();
+#pragma omp parallel for schedule(runtime)
+  for(long nebucket=0; nebucket < ne.size(); nebucket++){
+    std::vector<T> &bucket = ne[nebucket].second;
+    std::vector<T>(bucket).swap(bucket);
+  }
+}
+
+template <class T>
+long BucketContainer<T>::occupancyIndex(std::array<long,3> const& bp) const {
+  if(bp[0] < -1 || bp[0] > nx ||
+     bp[1] < -1 || bp[1] > ny ||
+     bp[2] < z0 - 1 || bp[2] > z1)
+    return -1;
+  return (bp[0] + 1) + (nx + 2) * ((bp[1] + 1) + (ny + 2) * (bp[2] - z0 + 1));
+}
+
+template <class T>
+void BucketContainer<T>::buildOccupancy(){
+  long px = nx + 2, py = ny + 2, pz = z1 - z0 + 2, ntotal = px * py * pz;
+  std::vector<unsigned> count(ntotal, 0);
+  for(long nbucket=0; nbucket < buckets.size(); nbucket++)
+    if(buckets[nbucket].size() > 0)
+      count[occupancyIndex(getBucketCoords(nbucket))] = buckets[nbucket].size();
+
+  // Sums of three buckets along each axis, one after the other
+  around.resize(ntotal);
+  auto boxSum = [&](long stride, long extent){
+#pragma omp parallel for
+    for(long i=0; i < ntotal; i++){
+      long c = (i / stride) % extent;
+      unsigned s = count[i];
+      if(c > 0)
+        s += count[i - stride];
+      if(c < extent - 1)
+        s += count[i + stride];
+      around[i] = s;
+    }
+    count.swap(around);
+  };
+  boxSum(1, px);
+  boxSum(px, py);
+  boxSum(px * py, pz);
+  around.swap(count);
+
+  aroundBits.assign((ntotal + 63) / 64, 0);
+  for(long i=0; i < ntotal; i++)
+    if(around[i] > 0)
+      aroundBits[i / 64] |= 1ULL << (i % 64);
+}
+
+template <class T>
+long BucketContainer<T>::getSurroundingCount(std::array<long,3> const& bp) const {
+  if(!around.empty()){
+    long i = occupancyIndex(bp);
+    return i < 0 ? 0 : around[i];
+  }
+  long n = 0;
+  for(long i=0; i<nneig; i++){
+    long vx = bp[0] + addvals[i][0],
+      vy = bp[1] + addvals[i][1],
+      vz = bp[2] + addvals[i][2];
+    if(vx>=0 && vx<nx &&
+       vy>=0 && vy<ny &&
+       vz>=z0 && vz<z1){
+      n += buckets[vx + nx * vy + nx * ny * (vz - z0)].size();
+    }
+  }
+  return n;
+}
+
+template <class T>
+bool BucketContainer<T>::hasSurroundingElements(std::array<long,3> const& bp) const {
+  if(!around.empty()){
+    long i = occupancyIndex(bp);
+    return i >= 0 && (aroundBits[i / 64] >> (i % 64) & 1);
+  }
+  return getSurroundingCount(bp) > 0;
+}
+
+template <class T>
+void BucketContainer<T>::mortonOrder(){
+  std::vector<std::pair<unsigned long long, long>> keys;
+  for(auto &nb : getNoEmptyBuckets())
+    keys.push_back(std::make_pair(getMortonCode(getBucketCoords(nb.first)), nb.first));
+  std::sort(keys.begin(), keys.end());
+
+  // The pairs hold references, so the list is built again
+  nebuckets.clear();
+  for(auto &k : keys)
+    nebuckets.push_back(std::make_pair(k.second, std::ref(buckets[k.second])));
+}
+
+template <class T>
+unsigned long long BucketContainer<T>::getMortonCode(std::array<long,3> const& bp){
+  unsigned long long code = 0;
+  for(int b=0; b<21; b++)
+    for(int d=0; d<3; d++)
+      code |= (unsigned long long)((bp[d] >> b) & 1) << (3 * b + d);
+  return code;
+}
+
 template <class T>
 std::vector<std::pair<long, std::vector<T> &>> & BucketContainer<T>::getNoEmptyBuckets(){
   if(nebuckets.size() == 0){ 
@@ -257,6 +539,14 @@ std::vector<std::pair<long, std::vector<T> &>> & BucketContainer<T>::getNoEmptyB
   return nebuckets;
 }
 
+template <class T>
+void BucketContainer<T>::setNoEmptyBuckets(std::vector<long> const& nbuckets){
+  nebuckets.clear();
+  around.clear();
+  for(long nbucket : nbuckets)
+    nebuckets.push_back(std::make_pair(nbucket, std::ref(buckets[nbucket])));
+}
+
 template <class T>
 std::vector<T> BucketContainer<T>::getSurroundingElements(long nbucket){
   auto buckets = getSurroundingBuckets(nbucket);
@@ -274,6 +564,24 @@ std::vector<std::vector<T> *> BucketContainer<T>::getSurroundingBuckets(long nbu
   return getSurroundingBuckets(getBucketCoords(nbucket));
 }
 
+template <class T>
+std::vector<long> BucketContainer<T>::getSurroundingBucketNumbers(long nbucket) const {
+  auto bp = getBucketCoords(nbucket);
+  std::vector<long> retvec;
+
+  for(long i=0; i<nneig; i++){
+    long vx = bp[0] + addvals[i][0],
+      vy = bp[1] + addvals[i][1],
+      vz = bp[2] + addvals[i][2];
+    if(vx>=0 && vx<nx &&
+       vy>=0 && vy<ny &&
+       vz>=z0 && vz<z1){
+      retvec.push_back(vx + nx * vy + nx * ny * (vz - z0));
+    }
+  }
+  return retvec;
+}
+
 template <class T>
 std::vector<std::vector<T> *> BucketContainer<T>::getSurroundingBuckets(std::array<long,3> bp){
   std::vector<std::vector<T> *> retvec;
@@ -284,8 +592,8 @@ std::vector<std::vector<T> *> BucketContainer<T>::getSurroundingBuckets(std::arr
       vz = bp[2] + addvals[i][2];
     if(vx>=0 && vx<nx &&
        vy>=0 && vy<ny &&
-       vz>=0 && vz<nz){
-      retvec.push_back(&buckets[vx + nx * vy + nx * ny * vz]);
+       vz>=z0 && vz<z1){
+      retvec.push_back(&buckets[vx + nx * vy + nx * ny * (vz - z0)]);
     }
   }
   return retvec;
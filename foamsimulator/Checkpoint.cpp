@@ -0,0 +1,82 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#include "Checkpoint.h"
+#include "BinaryFile.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#define _SILENCE_EXPERIMENTAL_FILESYSTEM_DEPRECATION_WARNING
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+
+#define MAGIC "VSPHCKP2"
+
+bool Checkpoint::write(std::string const &fileName) const {
+  std::ostringstream genState;
+  genState << gen;
+  std::string state = genState.str();
+  int64_t id = difId, stateSize = state.size();
+
+  // Written to a temporary file first, so that a process killed while writing does not
+  // destroy the previous checkpoint
+  std::string tmpName = fileName + ".tmp";
+  {
+    std::ofstream out(tmpName, std::ios::binary | std::ios::trunc);
+    out.write(MAGIC, std::strlen(MAGIC));
+    out.write((const char *)&nstep, sizeof(nstep));
+    out.write((const char *)&id, sizeof(id));
+    out.write((const char *)&stateSize, sizeof(stateSize));
+    out.write(state.data(), stateSize);
+    binary::writeVector(out, posit);
+    binary::writeVector(out, vel);
+    binary::writeVector(out, ids);
+    binary::writeVector(out, ttl);
+    binary::writeVector(out, density);
+    if (!out.good())
+      return false;
+  }
+
+  std::error_code ec;
+  fs::rename(tmpName, fileName, ec);
+  return !ec;
+}
+
+bool Checkpoint::read(std::string const &fileName) {
+  std::ifstream in(fileName, std::ios::binary);
+  char magic[sizeof(MAGIC)] = {0};
+  int64_t id, stateSize;
+
+  if (!in.read(magic, std::strlen(MAGIC)) || std::string(magic) != MAGIC ||
+      !in.read((char *)&nstep, sizeof(nstep)) ||
+      !in.read((char *)&id, sizeof(id)) ||
+      !in.read((char *)&stateSize, sizeof(stateSize)) || stateSize < 0)
+    return false;
+  difId = id;
+
+  std::string state(stateSize, ' ');
+  if (!in.read(&state[0], stateSize))
+    return false;
+  std::istringstream genState(state);
+  genState >> gen;
+
+  return binary::readVector(in, posit) && binary::readVector(in, vel) &&
+         binary::readVector(in, ids) && binary::readVector(in, ttl) &&
+         binary::readVector(in, density) && posit.size() == ids.size() &&
+         vel.size() == ids.size() && ttl.size() == ids.size() &&
+         density.size() == ids.size();
+}
@@ -0,0 +1,55 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <array>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+   \brief State of the simulation between two steps: the diffuse particles, the next particle
+   id and the random generator. A simulation stopped at a step can be resumed from it with the
+   same result as if it had not stopped.
+ */
+struct Checkpoint {
+  int nstep = 0;                                ///< Next step to simulate.
+  long difId = 0;                               ///< Id of the next diffuse particle.
+  std::mt19937 gen;                             ///< Random generator.
+  std::vector<std::array<double,3>> posit,      ///< Positions of the diffuse particles.
+    vel;                                        ///< Velocities of the diffuse particles.
+  std::vector<int> ids,                         ///< Ids of the diffuse particles.
+    ttl;                                        ///< Remaining lifetime of the diffuse particles.
+  std::vector<double> density;                  ///< Fluid density around the diffuse particles.
+
+  /**
+     Writes the checkpoint to a binary file. It is written to a temporary file that is renamed
+     at the end, so that the previous checkpoint is kept until the new one is complete.
+     \param fileName File name.
+     \return True if the file was correctly written.
+   */
+  bool write(std::string const& fileName) const;
+
+  /**
+     Reads a checkpoint from a file written by write().
+     \param fileName File name.
+     \return True if the file was correctly read.
+   */
+  bool read(std::string const& fileName);
+};
+
+#endif
@@ -0,0 +1,254 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "ConfigFile.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <stdexcept>
+
+#include <vtkSmartPointer.h>
+#include <vtkXMLDataElement.h>
+#include <vtkXMLUtilities.h>
+
+namespace config {
+
+  // Removes the leading and trailing blanks
+  static std::string strip(std::string const &s) {
+    size_t first = s.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos)
+      return "";
+    size_t last = s.find_last_not_of(" \t\r\n");
+    return s.substr(first, last - first + 1);
+  }
+
+  static std::string lower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(),
+                   [](unsigned char c) { return std::tolower(c); });
+    return s;
+  }
+
+  long toLong(std::string const &value) {
+    size_t n;
+    long v = std::stol(value, &n);
+    if (n != value.size())
+      throw std::invalid_argument(value);
+    return v;
+  }
+
+  double toDouble(std::string const &value) {
+    size_t n;
+    double v = std::stod(value, &n);
+    if (n != value.size())
+      throw std::invalid_argument(value);
+    return v;
+  }
+
+  int toBool(std::string const &value) {
+    std::string v = lower(value);
+    if (v == "1" || v == "yes" || v == "true" || v == "on")
+      return 1;
+    if (v == "0" || v == "no" || v == "false" || v == "off")
+      return 0;
+    throw std::invalid_argument(value);
+  }
+
+  bool readIni(std::string const &fileName, Ini &ini) {
+    std::ifstream in(fileName);
+    if (!in) {
+      std::cerr << "Error opening " << fileName << std::endl;
+      return false;
+    }
+
+    std::string line, section;
+    for (int nline = 1; std::getline(in, line); nline++) {
+      line = strip(line);
+      if (line.empty() || line[0] == '#' || line[0] == ';')
+        continue;
+
+      if (line[0] == '[') {
+        if (line.back() != ']') {
+          std::cerr << "Error reading config file " << fileName << ", line " << nline
+                    << ": " << line << std::endl;
+          return false;
+        }
+        section = strip(line.substr(1, line.size() - 2));
+        ini[section];
+        continue;
+      }
+
+      size_t sep = line.find_first_of("=:");
+      if (sep == std::string::npos || sep == 0 || section.empty()) {
+        std::cerr << "Error reading config file " << fileName << ", line " << nline << ": "
+                  << line << std::endl;
+        return false;
+      }
+      ini[section][lower(strip(line.substr(0, sep)))] = strip(line.substr(sep + 1));
+    }
+    return true;
+  }
+
+  // Nested element following a path of names, or nullptr if any of them is missing
+  static vtkXMLDataElement *find(vtkXMLDataElement *e,
+                                 std::initializer_list<const char *> path) {
+    for (auto name : path) {
+      if (e == nullptr)
+        break;
+      e = e->FindNestedElementWithName(name);
+    }
+    return e;
+  }
+
+  // Reads a real attribute of an element. Throws std::invalid_argument if it is missing.
+  static double attribute(vtkXMLDataElement *e, const char *element, const char *name) {
+    if (e == nullptr || e->GetAttribute(name) == nullptr)
+      throw std::invalid_argument(std::string(element) + " " + name);
+    return toDouble(e->GetAttribute(name));
+  }
+
+  bool readXml(std::string const &fileName, SimulationParams &sp, bool domain) {
+    vtkXMLDataElement *root = vtkXMLUtilities::ReadElementFromFile(fileName.c_str());
+    if (root == nullptr) {
+      std::cerr << "Error opening " << fileName << std::endl;
+      return false;
+    }
+
+    bool ok = true;
+    try {
+      sp.h = attribute(find(root, {"execution", "constants", "h"}), "h", "value");
+      sp.mass = attribute(find(root, {"execution", "constants", "massfluid"}), "massfluid",
+                          "value");
+
+      vtkXMLDataElement *parameters = find(root, {"execution", "parameters"}), *timeOut = nullptr;
+      for (int i = 0; parameters != nullptr && i < parameters->GetNumberOfNestedElements(); i++) {
+        vtkXMLDataElement *p = parameters->GetNestedElement(i);
+        if (p->GetAttribute("key") != nullptr && std::string(p->GetAttribute("key")) == "TimeOut")
+          timeOut = p;
+      }
+      sp.TIMESTEP = attribute(timeOut, "TimeOut", "value");
+
+      if (domain) {
+        vtkXMLDataElement *pmin = find(root, {"casedef", "geometry", "definition", "pointmin"}),
+                          *pmax = find(root, {"casedef", "geometry", "definition", "pointmax"});
+        sp.MINX = attribute(pmin, "pointmin", "x");
+        sp.MINY = attribute(pmin, "pointmin", "y");
+        sp.MINZ = attribute(pmin, "pointmin", "z");
+        sp.MAXX = attribute(pmax, "pointmax", "x");
+        sp.MAXY = attribute(pmax, "pointmax", "y");
+        sp.MAXZ = attribute(pmax, "pointmax", "z");
+      }
+    } catch (std::exception &e) {
+      std::cerr << "Error reading " << e.what() << " from " << fileName << std::endl;
+      ok = false;
+    }
+
+    root->Delete();
+    return ok;
+  }
+
+  bool readParams(std::string const &fileName, SimulationParams &sp) {
+    Ini ini;
+    if (!readIni(fileName, ini))
+      return false;
+
+    std::string section, key;
+    bool found = false;
+    // Value of a key, throws std::out_of_range if it is missing
+    auto get = [&](const char *s, const char *k) -> std::string const & {
+      section = s;
+      key = k;
+      found = false;
+      auto is = ini.find(s);
+      if (is == ini.end())
+        throw std::out_of_range(s);
+      auto ik = is->second.find(lower(k));
+      if (ik == is->second.end())
+        throw std::out_of_range(k);
+      found = true;
+      return ik->second;
+    };
+
+    try {
+      sp.dataPath = get("PATHS", "InputDataPath");
+      sp.filePrefix = get("PATHS", "InputFilesPrefix");
+      sp.nzeros = toLong(get("PATHS", "ZeroPadding"));
+      sp.outputPath = get("PATHS", "OutputDataPath");
+      sp.outputPreffix = get("PATHS", "FilesOutputPrefix");
+      sp.exclusionZoneFile = get("PATHS", "ExclusionZoneFile");
+      std::string xmlFile = get("PATHS", "XmlFile");
+
+      sp.text_files = toBool(get("OUTPUT", "TextFiles"));
+      sp.vtk_files = toBool(get("OUTPUT", "VtkFiles"));
+      sp.vtk_diffuse_data = toBool(get("OUTPUT", "VtkDiffuseData"));
+      sp.vtk_fluid_data = toBool(get("OUTPUT", "VtkFluidData"));
+
+      sp.nstart = toLong(get("TIMESTEPS", "StartingTimeStep"));
+      sp.nend = toLong(get("TIMESTEPS", "EndingTimeStep"));
+
+      sp.MINTA = toDouble(get("FOAMPARAMETERS", "MinTrappedAirThreshold"));
+      sp.MAXTA = toDouble(get("FOAMPARAMETERS", "MaxTrappedAirThreshold"));
+      sp.MINWC = toDouble(get("FOAMPARAMETERS", "MinWaveCrestsThreshold"));
+      sp.MAXWC = toDouble(get("FOAMPARAMETERS", "MaxWaveCrestsThreshold"));
+      sp.MINK = toDouble(get("FOAMPARAMETERS", "MinKineticEnergyThreshold"));
+      sp.MAXK = toDouble(get("FOAMPARAMETERS", "MaxKineticEnergyThreshold"));
+      sp.KTA = toDouble(get("FOAMPARAMETERS", "DiffuseTrappedAirMultiplier"));
+      sp.KWC = toDouble(get("FOAMPARAMETERS", "DiffuseWaveCrestsMultiplier"));
+      sp.SPRAY = toDouble(get("FOAMPARAMETERS", "SprayDensity"));
+      sp.BUBBLES = toDouble(get("FOAMPARAMETERS", "BubblesDensity"));
+      sp.LIFEFIME = toDouble(get("FOAMPARAMETERS", "LifefimeMultiplier"));
+      sp.KB = toDouble(get("FOAMPARAMETERS", "BuoyancyControl"));
+      sp.KD = toDouble(get("FOAMPARAMETERS", "DragControl"));
+
+      bool customDomain = toBool(get("DOMAIN", "CustomDomain"));
+      if (customDomain) {
+        sp.MINX = toDouble(get("DOMAIN", "DomainMinx"));
+        sp.MINY = toDouble(get("DOMAIN", "DomainMiny"));
+        sp.MINZ = toDouble(get("DOMAIN", "DomainMinz"));
+        sp.MAXX = toDouble(get("DOMAIN", "DomainMaxx"));
+        sp.MAXY = toDouble(get("DOMAIN", "DomainMaxy"));
+        sp.MAXZ = toDouble(get("DOMAIN", "DomainMaxz"));
+        if (sp.MINX >= sp.MAXX || sp.MINY >= sp.MAXY || sp.MINZ >= sp.MAXZ) {
+          std::cerr << "Error: domain not valid." << std::endl;
+          return false;
+        }
+      }
+
+      // Optional advanced settings
+      auto advanced = ini.find("ADVANCED");
+      if (advanced != ini.end())
+        for (auto &kv : advanced->second)
+          if (!sp.setOption(kv.first, kv.second)) {
+            std::cerr << "Invalid advanced option '" << kv.first << "' = " << kv.second
+                      << std::endl;
+            return false;
+          }
+
+      return readXml(xmlFile, sp, !customDomain);
+
+    } catch (std::exception &) {
+      if (!found)
+        std::cerr << "Error reading '" << key << "' parameter of the [" << section
+                  << "] section." << std::endl;
+      else // Not a number or out of range
+        std::cerr << "Error parsing numerical parameter: " << key << " = "
+                  << ini[section][lower(key)] << std::endl;
+    }
+    return false;
+  }
+}
@@ -0,0 +1,89 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CONFIGFILE_H
+#define CONFIGFILE_H
+
+#include <map>
+#include <string>
+
+#include "SimulationParams.h"
+
+/**
+   \brief This namespace reads the simulation parameters from the configuration file (see
+   example.ini) and from the XML file of the DualSPHysics case, as foam.py does.
+   Errors are reported to the standard error output.
+ */
+namespace config {
+
+  /**
+     Contents of an ini file: the keys and values of each section. Section names are case
+     sensitive and keys are stored in lower case, as in Python's configparser.
+   */
+  typedef std::map<std::string, std::map<std::string, std::string>> Ini;
+
+  /**
+     Reads an ini file. Lines starting with '#' or ';' are comments and both '=' and ':'
+     separate keys from values.
+     \param fileName File name.
+     \param ini Read sections.
+     \return False if the file cannot be read or has a syntax error.
+   */
+  bool readIni(std::string const& fileName, Ini &ini);
+
+  /**
+     Reads the smoothing length, the fluid particle mass and the output time step from the
+     XML file of a DualSPHysics case, and optionally the domain limits.
+     \param fileName File name.
+     \param sp Simulation parameters.
+     \param domain Points if the domain limits (pointmin and pointmax) are read too.
+     \return False if the file cannot be read or a value is missing.
+   */
+  bool readXml(std::string const& fileName, SimulationParams &sp, bool domain);
+
+  /**
+     Reads all the simulation parameters from a configuration file and the XML file it
+     points to.
+     \param fileName Configuration file name.
+     \param sp Simulation parameters.
+     \return False if a parameter is missing or not valid.
+   */
+  bool readParams(std::string const& fileName, SimulationParams &sp);
+
+  /**
+     Parses a whole string as an integer.
+     \param value Text.
+     \return Value. Throws std::invalid_argument if the text is not an integer.
+   */
+  long toLong(std::string const& value);
+
+  /**
+     Parses a whole string as a real number.
+     \param value Text.
+     \return Value. Throws std::invalid_argument if the text is not a number.
+   */
+  double toDouble(std::string const& value);
+
+  /**
+     Parses a boolean value with the same words accepted by Python's configparser: 1, yes,
+     true, on and 0, no, false, off.
+     \param value Text.
+     \return 1 or 0. Throws std::invalid_argument if the text is not a boolean.
+   */
+  int toBool(std::string const& value);
+}
+
+#endif
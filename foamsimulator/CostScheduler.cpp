@@ -0,0 +1,103 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "CostScheduler.h"
+
+#include <algorithm>
+
+// Chunks of each thread: enough to correct the errors of the cost model by stealing
+#define CHUNKS_PER_THREAD 8
+
+CostScheduler::CostScheduler() : balanced(false), n(0), nblocks(0) {}
+
+void CostScheduler::setBalanced(bool balanced) { this->balanced = balanced; }
+
+void CostScheduler::split(std::vector<double> const &cost) {
+  double total = 0;
+  for (double c : cost)
+    total += c;
+
+  // Chunk boundaries at the same fractions of the accumulated cost
+  nblocks = omp_get_max_threads();
+  long nchunks = std::min<long>(n, (long)nblocks * CHUNKS_PER_THREAD);
+  bounds.assign(1, 0);
+  double acc = 0;
+  for (long i = 0; i < n && (long)bounds.size() < nchunks; i++) {
+    acc += cost[i];
+    if (acc * nchunks >= total * bounds.size())
+      bounds.push_back(i + 1);
+  }
+  if (bounds.back() != n)
+    bounds.push_back(n);
+  nchunks = bounds.size() - 1;
+
+  blocks.reset(new Block[nblocks]);
+  restart();
+}
+
+void CostScheduler::restart() {
+  busy.assign(busy.size(), -1);
+  if (!balanced)
+    return;
+
+  // Contiguous blocks of chunks, to keep the neighbouring cells in the same thread
+  long nchunks = bounds.size() - 1;
+  for (int b = 0; b < nblocks; b++) {
+    blocks[b].first = nchunks * b / nblocks;
+    blocks[b].last = nchunks * (b + 1) / nblocks;
+  }
+}
+
+long CostScheduler::next(int thread) {
+  if (thread < nblocks) {
+    Block &own = blocks[thread];
+    std::lock_guard<std::mutex> guard(own.lock);
+    if (own.first < own.last)
+      return own.first++;
+  }
+
+  // Steal from the back of the block with more chunks left
+  while (true) {
+    int victim = -1;
+    long left = 0;
+    for (int b = 0; b < nblocks; b++) {
+      long l = blocks[b].last - blocks[b].first; // Only a hint, checked under the lock
+      if (l > left) {
+        left = l;
+        victim = b;
+      }
+    }
+    if (victim < 0)
+      return -1;
+    Block &block = blocks[victim];
+    std::lock_guard<std::mutex> guard(block.lock);
+    if (block.first < block.last)
+      return --block.last;
+  }
+}
+
+double CostScheduler::imbalance() const {
+  double sum = 0, max = 0;
+  int nthreads = 0;
+  for (double t : busy) {
+    if (t < 0)
+      continue;
+    sum += t;
+    max = std::max(max, t);
+    nthreads++;
+  }
+  return sum > 0 ? max * nthreads / sum - 1 : 0;
+}
@@ -0,0 +1,146 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COSTSCHEDULER_H
+#define COSTSCHEDULER_H
+
+#include <omp.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+   \brief Scheduler of the loops whose iterations have a very different cost, like the loops
+   over the cells of the fluid, where a dense cell at the bottom of the tank costs much more
+   than a cell at the surface.
+   When it is balanced, the iterations are split into chunks of consecutive iterations with
+   about the same estimated cost, and the chunks are dealt to the threads in contiguous blocks.
+   Each thread executes the chunks of its block from the front and, when it runs out of them,
+   steals chunks from the back of the block with more chunks left. Otherwise, the loop is an
+   OpenMP worksharing loop with the runtime schedule.
+   In both cases the busy time of each thread is measured, to report the load imbalance.
+ */
+class CostScheduler {
+
+ public:
+  /**
+     Class constructor. The scheduler is not balanced by default.
+   */
+  CostScheduler();
+
+  /**
+     Enables the cost-balanced chunks and the work stealing.
+     \param balanced True to enable them.
+   */
+  void setBalanced(bool balanced);
+
+  /**
+     Prepares a loop. Must be called outside parallel regions.
+     \param n Number of iterations.
+     \param cost Function that returns the estimated cost of an iteration. Only evaluated if
+     the scheduler is balanced.
+   */
+  template <class C>
+  void plan(long n, C cost);
+
+  /**
+     Prepares the last planned loop to run again, with the same chunks. Must be called
+     outside parallel regions.
+   */
+  void restart();
+
+  /**
+     Runs the loop prepared by plan(). Must be called by all the threads of a parallel region.
+     There is no barrier at the end.
+     \param body Function called with the number of each iteration.
+   */
+  template <class F>
+  void loop(F body);
+
+  /**
+     \return Load imbalance of the last loop: busy time of the slowest thread over the mean
+     busy time, minus one.
+   */
+  double imbalance() const;
+
+ private:
+  typedef std::chrono::steady_clock clock;
+
+  /**
+     Chunks not executed yet of a thread, padded to its own cache line.
+   */
+  struct Block {
+    std::mutex lock;
+    std::atomic<long> first, last;
+    char pad[64];
+  };
+
+  bool balanced;
+  long n;
+  std::vector<long> bounds;       // First iteration of each chunk
+  std::unique_ptr<Block[]> blocks;
+  int nblocks;
+  std::vector<double> busy;       // Busy time of each thread in the last loop
+
+  /**
+     Splits the iterations into chunks of about the same cost and deals them to the threads.
+   */
+  void split(std::vector<double> const& cost);
+
+  /**
+     Takes the next chunk for a thread: from its block or stolen from another one.
+     \return Chunk number, -1 if there are no chunks left.
+   */
+  long next(int thread);
+};
+
+template <class C>
+void CostScheduler::plan(long n, C cost) {
+  this->n = n;
+  busy.assign(omp_get_max_threads(), -1);
+  if (!balanced)
+    return;
+
+  std::vector<double> costs(n);
+#pragma omp parallel for schedule(static)
+  for (long i = 0; i < n; i++)
+    costs[i] = cost(i);
+  split(costs);
+}
+
+template <class F>
+void CostScheduler::loop(F body) {
+  auto start = clock::now();
+  int thread = omp_get_thread_num();
+
+  if (!balanced) {
+#pragma omp for schedule(runtime) nowait
+    for (long i = 0; i < n; i++)
+      body(i);
+  } else {
+    for (long c = next(thread); c >= 0; c = next(thread))
+      for (long i = bounds[c]; i < bounds[c + 1]; i++)
+        body(i);
+  }
+
+  if (thread < busy.size())
+    busy[thread] = std::chrono::duration<double>(clock::now() - start).count();
+}
+
+#endif
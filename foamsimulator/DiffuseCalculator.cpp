@@ -18,12 +18,16 @@
 
 #include "DiffuseCalculator.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstdio>
 #include <fstream>
 #include <functional>
+#include <iomanip>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <numeric>
 #include <random>
 #include <vector>
@@ -52,14 +56,161 @@ namespace fs = std::experimental::filesystem;
 #include <vtkPolyDataWriter.h>
 #include <vtkSTLWriter.h>
 
+#include "BinaryFile.h"
+#include "Checkpoint.h"
+#include "FileWatcher.h"
 #include "FluidData.h"
+#include "FrameFarm.h"
+#include "Memory.h"
+#include "Parallel.h"
+#include "VolumeWriter.h"
 #include "VtkDWriter.h"
 
 #include "BucketContainer.h"
 
 #include "Ops.h"
+#include "StreamStats.h"
+#include "Trace.h"
+#include "VelocityGrid.h"
 
 #define SURFACE 0.75
+#define EMISSION_BINS 16 // Emission histogram: 1, 2, ... 15 and 16 or more particles
+
+// Memory of each particle, in bytes
+#define POOL_BYTES (2 * sizeof(std::array<double, 3>) + 2 * sizeof(int) + sizeof(double)) // Diffuse particle
+#define NEW_BYTES (POOL_BYTES + 3 * sizeof(double)) // New diffuse particle, with its random numbers
+#define SLAB_HALO 3 // Layers of cells around a slab: wave crests need the gradient of the neighbours, and it the color field of theirs
+#define DIFFUSE_RECORD 9 // Doubles of a diffuse particle sent to another process: position, velocity, id, lifetime and density
+
+#define VTK_POINT_BYTES (3 * sizeof(float) + 2 * sizeof(vtkIdType)) // Point and vertex cell in a vtk file
+
+// Size of a file in bytes. Zero if it does not exist.
+static long long fileBytes(std::string const &fileName) {
+  std::error_code ec;
+  auto size = fs::file_size(fileName, ec);
+  return ec ? 0 : size;
+}
+
+// Loads the fluid particles of a step from its cache file, if there is one, or else from the vtk
+// file, updating the grid of the previous step if asked. Returns the bytes read, -1 on error
+static long long loadFluid(FluidData &file, std::string const &cachePath,
+                           std::string const &fileName, bool update) {
+  if (cachePath != "") {
+    std::string cacheName = FluidData::cacheFileName(cachePath, fileName);
+    if (fs::exists(cacheName)) {
+      if (file.loadCache(cacheName, fileName))
+        return fileBytes(cacheName);
+      std::cerr << "WARNING: the vtk file is read instead." << std::endl;
+    }
+  }
+  bool loaded = update ? file.updateFile(fileName) : file.loadFile(fileName);
+  return loaded ? fileBytes(fileName) : -1;
+}
+
+// Appends a diffuse particle of a state or an emission to a buffer of records
+template <class T>
+static void packDiffuse(T const &d, long i, std::vector<double> &buffer) {
+  buffer.insert(buffer.end(), {d.posit[i][0], d.posit[i][1], d.posit[i][2], d.vel[i][0],
+                               d.vel[i][1], d.vel[i][2], (double)d.ids[i], (double)d.ttl[i],
+                               d.density[i]});
+}
+
+// Appends the diffuse particles of a buffer of records to a state or an emission
+template <class T>
+static void unpackDiffuse(std::vector<double> const &buffer, T &d) {
+  for (long i = 0; i + DIFFUSE_RECORD <= buffer.size(); i += DIFFUSE_RECORD) {
+    const double *r = &buffer[i];
+    d.posit.push_back({{r[0], r[1], r[2]}});
+    d.vel.push_back({{r[3], r[4], r[5]}});
+    d.ids.push_back(r[6]);
+    d.ttl.push_back(r[7]);
+    d.density.push_back(r[8]);
+  }
+}
+
+// Sends the diffuse particles of a state or an emission to the process that owns their position
+template <class T, class F>
+static void migrateDiffuse(T &d, F owner) {
+  int rank = parallel::rank();
+  std::vector<std::vector<double>> send(parallel::size());
+  T kept;
+  for (long i = 0; i < d.ids.size(); i++) {
+    int p = owner(d.posit[i]);
+    if (p == rank) {
+      kept.posit.push_back(d.posit[i]);
+      kept.vel.push_back(d.vel[i]);
+      kept.ids.push_back(d.ids[i]);
+      kept.ttl.push_back(d.ttl[i]);
+      kept.density.push_back(d.density[i]);
+    } else {
+      packDiffuse(d, i, send[p]);
+    }
+  }
+
+  std::vector<double> recv;
+  parallel::exchange(send, recv);
+  unpackDiffuse(recv, kept);
+
+  d.posit = std::move(kept.posit);
+  d.vel = std::move(kept.vel);
+  d.ids = std::move(kept.ids);
+  d.ttl = std::move(kept.ttl);
+  d.density = std::move(kept.density);
+}
+
+// Collects the diffuse particles of all the processes in the first one
+static void gatherDiffuse(Checkpoint &state) {
+  std::vector<double> send, recv;
+  for (long i = 0; i < state.ids.size(); i++)
+    packDiffuse(state, i, send);
+  parallel::gather(send, recv);
+
+  state.posit.clear();
+  state.vel.clear();
+  state.ids.clear();
+  state.ttl.clear();
+  state.density.clear();
+  unpackDiffuse(recv, state);
+}
+
+// Advances a random generator past the numbers of some diffuse particles (three for each in stage 6)
+static void skipRandom(std::mt19937 &gen, long long ndiffuse) {
+  std::uniform_real_distribution<> xunif(0, 1);
+  for (long long i = 0; i < ndiffuse * 3; i++)
+    xunif(gen);
+}
+
+// Silences the console while it exists
+struct ConsoleGuard {
+  std::streambuf *out, *err;
+  bool quiet;
+
+  ConsoleGuard(bool q) : out(std::cout.rdbuf()), err(std::cerr.rdbuf()), quiet(q) {
+    if (quiet) {
+      std::cout.rdbuf(nullptr);
+      std::cerr.rdbuf(nullptr);
+    }
+  }
+
+  ~ConsoleGuard() {
+    if (quiet) {
+      std::cout.rdbuf(out);
+      std::cerr.rdbuf(err);
+      std::cout.clear();
+      std::cerr.clear();
+    }
+  }
+};
+
+// Name of a file written by each process: the rank is appended when there are several
+static std::string rankFileName(std::string const &fileName) {
+  if (parallel::size() == 1)
+    return fileName;
+  fs::path p(fileName);
+  return (p.parent_path() /
+          (p.stem().string() + "_r" + std::to_string(parallel::rank()) + p.extension().string()))
+      .generic_string();
+}
 
 // Clamping function
 #ifndef _MSVC
@@ -162,418 +313,1401 @@ double DiffuseCalculator::solveEq(double px, double py, double pz, double vx,
 // Constructor
 DiffuseCalculator::DiffuseCalculator(SimulationParams p) : sp(p) {}
 
-void DiffuseCalculator::runSimulation() {
-  std::string seqnum(sp.nzeros, '0'),
-      formats = std::string("%.") + std::to_string(sp.nzeros) + std::string("d");
+Profiler const &DiffuseCalculator::getProfiler() const { return prof; }
 
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  std::uniform_real_distribution<> xunif(0, 1);
+void DiffuseCalculator::setupThreads() {
+  omp_set_schedule(sp.numaFirstTouch ? omp_sched_static : omp_sched_guided, 0);
+  if (sp.numaFirstTouch)
+    std::cout << "NUMA nodes: " << numa::nodes() << std::endl;
+  if (sp.pinThreads != "" && !numa::pinThreads(sp.pinThreads))
+    std::cerr << "WARNING: the threads cannot be pinned." << std::endl;
+  sched.setBalanced(sp.balancedScheduler);
+}
 
-  long difId = 0;
+void DiffuseCalculator::arrangeFluid(BucketContainer<particle> &f) {
+  if (sp.cellOrder == "morton")
+    f.mortonOrder();
+  if (sp.numaFirstTouch || sp.cellOrder == "morton")
+    f.firstTouch();
+  f.buildOccupancy();
+}
 
-  // Persistent particle vector
-  std::vector<std::array<double, 3>> ppPosit, ppVel;
-  std::vector<int> ppIds, ppTTL;
-  std::vector<double> ppDensity;
+// Indices of the diffuse particles sorted along the Morton curve of their cells, so that
+// consecutive particles look at the same fluid buckets.
+static void sortByCell(BucketContainer<particle> &f, std::vector<std::array<double, 3>> const &posit,
+                       std::vector<long> const *index, std::vector<long> &sorted) {
+  long n = index != nullptr ? index->size() : posit.size();
+  std::vector<std::pair<unsigned long long, long>> keys(n);
+#pragma omp parallel for
+  for (long k = 0; k < n; k++) {
+    long i = index != nullptr ? (*index)[k] : k;
+    auto bp = f.getBucketCoords(posit[i][0], posit[i][1], posit[i][2]);
+    keys[k] = std::make_pair(BucketContainer<particle>::getMortonCode(bp), i);
+  }
+  std::sort(keys.begin(), keys.end());
 
-  // Let's loop!
-  for (int nstep = sp.nstart; nstep <= sp.nend; nstep++) {
+  sorted.resize(n);
+  for (long k = 0; k < n; k++)
+    sorted[k] = keys[k].second;
+}
 
-    std::sprintf(&seqnum[0], formats.c_str(), nstep);
-    std::string fileName = (fs::path(sp.dataPath) / (sp.filePrefix + seqnum + ".vtk")).generic_string();
+// Estimated cost of the neighbour loops of a position: the fluid particles around its cell.
+static double neighbourCost(BucketContainer<particle> &f, std::array<double, 3> const &pos) {
+  return 1 + f.getSurroundingCount(f.getBucketCoords(pos[0], pos[1], pos[2]));
+}
 
-    std::cout << "\n\n== [" << " Step " << nstep << " of " << sp.nend << " ] ===================================================================\n";
-    std::cout << "Opening: " << fileName << std::endl;
+// Density of a diffuse particle known from the occupancy summary of the fluid grid, without
+// looking at the fluid particles: zero if there are none around and, if the exact value is not
+// needed, the number of fluid particles around when it proves that it is spray. Else, -1.
+static long summaryDensity(BucketContainer<particle> const &f, std::array<double, 3> const &pos,
+                           double spray, bool exact) {
+  auto bp = f.getBucketCoords(pos[0], pos[1], pos[2]);
+  if (!f.hasSurroundingElements(bp))
+    return 0;
+  if (exact)
+    return -1;
+  long n = f.getSurroundingCount(bp);
+  return n < spray ? n : -1;
+}
 
-    FluidData file(sp.MINX, sp.MAXX, sp.MINY, sp.MAXY, sp.MINZ, sp.MAXZ, sp.h);
+long long DiffuseCalculator::computePotentials(BucketContainer<particle> &f,
+                                               Potentials &pot,
+                                               std::vector<char> const *level) {
+  long npoints = f.getNElements();
+  long long fluidPairs = 0;
+
+  pot.Ita.resize(npoints);
+  pot.colorField.resize(npoints);
+  pot.waveCrest.resize(npoints);
+  pot.energy.resize(npoints);
+  pot.gradient.resize(npoints);
+
+  auto &Ita = pot.Ita, &colorField = pot.colorField, &waveCrest = pot.waveCrest,
+       &energy = pot.energy;
+  auto &gradient = pot.gradient;
+  auto &buckets = f.getNoEmptyBuckets();
+
+  // The fields are first touched by the threads that compute them, with the same schedule
+#pragma omp parallel for schedule(runtime)
+  for (long nebucket = 0; nebucket < buckets.size(); nebucket++)
+    for (auto &pi : buckets[nebucket].second) {
+      long i = pi.id;
+      Ita[i] = colorField[i] = waveCrest[i] = energy[i] = 0;
+      gradient[i] = {{0, 0, 0}};
+    }
+  auto &taStats = pot.taStats, &energyStats = pot.energyStats,
+       &crestStats = pot.crestStats;
+
+  // Buckets out of the sample are skipped
+  auto inLevel = [level](long nbucket, char l) {
+    return level == nullptr || (*level)[nbucket] >= l;
+  };
+
+  // Fluid particles around each bucket
+  auto aroundBucket = [&](long nebucket) {
+    return (double)f.getSurroundingCount(f.getBucketCoords(buckets[nebucket].first));
+  };
+
+  // Cost of a bucket: its particles by the particles around it
+  sched.plan(buckets.size(), [&](long nebucket) {
+    return buckets[nebucket].second.size() * aroundBucket(nebucket);
+  });
+
+  std::cerr << "\n[Stage 1] trapped air potential, energy and colorfield..." << std::endl;
+  prof.beginStage("stage1");
+
+  /*
+   * First pass: trapped air potential, Energy and colorfield
+   */
+#pragma omp parallel
+  {
+    trace::ChunkSpan chunk("stage1");
+    StreamStats taLocal, energyLocal;
+    long long pairs = 0;
+    sched.loop([&](long nebucket) { // Iterate over all buckets
+      chunk.iteration(nebucket);
+      if (!inLevel(buckets[nebucket].first, 1))
+        return;
+      bool sampled = inLevel(buckets[nebucket].first, 3);
+      auto &bucket = buckets[nebucket].second;
+      auto sbuckets = f.getSurroundingBuckets(buckets[nebucket].first);
+
+      for (auto &pi : bucket) { // Iterate over each particle in the bucket
+        long i = pi.id;
+        auto vi = pi.vel, xi = pi.pos;
+
+        for (auto sb : sbuckets) { // Iterate over surrounding buckets
+          pairs += sb->size();
+          for (auto &pj : *sb) {   // Iterate over each particle in the bucket
+
+            if (pi.id != pj.id) {
+              auto vj = pj.vel, xj = pj.pos;
+
+              // Substract position
+              double spx = xi[0] - xj[0], spy = xi[1] - xj[1],
+                     spz = xi[2] - xj[2];
+
+              double mp = sqrt(spx * spx + spy * spy + spz * spz);
+              double q = mp / sp.h;
+
+              if (mp <= sp.h) {
+                // Substract velocity
+                double svx = vi[0] - vj[0], svy = vi[1] - vj[1],
+                       svz = vi[2] - vj[2];
+
+                // Magnitude
+                double mv = sqrt(svx * svx + svy * svy + svz * svz);
+
+                // Distance vector
+                double dvx = svx / mv, dvy = svy / mv, dvz = svz / mv;
+
+                double dpx = spx / mp, dpy = spy / mp, dpz = spz / mp;
+
+                double e = 1 - (dvx * dpx + dvy * dpy + dvz * dpz);
+
+                double w = 1. - q;
+
+                Ita[i] += mv * e * w;
+              }
 
-    if (std::string(sp.exclusionZoneFile) != "")
-      file.setExclusionZone(sp.exclusionZoneFile);
+              if (q >= 0 && q <= 2) {
+                double ad = 21. / (16. * M_PI * sp.h * sp.h * sp.h),
+                       e1 = (1. - (q / 2.0));
+                colorField[i] += (sp.mass / pj.rhop) * ad * e1 * e1 * e1 *
+                                 e1 * (2 * q + 1.);
+              }
+            }
+          }
+        }
 
-    if (!file.loadFile(fileName)) // Cannot open the file, finish the simulation!!
-      break;
+        energy[i] =
+            0.5 * sp.mass * (vi[0] * vi[0] + vi[1] * vi[1] + vi[2] * vi[2]);
 
-    BucketContainer<particle> &f = *(file.getBucketContainer());
+        if (sampled) {
+          taLocal.add(Ita[i]);
+          energyLocal.add(energy[i]);
+        }
+      }
+    });
+#pragma omp atomic
+    fluidPairs += pairs;
+#pragma omp critical(stats)
+    {
+      taStats.merge(taLocal);
+      energyStats.merge(energyLocal);
+    }
+  }
+  prof.imbalance(sched.imbalance());
+
+
+
+  std::cerr << "[Stage 2] gradient... " << std::endl;
+  prof.beginStage("stage2");
+  sched.restart();
+  /*
+   * Second pass: gradient
+   */
+#pragma omp parallel
+  {
+    trace::ChunkSpan chunk("stage2");
+    long long pairs = 0;
+    sched.loop([&](long nebucket) { // Iterate over all buckets
+      chunk.iteration(nebucket);
+      if (!inLevel(buckets[nebucket].first, 2))
+        return;
+      auto &bucket = buckets[nebucket].second;
+      auto sbuckets = f.getSurroundingBuckets(buckets[nebucket].first);
+
+      for (auto &pi : bucket) { // Iterate over each particle in the bucket
+        long i = pi.id;
+
+        for (auto sb : sbuckets) { // Iterate over surrounding buckets
+          pairs += sb->size();
+          for (auto &pj : *sb) {   // Iterate over each particle in the bucket
+            auto xij = ops::substract(pi.pos, pj.pos);
+            double mxij = ops::magnitude(xij), q = mxij / sp.h;
+
+            if (q >= 0 && q <= 2) {
+              double ad = 21. / (16. * M_PI * sp.h * sp.h * sp.h),
+                     e1 = (1. - (q / 2.0)),
+                     rval = colorField[pj.id] * ad * e1 * e1 * e1 * e1 *
+                            (2 * q + 1.);
+              gradient[i][0] += rval * xij[0];
+              gradient[i][1] += rval * xij[1];
+              gradient[i][2] += rval * xij[2];
+            }
+          }
+        }
+      }
+    });
+#pragma omp atomic
+    fluidPairs += pairs;
+  }
+  prof.imbalance(sched.imbalance());
+
+  std::cerr << "[Stage 3] wave crests... " << std::endl;
+  prof.beginStage("stage3");
+
+  // Only the particles at the surface look for their neighbours
+  sched.plan(buckets.size(), [&](long nebucket) {
+    double n = 0;
+    for (auto &pi : buckets[nebucket].second)
+      n += colorField[pi.id] < SURFACE;
+    return buckets[nebucket].second.size() + n * aroundBucket(nebucket);
+  });
+
+  /*
+   * Third pass: wave crests
+   */
+#pragma omp parallel
+  {
+    trace::ChunkSpan chunk("stage3");
+    StreamStats crestLocal;
+    long long pairs = 0;
+    sched.loop([&](long nebucket) { // Iterate over all buckets
+      chunk.iteration(nebucket);
+      if (!inLevel(buckets[nebucket].first, 3))
+        return;
+      auto &bucket = buckets[nebucket].second;
+      std::vector<std::vector<particle> *> sbuckets;
+
+      for (auto &pi : bucket) { // Iterate over each particle in the bucket
+        long i = pi.id;
+        if (colorField[i] < SURFACE) {
+          if (sbuckets.size() == 0)
+            sbuckets = f.getSurroundingBuckets(buckets[nebucket].first);
+          for (auto sb : sbuckets) { // Iterate over surrounding buckets
+            pairs += sb->size();
+            for (auto &pj : *sb) { // Iterate over each particle in the bucket
+              waveCrest[i] += crests2p(pi.pos, pj.pos, pi.vel, gradient[i],
+                                       gradient[pj.id], sp.h);
+            }
+          }
+        }
+        crestLocal.add(waveCrest[i]);
+      }
+    });
+#pragma omp atomic
+    fluidPairs += pairs;
+#pragma omp critical(stats)
+    crestStats.merge(crestLocal);
+  }
+  prof.imbalance(sched.imbalance());
 
-    long npoints =
-        f.getNElements(); // output->GetPoints()->GetNumberOfPoints();
+  return fluidPairs;
+}
 
-    // Create a vector with the scaled velocity difference for each particle
-    std::vector<double> Ita(npoints, 0.0);
-    std::vector<double> colorField(npoints, 0.0);
-    std::vector<double> waveCrest(npoints, 0.0);
-    std::vector<double> energy(npoints, 0.0);
-    std::vector<int> ndiffuse(npoints, 0);
-    std::vector<std::array<double, 3>> gradient(npoints, std::array<double, 3>{{0, 0, 0}});
+long DiffuseCalculator::countDiffuse(Potentials &pot, std::vector<int> &ndiffuse,
+                                     long first, long last) {
+  auto &Ita = pot.Ita, &waveCrest = pot.waveCrest, &energy = pot.energy;
 
-    std::cout << "Total fluid particles: " << npoints << std::endl;
+  std::cerr << "[Stage 4] clamping function... " << std::endl;
+  prof.beginStage("stage4");
 
-    std::cerr << "\n[Stage 1] trapped air potential, energy and colorfield..." << std::endl;
+  /*
+   * Fourth pass: clamping function
+   */
 
+#ifndef _MSVC
+#pragma omp parallel for simd
+#else
+#pragma omp parallel for schedule(static)
+#endif
+  for (long i = first; i < last; i++) {
+    waveCrest[i] = phi(waveCrest[i], sp.MINWC, sp.MAXWC);
+    Ita[i] = phi(Ita[i], sp.MINTA, sp.MAXTA);
+    energy[i] = phi(energy[i], sp.MINK, sp.MAXK);
+  }
 
-    auto &buckets = f.getNoEmptyBuckets();
+  long npdiffuse = 0;
 
-    /*
-     * First pass: trapped air potential, Energy and colorfield
-     */
-    {
-#pragma omp parallel for schedule(guided)
-      for (long nebucket = 0; nebucket < buckets.size();
-           nebucket++) { // Iterate over all buckets
-        auto &bucket = buckets[nebucket].second;
-        auto sbuckets = f.getSurroundingBuckets(buckets[nebucket].first);
+  std::cerr << "[Stage 5] number of diffuse particles generated: ";
+  prof.beginStage("stage5");
+  /*
+   * Fifth pass: number of diffuse particles generated
+   */
 
-        for (auto &pi : bucket) { // Iterate over each particle in the bucket
-          long i = pi.id;
-          auto vi = pi.vel, xi = pi.pos;
+#ifndef _MSVC
+#pragma omp parallel for simd reduction(+ : npdiffuse)
+#else
+#pragma omp parallel for reduction(+ : npdiffuse)
+#endif
+  for (long i = first; i < last; i++) {
+    ndiffuse[i] = std::floor(
+        energy[i] * (sp.KTA * Ita[i] + sp.KWC * waveCrest[i]) * sp.TIMESTEP);
+    npdiffuse += ndiffuse[i];
+  }
 
-          for (auto sb : sbuckets) { // Iterate over surrounding buckets
-            for (auto &pj : *sb) {   // Iterate over each particle in the bucket
+  return npdiffuse;
+}
 
-              if (pi.id != pj.id) {
-                auto vj = pj.vel, xj = pj.pos;
+void DiffuseCalculator::emitDiffuse(BucketContainer<particle> &f,
+                                    std::vector<int> const &ndiffuse,
+                                    std::vector<int> const &kept, long firstId,
+                                    std::mt19937 &gen, Emission &em) {
+  long npoints = ndiffuse.size(), npdiffuse = 0;
+
+  // Index of the first diffuse particle generated by each fluid particle, so that
+  // stage 6 gives the same result regardless of the thread scheduling.
+  std::vector<long> firstDiffuse(npoints);
+  for (long i = 0; i < npoints; i++) {
+    firstDiffuse[i] = npdiffuse;
+    npdiffuse += kept[i];
+  }
 
-                // Substract position
-                double spx = xi[0] - xj[0], spy = xi[1] - xj[1],
-                       spz = xi[2] - xj[2];
+  std::cerr << "[Stage 6] calculate diffuse particle positions... " << std::endl;
+  prof.beginStage("stage6");
 
-                double mp = sqrt(spx * spx + spy * spy + spz * spz);
-                double q = mp / sp.h;
+  /*
+   * Sixth pass: calculate diffuse particle positions
+   */
 
-                if (mp <= sp.h) {
-                  // Substract velocity
-                  double svx = vi[0] - vj[0], svy = vi[1] - vj[1],
-                         svz = vi[2] - vj[2];
+  // New particles are appended to the emission
+  long base = em.ids.size();
+  em.posit.resize(base + npdiffuse);
+  em.vel.resize(base + npdiffuse);
+  em.ids.resize(base + npdiffuse);
+  em.ttl.resize(base + npdiffuse);
+  em.density.resize(base + npdiffuse, 0.0);
+  em.histogram.resize(EMISSION_BINS, 0);
 
-                  // Magnitude
-                  double mv = sqrt(svx * svx + svy * svy + svz * svz);
+  // Generate random numbers: this is done out of the loop because it is not thread safe
+  std::uniform_real_distribution<> xunif(0, 1);
+  std::vector<double> tempRand(npdiffuse * 3);
+  for (auto &x : tempRand)
+    x = xunif(gen);
+
+  auto &buckets = f.getNoEmptyBuckets();
+
+  // Cost of a bucket: its particles and the diffuse particles that they generate
+  sched.plan(buckets.size(), [&](long nebucket) {
+    double n = 0;
+    for (auto &pi : buckets[nebucket].second)
+      n += 1 + kept[pi.id];
+    return n;
+  });
+
+#pragma omp parallel
+  {
+    trace::ChunkSpan chunk("stage6");
+    std::vector<long> emissionLocal(EMISSION_BINS, 0);
+    sched.loop([&](long nebucket) { // Iterate over all buckets
+      chunk.iteration(nebucket);
+      auto &bucket = buckets[nebucket].second;
+
+      for (auto &pi : bucket) { // Iterate over each particle in the bucket
+        long i = pi.id;
+
+        if (ndiffuse[i] >= 1) {
+          emissionLocal[std::min(ndiffuse[i], EMISSION_BINS) - 1]++;
+          long idif = firstDiffuse[i];
+          std::array<double, 3> pos = pi.pos, vel = pi.vel;
+
+          // Obtain orthogonal vectors to velocity vector
+          std::array<double, 3> e1, e2;
+
+          // Find non-zero component of velocity vector in order to avoid
+          // division by 0 and calculate e1
+          if (vel[0] != 0) { // x non zero
+
+            e1 = ops::normalize({{solveEq(pos[2], pos[1], pos[0], vel[2],
+                                          vel[1], vel[0], 0, 1),
+                                  1, 0}});
+          } else if (vel[1] != 0) { // y non zero
+            e1 = ops::normalize({{1,
+                                  solveEq(pos[0], pos[2], pos[1], vel[0],
+                                          vel[2], vel[1], 1, 0),
+                                  0}});
+          } else { // z non zero
+            e1 = ops::normalize({{1, 0,
+                                  solveEq(pos[0], pos[1], pos[2], vel[0],
+                                          vel[1], vel[2], 1, 0)}});
+          }
 
-                  // Distance vector
-                  double dvx = svx / mv, dvy = svy / mv, dvz = svz / mv;
+          // Cross product of two orthogonal vectors generate a vector
+          // orthogonal to them
+          e2 = ops::normalize({{e1[1] * vel[2] - vel[1] * e1[2],
+                                e1[0] * vel[2] - vel[0] * e1[2],
+                                e1[0] * vel[1] - vel[0] * e1[1]}});
 
-                  double dpx = spx / mp, dpy = spy / mp, dpz = spz / mp;
+          std::array<double, 3> nvel =
+              ops::normalize(std::array<double, 3>{{vel[0], vel[1], vel[2]}});
 
-                  double e = 1 - (dvx * dpx + dvy * dpy + dvz * dpz);
+          for (int j = 0; j < kept[i]; j++) {
+            double h = tempRand[idif * 3] *
+                       (ops::magnitude(std::array<double, 3>{{vel[0], vel[1], vel[2]}}) * sp.TIMESTEP) *
+												 .5,
+                   r = sp.h * sqrt(tempRand[idif * 3 + 1]), theta = tempRand[idif * 3 + 2] * 2 * M_PI;
 
-                  double w = 1. - q;
+            // Position of newly created diffuse particle
+            em.posit[base + idif] = {{pos[0] + r * cos(theta) * e1[0] +
+                                       r * sin(theta) * e2[0] + h * nvel[0],
+                                   pos[1] + r * cos(theta) * e1[1] +
+                                       r * sin(theta) * e2[1] + h * nvel[1],
+                                   pos[2] + r * cos(theta) * e1[2] +
+                                       r * sin(theta) * e2[2] + h * nvel[2]}};
 
-                  Ita[i] += mv * e * w;
-                }
+            // Velocity of newly created diffuse particle
+            em.vel[base + idif] = {
+                {r * cos(theta) * e1[0] + r * sin(theta) * e2[0] + vel[0],
+                 r * cos(theta) * e1[1] + r * sin(theta) * e2[1] + vel[1],
+                 r * cos(theta) * e1[2] + r * sin(theta) * e2[2] + vel[2]}};
 
-                if (q >= 0 && q <= 2) {
-                  double ad = 21. / (16. * M_PI * sp.h * sp.h * sp.h),
-                         e1 = (1. - (q / 2.0));
-                  colorField[i] += (sp.mass / pj.rhop) * ad * e1 * e1 * e1 *
-                                   e1 * (2 * q + 1.);
-                }
-              }
-            }
-          }
+            // Particle ID
+            em.ids[base + idif] = firstId + idif;
 
-          energy[i] =
-              0.5 * sp.mass * (vi[0] * vi[0] + vi[1] * vi[1] + vi[2] * vi[2]);
+            // Particle lifetime, from all the particles generated even if the emission is capped
+            em.ttl[base + idif] = ndiffuse[i] * sp.LIFEFIME;
+
+            idif++;
+          }
         }
       }
-    }
+    });
+#pragma omp critical(stats)
+    for (int b = 0; b < EMISSION_BINS; b++)
+      em.histogram[b] += emissionLocal[b];
+  }
+  prof.imbalance(sched.imbalance());
+}
 
+long long DiffuseCalculator::classifyDiffuse(BucketContainer<particle> &f, Emission &em,
+                                             std::vector<long> const *index) {
+  long n = index != nullptr ? index->size() : em.ids.size();
+  long long diffusePairs = 0;
+  long nspray = 0, nfoam = 0, nbubbles = 0, nknown = 0;
+
+  // Seventh pass: classify particles
+  //[0-6]Spray [6-20]Foam [20..]Bubbles ¿?
+  std::cerr << "[Stage 7] classify particles... " << std::endl;
+  prof.beginStage("stage7");
+
+  std::vector<long> sorted;
+  if (sp.cellOrder == "morton") {
+    sortByCell(f, em.posit, index, sorted);
+    index = &sorted;
+  }
 
+  sched.plan(n, [&](long k) {
+    return neighbourCost(f, em.posit[index != nullptr ? (*index)[k] : k]);
+  });
+
+#pragma omp parallel
+  {
+    trace::ChunkSpan chunk("stage7");
+    long long pairs = 0;
+    long spray = 0, foam = 0, bubbles = 0, known = 0;
+    sched.loop([&](long k) {
+      chunk.iteration(k);
+      long i = index != nullptr ? (*index)[k] : k;
+      auto pxd = em.posit[i];
+      long density = summaryDensity(f, pxd, sp.SPRAY, sp.vtk_diffuse_data);
+      if (density >= 0) { // Spray, the fluid particles are not needed
+        em.density[i] += density;
+        known++;
+      } else {
+        auto sbuckets = f.getSurroundingBuckets(pxd);
+        for (auto sb : sbuckets) { // Iterate over surrounding buckets
+          pairs += sb->size();
+          for (auto &pj : *sb) {   // Iterate over each particle in the bucket
+            if (ops::magnitude(ops::substract(pxd, pj.pos)) <= sp.h) {
+              em.density[i]++;
+            }
+          }
+        }
+      }
 
-    std::cerr << "[Stage 2] gradient... " << std::endl;
-    /*
-     * Second pass: gradient
-     */
+      if (em.density[i] < sp.SPRAY)
+        spray++;
+      else if (em.density[i] > sp.BUBBLES)
+        bubbles++;
+      else
+        foam++;
+    });
+#pragma omp critical(stats)
     {
+      diffusePairs += pairs;
+      nspray += spray;
+      nfoam += foam;
+      nbubbles += bubbles;
+      nknown += known;
+    }
+  }
+  prof.imbalance(sched.imbalance());
+  prof.count("summary_spray", nknown);
 
+  em.nspray += nspray;
+  em.nfoam += nfoam;
+  em.nbubbles += nbubbles;
+  return diffusePairs;
+}
 
-#pragma omp parallel for schedule(guided)
-      for (long nebucket = 0; nebucket < buckets.size();
-           nebucket++) { // Iterate over all buckets
-        auto &bucket = buckets[nebucket].second;
-        auto sbuckets = f.getSurroundingBuckets(buckets[nebucket].first);
+long long DiffuseCalculator::updateDiffuse(BucketContainer<particle> &f, Checkpoint &state,
+                                           std::vector<long> const *index,
+                                           BucketContainer<particle> *next) {
+  auto &ppPosit = state.posit, &ppVel = state.vel;
+  auto &ppDensity = state.density;
+  long n = index != nullptr ? index->size() : state.ids.size();
+  long long diffusePairs = 0;
 
-        for (auto &pi : bucket) { // Iterate over each particle in the bucket
-          long i = pi.id;
+  // Update particles
 
-          for (auto sb : sbuckets) { // Iterate over surrounding buckets
-            for (auto &pj : *sb) {   // Iterate over each particle in the bucket
-              auto xij = ops::substract(pi.pos, pj.pos);
-              double mxij = ops::magnitude(xij), q = mxij / sp.h;
+  std::cerr << "[Stage 8] update particles... " << std::endl;
+  prof.beginStage("stage8");
 
-              if (q >= 0 && q <= 2) {
-                double ad = 21. / (16. * M_PI * sp.h * sp.h * sp.h),
-                       e1 = (1. - (q / 2.0)),
-                       rval = colorField[pj.id] * ad * e1 * e1 * e1 * e1 *
-                              (2 * q + 1.);
-                gradient[i][0] += rval * xij[0];
-                gradient[i][1] += rval * xij[1];
-                gradient[i][2] += rval * xij[2];
-              }
-            }
+  std::vector<long> sorted;
+  if (sp.cellOrder == "morton") {
+    sortByCell(f, ppPosit, index, sorted);
+    index = &sorted;
+  }
+
+  sched.plan(n, [&](long k) {
+    return neighbourCost(f, ppPosit[index != nullptr ? (*index)[k] : k]);
+  });
+
+  // Recalculate density: should be placed before the new position calculation.
+  long nknown = 0;
+#pragma omp parallel
+  {
+    trace::ChunkSpan chunk("stage8");
+    long long pairs = 0;
+    long known = 0;
+    sched.loop([&](long k) {
+      chunk.iteration(k);
+      long i = index != nullptr ? (*index)[k] : k;
+      auto &pxd = ppPosit[i];
+      long density = summaryDensity(f, pxd, sp.SPRAY, sp.vtk_diffuse_data);
+      if (density >= 0) { // Spray, the fluid particles are not needed
+        ppDensity[i] = density;
+        known++;
+        return;
+      }
+      ppDensity[i] = 0;
+      for (auto sb : f.getSurroundingBuckets(pxd)) { // Iterate over surrounding buckets
+        pairs += sb->size();
+        for (auto &pj : *sb) { // Iterate over each particle in the bucket
+          if (ops::magnitude(ops::substract(pxd, pj.pos)) <= sp.h) {
+            ppDensity[i]++;
           }
         }
       }
+    });
+#pragma omp critical(stats)
+    {
+      diffusePairs += pairs;
+      nknown += known;
     }
+  }
+  prof.imbalance(sched.imbalance());
+  prof.count("summary_spray", nknown);
+
+  // Now we can re-clasify: the particles of each class, in the order of the loop
+  std::vector<long> spray, foam, bubbles;
+  for (long k = 0; k < n; k++) {
+    long i = index != nullptr ? (*index)[k] : k;
+    if (ppDensity[i] < sp.SPRAY)
+      spray.push_back(i);
+    else if (ppDensity[i] > sp.BUBBLES)
+      bubbles.push_back(i);
+    else
+      foam.push_back(i);
+  }
+  prof.count("update_spray", spray.size());
+  prof.count("update_foam", foam.size());
+  prof.count("update_bubbles", bubbles.size());
 
-    std::cerr << "[Stage 3] wave crests... " << std::endl;
+  // Substeps of the time step
+  int substeps = std::max(1, sp.substeps);
+  double dt = sp.TIMESTEP / substeps;
 
-    /*
-     * Third pass: wave crests
-     */
-    {
+  // Spray: ballistic motion, the fluid around is not needed
+  // TODO: we are avoiding external forces (like wind)
+  long nspray = spray.size();
+#ifndef _MSVC
+#pragma omp parallel for simd
+#else
+#pragma omp parallel for schedule(static)
+#endif
+  for (long k = 0; k < nspray; k++) {
+    long i = spray[k];
+    for (int s = 0; s < substeps; s++) {
+      ppVel[i][2] = ppVel[i][2] + -9.81 * dt;
+      ppPosit[i][0] = ppPosit[i][0] + dt * ppVel[i][0];
+      ppPosit[i][1] = ppPosit[i][1] + dt * ppVel[i][1];
+      ppPosit[i][2] = ppPosit[i][2] + dt * ppVel[i][2];
+    }
+  }
 
-#pragma omp parallel for schedule(guided)
-      for (long nebucket = 0; nebucket < buckets.size(); nebucket++) { // Iterate over all buckets
-        auto &bucket = buckets[nebucket].second;
-        std::vector<std::vector<particle> *> sbuckets;
-
-        for (auto &pi : bucket) { // Iterate over each particle in the bucket
-          long i = pi.id;
-          if (colorField[i] < SURFACE) {
-            if (sbuckets.size() == 0)
-              sbuckets = f.getSurroundingBuckets(buckets[nebucket].first);
-            for (auto sb : sbuckets) { // Iterate over surrounding buckets
-              for (auto &pj : *sb) { // Iterate over each particle in the bucket
-                waveCrest[i] += crests2p(pi.pos, pj.pos, pi.vel, gradient[i],
-                                         gradient[pj.id], sp.h);
-              }
-            }
-          }
+  // Foam and bubbles: they follow the velocity of the fluid around them. Foam first
+  std::vector<long> &dense = foam;
+  long nfoam = foam.size();
+  dense.insert(dense.end(), bubbles.begin(), bubbles.end());
+
+  // Velocity of the fluid rasterized once, sampled by each particle. The particles that leave
+  // the sampled cells in the substeps take it from the fluid particles
+  VelocityGrid grid, gridNext;
+  bool sampled = sp.velocityGrid && dense.size() > 0;
+  if (sampled) {
+    auto kernel = [this](std::array<double, 3> xij, double h) { return Wwendland(xij, h); };
+    auto position = [&](long k) { return ppPosit[dense[k]]; };
+    grid.build(f, {{sp.MINX, sp.MINY, sp.MINZ}}, sp.h, sp.velocityGridResolution, kernel,
+               dense.size(), position);
+    prof.count("grid_nodes", grid.getNodes());
+    if (next != nullptr && substeps > 1) {
+      gridNext.build(*next, {{sp.MINX, sp.MINY, sp.MINZ}}, sp.h, sp.velocityGridResolution,
+                     kernel, dense.size(), position);
+      prof.count("grid_nodes", gridNext.getNodes());
+    }
+  }
+
+  // Kernel sums of the velocity of the fluid around a position: returns the sum of the weights
+  auto fluidVelocity = [&](BucketContainer<particle> &fluid, VelocityGrid const &g,
+                           std::array<double, 3> const &pxd, std::array<double, 3> &num,
+                           long long &pairs) {
+    num = {{0, 0, 0}};
+    double den = sampled ? g.sample(pxd, num) : 0;
+
+    if (den <= 0) { // Not sampled, or too far from the fluid nodes
+      num = {{0, 0, 0}};
+      for (auto sb : fluid.getSurroundingBuckets(pxd)) { // Iterate over surrounding buckets
+        pairs += sb->size();
+        for (auto &pj : *sb) {   // Iterate over each particle in the bucket
+          double tval = Wwendland(ops::substract(pxd, pj.pos), sp.h);
+          num = {{num[0] + pj.vel[0] * tval,
+                  num[1] + pj.vel[1] * tval,
+                  num[2] + pj.vel[2] * tval}};
+          den += tval;
         }
       }
+    }
+    return den;
+  };
 
+  sched.plan(dense.size(), [&](long k) {
+    return sampled ? 1. : neighbourCost(f, ppPosit[dense[k]]) * (next != nullptr && substeps > 1 ? 2 : 1);
+  });
+
+  for (int s = 0; s < substeps; s++) {
+    // Weight of the next step in the velocity of the fluid at the beginning of the substep
+    double alpha = next != nullptr ? (double)s / substeps : 0;
+    if (s > 0)
+      sched.restart();
+
+#pragma omp parallel
+    {
+      trace::ChunkSpan chunk("stage8");
+      long long pairs = 0;
+      sched.loop([&](long k) {
+        chunk.iteration(k);
+        long i = dense[k];
+        auto &pxd = ppPosit[i];
+        std::array<double, 3> num, numNext;
+        double den = fluidVelocity(f, grid, pxd, num, pairs),
+               denNext = alpha > 0 ? fluidVelocity(*next, gridNext, pxd, numNext, pairs) : 0;
+
+        if (den > 0 && denNext > 0)
+          num = {{(1 - alpha) * num[0] / den + alpha * numNext[0] / denNext,
+                  (1 - alpha) * num[1] / den + alpha * numNext[1] / denNext,
+                  (1 - alpha) * num[2] / den + alpha * numNext[2] / denNext}};
+        else if (den > 0)
+          num = {{num[0] / den, num[1] / den, num[2] / den}};
+        else if (denNext > 0)
+          num = {{numNext[0] / denNext, numNext[1] / denNext, numNext[2] / denNext}};
+        else // Moved away from the fluid in a substep: it keeps its velocity
+          num = ppVel[i];
+
+        if (k < nfoam) { // It's foam!
+          ppVel[i] = {{num[0], num[1], num[2]}};
+
+          pxd = {{pxd[0] + dt * num[0],
+                  pxd[1] + dt * num[1],
+                  pxd[2] + dt * num[2]}};
+
+        } else { // It's a bubble!
+          ppVel[i] = {{ppVel[i][0] + dt * (sp.KD * (num[0] - ppVel[i][0]) / sp.TIMESTEP),
+                       ppVel[i][1] + dt * (sp.KD * (num[1] - ppVel[i][1]) / sp.TIMESTEP),
+                       ppVel[i][2] + dt * (-sp.KB * -9.81 + sp.KD * (num[2] - ppVel[i][2]) / sp.TIMESTEP)}};
+          pxd = {{pxd[0] + dt * ppVel[i][0],
+                  pxd[1] + dt * ppVel[i][1],
+                  pxd[2] + dt * ppVel[i][2]}};
+        }
+      });
+#pragma omp atomic
+      diffusePairs += pairs;
     }
+    prof.imbalance(sched.imbalance());
+  }
 
-    std::string stats = std::string("Wave crests: ")
-      + ops::vectorStats(waveCrest) 
-      + "\n"
-      + "Trapped air: "
-      + ops::vectorStats(Ita)
-      + "\n"
-      + "Energy:      "
-      + ops::vectorStats(energy);
-      + "\n";
+  return diffusePairs;
+}
 
-    std::cerr << "[Stage 4] clamping function... " << std::endl;
+bool DiffuseCalculator::runSlabs(std::string const &fileName, Checkpoint &state,
+                                 Potentials &pot, Emission &em, FluidCounters &counters) {
+  std::string prefix =
+      (fs::path(sp.slabPath != "" ? sp.slabPath : sp.outputPath) / (sp.outputPreffix + "slab_"))
+          .generic_string();
+
+  // Split the input file in slabs with about the same number of particles
+  FluidData domain(sp.MINX, sp.MAXX, sp.MINY, sp.MAXY, sp.MINZ, sp.MAXZ, sp.h, 0, 0);
+  BucketContainer<particle> &grid = *(domain.getBucketContainer());
+  std::vector<long> layers;
+  if (!domain.splitFile(fileName, prefix, sp.slabs, layers))
+    return false;
+
+  int nslabs = layers.size() - 1;
+  auto dims = grid.getDimensions();
+  long nlayers = dims[2];
+  counters.ncells = dims[0] * dims[1] * dims[2];
+
+  std::vector<int> slabOf(nlayers);
+  for (int s = 0; s < nslabs; s++)
+    for (long l = layers[s]; l < layers[s + 1]; l++)
+      slabOf[l] = s;
+
+  // Slab of a point. Points out of the domain belong to the nearest slab.
+  auto slabAt = [&](std::array<double, 3> const &pos) {
+    long l = grid.getBucketCoords(pos[0], pos[1], pos[2])[2];
+    return slabOf[std::min(std::max(l, 0L), nlayers - 1)];
+  };
+
+  // Loads a slab with some layers of halo
+  auto loadSlab = [&](FluidData &slab, int s, long halo) {
+    long first = std::max(layers[s] - halo, 0L), last = std::min(layers[s + 1] + halo, nlayers);
+    return slab.loadSlabFiles(prefix, slabOf[first], slabOf[last - 1] + 1);
+  };
+
+  // Existing diffuse particles of each slab
+  std::vector<std::vector<long>> pool(nslabs);
+  for (long i = 0; i < state.ids.size(); i++)
+    pool[slabAt(state.posit[i])].push_back(i);
+
+  // New diffuse particles whose neighbours are not loaded with the slab that created them
+  std::vector<std::vector<long>> pending(nslabs);
+
+  for (int s = 0; s < nslabs; s++) {
+    long first = layers[s], last = layers[s + 1];
+    std::cout << "Slab " << s + 1 << " of " << nslabs << ": layers " << first << " to "
+              << last - 1 << std::endl;
+    prof.beginStage("load");
+
+    FluidData slab(sp.MINX, sp.MAXX, sp.MINY, sp.MAXY, sp.MINZ, sp.MAXZ, sp.h,
+                   first - SLAB_HALO, last + SLAB_HALO);
+    if (!loadSlab(slab, s, SLAB_HALO))
+      return false;
+    BucketContainer<particle> &f = *(slab.getBucketContainer());
+    arrangeFluid(f);
+
+    // Potentials are only needed in the slab: the halo gets the color field and the gradient
+    std::vector<char> level(f.getBuckets().size());
+    long ownFirst = 0, nown = 0;
+    for (long b = 0; b < level.size(); b++) {
+      long l = f.getBucketCoords(b)[2], d = std::max(std::max(first - l, l - last + 1), 0L);
+      level[b] = std::max(3 - d, 0L);
+      if (l < first)
+        ownFirst += f.getBuckets()[b].size();
+      else if (l < last)
+        nown += f.getBuckets()[b].size();
+    }
+    counters.nfluid += nown;
+
+    // Particles of the slab have consecutive ids, in the same order as in the whole domain
+    Potentials slabPot;
+    std::vector<int> ndiffuse(f.getNElements(), 0);
+    counters.fluidPairs += computePotentials(f, slabPot, &level);
+    std::cerr << countDiffuse(slabPot, ndiffuse, ownFirst, ownFirst + nown) << std::endl;
+
+    long before = em.ids.size();
+    emitDiffuse(f, ndiffuse, ndiffuse, state.difId + before, state.gen, em);
+
+    std::vector<long> &local = pending[s];
+    for (long i = before; i < em.ids.size(); i++) {
+      if (f.storesNeighbourhood(em.posit[i]))
+        local.push_back(i);
+      else
+        pending[slabAt(em.posit[i])].push_back(i);
+    }
+    counters.diffusePairs += classifyDiffuse(f, em, &local);
+    local.clear();
+    counters.diffusePairs += updateDiffuse(f, state, &pool[s]);
+
+    pot.taStats.merge(slabPot.taStats);
+    pot.crestStats.merge(slabPot.crestStats);
+    pot.energyStats.merge(slabPot.energyStats);
+
+    counters.fluidBytes = std::max(counters.fluidBytes, memory::bytes(f.getBuckets()));
+    counters.temporaryBytes = std::max(
+        counters.temporaryBytes,
+        memory::bytes(slabPot.Ita) + memory::bytes(slabPot.colorField) +
+            memory::bytes(slabPot.waveCrest) + memory::bytes(slabPot.energy) +
+            memory::bytes(slabPot.gradient) + memory::bytes(ndiffuse) +
+            memory::bytes(level) + ndiffuse.size() * sizeof(long));
+  }
 
-    /*
-     * Fourth pass: clamping function
-     */
+  // New particles that moved to a slab processed before the one that created them
+  for (int s = 0; s < nslabs; s++) {
+    if (pending[s].empty())
+      continue;
+    prof.beginStage("load");
+    FluidData slab(sp.MINX, sp.MAXX, sp.MINY, sp.MAXY, sp.MINZ, sp.MAXZ, sp.h,
+                   layers[s] - 1, layers[s + 1] + 1);
+    if (!loadSlab(slab, s, 1))
+      return false;
+    counters.diffusePairs += classifyDiffuse(*(slab.getBucketContainer()), em, &pending[s]);
+  }
 
+  std::error_code ec;
+  for (int s = 0; s < nslabs; s++)
+    fs::remove(prefix + std::to_string(s) + ".bin", ec);
 
-#ifndef _MSVC
-#pragma omp parallel for simd
-#else
-#pragma omp parallel for schedule(static)
-#endif
-    for (long i = 0; i < npoints; i++) {
-      waveCrest[i] = phi(waveCrest[i], sp.MINWC, sp.MAXWC);
-      Ita[i] = phi(Ita[i], sp.MINTA, sp.MAXTA);
-      energy[i] = phi(energy[i], sp.MINK, sp.MAXK);
+  return true;
+}
+
+bool DiffuseCalculator::runRanks(std::string const &fileName, Checkpoint &state,
+                                 Potentials &pot, Emission &em, FluidCounters &counters,
+                                 long &nemitted) {
+  int rank = parallel::rank(), nranks = parallel::size();
+  std::string prefix =
+      (fs::path(sp.slabPath != "" ? sp.slabPath : sp.outputPath) / (sp.outputPreffix + "rank_"))
+          .generic_string();
+
+  // The first process splits the input file in slabs with about the same number of particles
+  FluidData domain(sp.MINX, sp.MAXX, sp.MINY, sp.MAXY, sp.MINZ, sp.MAXZ, sp.h, 0, 0);
+  BucketContainer<particle> &grid = *(domain.getBucketContainer());
+  std::vector<long> layers;
+  bool ok = rank != 0 || domain.splitFile(fileName, prefix, nranks, layers);
+  if (!parallel::all(ok))
+    return false;
+
+  std::vector<double> layerData(layers.begin(), layers.end());
+  parallel::broadcast(layerData);
+  layers.assign(layerData.begin(), layerData.end());
+
+  auto dims = grid.getDimensions();
+  long nlayers = dims[2];
+  counters.ncells = dims[0] * dims[1] * dims[2];
+
+  // There are no layers left for the last processes if there are less layers than processes
+  int nslabs = layers.size() - 1;
+  layers.resize(nranks + 1, nlayers);
+  long first = layers[rank], last = layers[rank + 1];
+
+  std::vector<int> slabOf(nlayers);
+  for (int s = 0; s < nslabs; s++)
+    for (long l = layers[s]; l < layers[s + 1]; l++)
+      slabOf[l] = s;
+
+  // Process of a point. Points out of the domain belong to the nearest slab.
+  auto layerAt = [&](double const *pos) {
+    long l = grid.getBucketCoords(pos[0], pos[1], pos[2])[2];
+    return std::min(std::max(l, 0L), nlayers - 1);
+  };
+  auto ownerAt = [&](std::array<double, 3> const &pos) { return slabOf[layerAt(pos.data())]; };
+
+  std::vector<double> records;
+  std::string slabFile = prefix + std::to_string(rank) + ".bin";
+  ok = rank >= nslabs || FluidData::readSlabFile(slabFile, records);
+  std::error_code ec;
+  fs::remove(slabFile, ec);
+  if (!parallel::all(ok))
+    return false;
+
+  // Halo exchange: the particles of the layers near other slabs are sent to their processes
+  std::vector<std::vector<double>> send(nranks);
+  for (long i = 0; i < records.size(); i += SLAB_RECORD) {
+    long l = layerAt(&records[i]);
+    for (int p = 0; p < nslabs; p++)
+      if (p != rank && l >= layers[p] - SLAB_HALO && l < layers[p + 1] + SLAB_HALO)
+        send[p].insert(send[p].end(), records.begin() + i, records.begin() + i + SLAB_RECORD);
+  }
+  std::vector<double> halo;
+  parallel::exchange(send, halo);
+  send.clear();
+  records.insert(records.end(), halo.begin(), halo.end());
+  halo.clear();
+
+  FluidData slab(sp.MINX, sp.MAXX, sp.MINY, sp.MAXY, sp.MINZ, sp.MAXZ, sp.h,
+                 first - SLAB_HALO, last + SLAB_HALO);
+  slab.loadRecords(records);
+  records.clear();
+  BucketContainer<particle> &f = *(slab.getBucketContainer());
+  arrangeFluid(f);
+
+  // Potentials are only needed in the slab: the halo gets the color field and the gradient
+  std::vector<char> level(f.getBuckets().size());
+  long ownFirst = 0, nown = 0;
+  for (long b = 0; b < level.size(); b++) {
+    long l = f.getBucketCoords(b)[2], d = std::max(std::max(first - l, l - last + 1), 0L);
+    level[b] = std::max(3 - d, 0L);
+    if (l < first)
+      ownFirst += f.getBuckets()[b].size();
+    else if (l < last)
+      nown += f.getBuckets()[b].size();
+  }
+  counters.nfluid = nown;
+
+  Potentials slabPot;
+  std::vector<int> ndiffuse(f.getNElements(), 0);
+  counters.fluidPairs = computePotentials(f, slabPot, &level);
+  long ndif = countDiffuse(slabPot, ndiffuse, ownFirst, ownFirst + nown);
+
+  // Particles are numbered and take their random numbers in the order of the whole domain
+  long before = parallel::exclusiveSum(ndif);
+  nemitted = parallel::sum(ndif);
+  std::cerr << nemitted << std::endl;
+
+  std::mt19937 gen = state.gen;
+  skipRandom(gen, before);
+  emitDiffuse(f, ndiffuse, ndiffuse, state.difId + before, gen, em);
+  skipRandom(state.gen, nemitted);
+
+  prof.beginStage("migrate");
+  migrateDiffuse(em, ownerAt);
+  migrateDiffuse(state, ownerAt);
+
+  counters.diffusePairs = classifyDiffuse(f, em, nullptr);
+  counters.diffusePairs += updateDiffuse(f, state, nullptr);
+
+  // Statistics of all the processes
+  std::vector<double> histogram(em.histogram.begin(), em.histogram.end());
+  histogram.resize(EMISSION_BINS, 0);
+  parallel::sum(histogram);
+  em.histogram.assign(histogram.begin(), histogram.end());
+
+  std::vector<double> packed, all;
+  slabPot.taStats.pack(packed);
+  slabPot.crestStats.pack(packed);
+  slabPot.energyStats.pack(packed);
+  parallel::gather(packed, all);
+  for (long position = 0; rank == 0 && position < all.size();) {
+    pot.taStats.mergePacked(all, position);
+    pot.crestStats.mergePacked(all, position);
+    pot.energyStats.mergePacked(all, position);
+  }
+
+  counters.fluidBytes = memory::bytes(f.getBuckets());
+  counters.temporaryBytes =
+      memory::bytes(slabPot.Ita) + memory::bytes(slabPot.colorField) +
+      memory::bytes(slabPot.waveCrest) + memory::bytes(slabPot.energy) +
+      memory::bytes(slabPot.gradient) + memory::bytes(ndiffuse) + memory::bytes(level) +
+      ndiffuse.size() * sizeof(long);
+
+  return true;
+}
+
+std::vector<double> DiffuseCalculator::frameParams() const {
+  return {sp.h,     sp.mass,  sp.MINX,  sp.MAXX,  sp.MINY, sp.MAXY,    sp.MINZ, sp.MAXZ,
+          sp.MINTA, sp.MAXTA, sp.MINWC, sp.MAXWC, sp.MINK, sp.MAXK,    sp.KTA,  sp.KWC,
+          sp.TIMESTEP};
+}
+
+long DiffuseCalculator::computeFrame(BucketContainer<particle> &f, int nstep,
+                                     std::string const &fileName, Potentials &pot,
+                                     std::vector<int> &ndiffuse, FrameResult &res) {
+  long npoints = f.getNElements();
+  ndiffuse.assign(npoints, 0);
+
+  res.nstep = nstep;
+  res.params = frameParams();
+  res.nfluid = npoints;
+  if (!binary::fileStamp(fileName, res.sourceSize, res.sourceTime))
+    res.sourceSize = res.sourceTime = 0;
+  res.fluidPairs = computePotentials(f, pot, nullptr);
+  long npdiffuse = countDiffuse(pot, ndiffuse, 0, npoints);
+
+  res.stats.clear();
+  pot.taStats.pack(res.stats);
+  pot.crestStats.pack(res.stats);
+  pot.energyStats.pack(res.stats);
+  res.emitters.clear();
+  res.ndiffuse.clear();
+  for (long i = 0; i < npoints; i++)
+    if (ndiffuse[i] > 0) {
+      res.emitters.push_back(i);
+      res.ndiffuse.push_back(ndiffuse[i]);
     }
 
+  return npdiffuse;
+}
+
+long DiffuseCalculator::farmFrame(FrameFarm &farm, FileWatcher &watcher,
+                                  BucketContainer<particle> &f, int nstep,
+                                  std::string const &fileName, Potentials &pot,
+                                  std::vector<int> &ndiffuse, FluidCounters &counters) {
+  FrameResult res;
+  std::string resultFile = farm.resultFile(nstep);
+  long npoints = f.getNElements();
+  int64_t sourceSize = 0, sourceTime = 0;
+  if (!binary::fileStamp(fileName, sourceSize, sourceTime))
+    sourceSize = sourceTime = 0;
+
+  // Results of the same step and input file, computed with the same parameters
+  auto valid = [&]() {
+    return res.read(resultFile) && res.nstep == nstep && res.nfluid == npoints &&
+           res.sourceSize == sourceSize && res.sourceTime == sourceTime &&
+           res.params == frameParams();
+  };
+
+  bool found = valid();
+  if (!found && !farm.claim(nstep)) {
+    std::cout << "Waiting for the farm: " << resultFile << std::endl;
+    found = watcher.waitFor(resultFile, "", "", sp.followTimeout) && valid();
+    if (!found)
+      std::cerr << "WARNING: the farm result is not valid or did not arrive in time, computing it: "
+                << resultFile << std::endl;
+  }
 
+  if (!found) {
+    long npdiffuse = computeFrame(f, nstep, fileName, pot, ndiffuse, res);
+    counters.fluidPairs = res.fluidPairs;
+    if (!res.write(resultFile))
+      std::cerr << "WARNING: the farm result cannot be written: " << resultFile << std::endl;
+    return npdiffuse;
+  }
 
-    long npdiffuse = 0;
+  std::cerr << "[Stages 1 to 5] taken from the farm. Diffuse particles generated: ";
+  prof.beginStage("farm");
 
-    std::cerr << "[Stage 5] number of diffuse particles generated: ";
-    /*
-     * Fifth pass: number of diffuse particles generated
-     */
+  long npdiffuse = 0;
+  ndiffuse.assign(npoints, 0);
+  for (long i = 0; i < res.emitters.size(); i++) {
+    ndiffuse[res.emitters[i]] = res.ndiffuse[i];
+    npdiffuse += res.ndiffuse[i];
+  }
 
-#ifndef _MSVC
-#pragma omp parallel for simd reduction(+ : npdiffuse)
-#else
-#pragma omp parallel for reduction(+ : npdiffuse)
-#endif
-    for (long i = 0; i < npoints; i++) {
-      ndiffuse[i] = std::floor(
-          energy[i] * (sp.KTA * Ita[i] + sp.KWC * waveCrest[i]) * sp.TIMESTEP);
-      npdiffuse += ndiffuse[i];
+  long position = 0;
+  pot.taStats.mergePacked(res.stats, position);
+  pot.crestStats.mergePacked(res.stats, position);
+  pot.energyStats.mergePacked(res.stats, position);
+  counters.fluidPairs = res.fluidPairs;
+
+  return npdiffuse;
+}
+
+double DiffuseCalculator::writersBytes(long ndiffuse, long nfluid, long ncells) const {
+  double b = 0;
+  if (sp.vtk_files) // Clustering grid, clustered particles and their vtk arrays: velocity and size
+    b += ncells * sizeof(std::vector<oparticle>) +
+         ndiffuse * (sizeof(oparticle) + VTK_POINT_BYTES + 4 * sizeof(double));
+  if (sp.vtk_diffuse_data) // Velocity, id, type and density
+    b += ndiffuse * (VTK_POINT_BYTES + 4 * sizeof(double) + 2 * sizeof(int));
+  if (sp.vtk_fluid_data) // Trapped air, wave crests, energy and diffuse particles
+    b += nfluid * (VTK_POINT_BYTES + 4 * sizeof(double));
+  if (sp.volumeFiles) // Blocks of voxels: about the eight voxels around each particle
+    b += ndiffuse * 8 * sizeof(float);
+  return b;
+}
+
+long DiffuseCalculator::emissionLimit(double stepBytes, long npool, long nfluid,
+                                      long ncells) const {
+  if (sp.memoryLimit <= 0)
+    return std::numeric_limits<long>::max();
+
+  // Peak of a step with n new particles: the step data, the new particles, the pool while the
+  // deleted particles are removed (two copies) or while the new ones are appended, and the writers.
+  double limit = sp.memoryLimit * 1024. * 1024.,
+         fixed = stepBytes + 2. * npool * POOL_BYTES + writersBytes(npool, nfluid, ncells),
+         perParticle = NEW_BYTES + POOL_BYTES + writersBytes(1, nfluid, ncells) -
+                       writersBytes(0, nfluid, ncells);
+  return (long)std::floor((limit - fixed) / perParticle);
+}
+
+bool DiffuseCalculator::runSimulation() {
+  std::string seqnum(sp.nzeros, '0'),
+      formats = std::string("%.") + std::to_string(sp.nzeros) + std::string("d");
+
+  // Persistent particle vector, with the rest of the state kept between steps
+  Checkpoint state;
+  auto &ppPosit = state.posit, &ppVel = state.vel;
+  auto &ppIds = state.ids, &ppTTL = state.ttl;
+  auto &ppDensity = state.density;
+  long &difId = state.difId;
+  std::mt19937 &gen = state.gen;
+
+  // Every process draws the same random numbers
+  std::random_device rd;
+  std::vector<double> seed(1, sp.seed != 0 ? sp.seed : rd());
+  parallel::broadcast(seed);
+  gen.seed((unsigned)seed[0]);
+  std::uniform_real_distribution<> xunif(0, 1);
+
+  // Only the first process writes to the console
+  int nranks = parallel::size();
+  ConsoleGuard console(parallel::rank() != 0);
+  setupThreads();
+
+  int nstart = sp.nstart;
+  if (sp.resumeFile != "") {
+    if (!state.read(sp.resumeFile)) {
+      std::cerr << "ERROR: the checkpoint cannot be read: " << sp.resumeFile << std::endl;
+      return false;
+    }
+    nstart = state.nstep;
+    if (parallel::rank() != 0) { // The first process sends them to their owners
+      ppPosit.clear();
+      ppVel.clear();
+      ppIds.clear();
+      ppTTL.clear();
+      ppDensity.clear();
     }
+    std::cout << "Resuming at step " << nstart << " with " << ppIds.size()
+              << " diffuse particles" << std::endl;
+  }
 
-    std::cerr << npdiffuse << std::endl;
+  std::string checkpointFile = sp.checkpointFile != "" ? sp.checkpointFile :
+    (fs::path(sp.outputPath) / (sp.outputPreffix + "checkpoint.bin")).generic_string();
+  bool stopped = false, failed = false;
+
+  if (sp.profileFile != "" && !prof.open(rankFileName(sp.profileFile)))
+    std::cerr << "WARNING: the profile file cannot be opened: " << sp.profileFile << std::endl;
+
+  if (sp.traceFile != "")
+    trace::enable(sp.traceBufferSize);
+
+  if (sp.hardwareCounters && hw.open())
+    prof.setHardwareCounters(&hw);
+
+  bool split = sp.slabs > 1 || nranks > 1;
+  if (nranks > 1 && sp.slabs > 1)
+    std::cerr << "WARNING: the domain is split among " << nranks << " processes, Slabs is ignored." << std::endl;
+  if (split && sp.vtk_fluid_data)
+    std::cerr << "WARNING: fluid data files are not written when the domain is split into slabs." << std::endl;
+  if (split && sp.memoryLimit > 0)
+    std::cerr << "WARNING: the memory limit is not applied when the domain is split into slabs." << std::endl;
+  if (split && sp.incrementalGrid)
+    std::cerr << "WARNING: the grid is built from scratch when the domain is split into slabs." << std::endl;
+  if (split && sp.cachePath != "")
+    std::cerr << "WARNING: the fluid cache is not used when the domain is split into slabs." << std::endl;
+  if (split && sp.substeps > 1)
+    std::cerr << "WARNING: the fluid velocity is not interpolated between steps when the domain is split into slabs." << std::endl;
+
+  // Stages 1 to 5 computed by the workers of a frame farm
+  std::unique_ptr<FrameFarm> farm;
+  std::unique_ptr<FileWatcher> farmWatcher;
+  if (sp.farmPath != "" && split) {
+    std::cerr << "WARNING: the frame farm is not used when the domain is split into slabs." << std::endl;
+  } else if (sp.farmPath != "") {
+    farm.reset(new FrameFarm(sp.farmPath, sp.outputPreffix));
+    farmWatcher.reset(new FileWatcher(sp.farmPath, sp.followPollInterval));
+    if (sp.vtk_fluid_data)
+      std::cerr << "WARNING: fluid data files are not written for the steps computed by the farm workers." << std::endl;
+  }
 
-    std::cerr << "[Stage 6] calculate diffuse particle positions... " << std::endl;
+  // Index of the files written by each process
+  std::ofstream index;
+  std::string indexFile = (fs::path(sp.outputPath) / (sp.outputPreffix + "index.jsonl")).generic_string();
+  if (nranks > 1 && parallel::rank() == 0) {
+    index.open(indexFile, std::ios::trunc);
+    if (!index)
+      std::cerr << "WARNING: the index file cannot be written: " << indexFile << std::endl;
+  }
 
-    /*
-     * Sixth pass: calculate diffuse particle positions
-     */
+  // Input files written while the simulation runs
+  std::unique_ptr<FileWatcher> watcher;
+  std::string sentinel;
+  if (sp.follow) {
+    watcher.reset(new FileWatcher(sp.dataPath, sp.followPollInterval));
+    if (sp.followSentinel != "")
+      sentinel = (fs::path(sp.dataPath) / sp.followSentinel).generic_string();
+  }
 
-    // Diffuse particle vector!
-    std::vector<std::array<double, 3>> diffusePosit(npdiffuse);
-    std::vector<std::array<double, 3>> diffuseVel(npdiffuse);
-    std::vector<int> diffuseIds(npdiffuse), diffuseTTL(npdiffuse);
-    std::vector<double> diffuseDensity(npdiffuse, 0.0);
+  // Input file of a step
+  auto stepFileName = [&](int n) {
+    std::string num(seqnum);
+    std::sprintf(&num[0], formats.c_str(), n);
+    return (fs::path(sp.dataPath) / (sp.filePrefix + num + ".vtk")).generic_string();
+  };
 
-		// Generate random numbers: this is done out of the loop because it is not thread safe
-		std::vector<double> tempRand(npdiffuse * 3);
-		for (auto &x : tempRand)
-			x = xunif(gen);
+  // Fluid particles, kept from a step to the next one to update the grid incrementally
+  std::unique_ptr<FluidData> file;
 
+  // Fluid particles of the next step, for the substeps. The next step takes them
+  std::unique_ptr<FluidData> next;
 
+  // Loads the fluid particles of a step, updating the previous ones if the grid is incremental
+  auto loadStep = [&](std::unique_ptr<FluidData> &data, std::string const &name) {
+    if (!sp.incrementalGrid || !data) {
+      data.reset(new FluidData(sp.MINX, sp.MAXX, sp.MINY, sp.MAXY, sp.MINZ, sp.MAXZ, sp.h));
 
-    {
-      long idif = 0;
-
-#pragma omp parallel for schedule(guided)
-      for (long nebucket = 0; nebucket < buckets.size(); nebucket++) { // Iterate over all buckets
-        auto &bucket = buckets[nebucket].second;
-
-        for (auto &pi : bucket) { // Iterate over each particle in the bucket
-          long i = pi.id;
-
-          if (ndiffuse[i] >= 1) {
-            std::array<double, 3> pos = pi.pos, vel = pi.vel;
-
-            // Obtain orthogonal vectors to velocity vector
-            std::array<double, 3> e1, e2;
-
-            // Find non-zero component of velocity vector in order to avoid
-            // division by 0 and calculate e1
-            if (vel[0] != 0) { // x non zero
-
-              e1 = ops::normalize({{solveEq(pos[2], pos[1], pos[0], vel[2],
-                                            vel[1], vel[0], 0, 1),
-                                    1, 0}});
-            } else if (vel[1] != 0) { // y non zero
-              e1 = ops::normalize({{1,
-                                    solveEq(pos[0], pos[2], pos[1], vel[0],
-                                            vel[2], vel[1], 1, 0),
-                                    0}});
-            } else { // z non zero
-              e1 = ops::normalize({{1, 0,
-                                    solveEq(pos[0], pos[1], pos[2], vel[0],
-                                            vel[1], vel[2], 1, 0)}});
-            }
+      if (std::string(sp.exclusionZoneFile) != "")
+        data->setExclusionZone(sp.exclusionZoneFile);
+    }
 
-            // Cross product of two orthogonal vectors generate a vector
-            // orthogonal to them
-            e2 = ops::normalize({{e1[1] * vel[2] - vel[1] * e1[2],
-                                  e1[0] * vel[2] - vel[0] * e1[2],
-                                  e1[0] * vel[1] - vel[0] * e1[1]}});
+    long long bytes = loadFluid(*data, sp.cachePath, name, sp.incrementalGrid);
+    if (bytes < 0)
+      return bytes;
+    if (sp.incrementalGrid)
+      prof.count("rebinned", data->getRebinned());
 
-            std::array<double, 3> nvel =
-                ops::normalize(std::array<double, 3>{{vel[0], vel[1], vel[2]}});
+    arrangeFluid(*data->getBucketContainer());
+    return bytes;
+  };
 
-            for (int j = 0; j < ndiffuse[i]; j++) {
-              double h = tempRand[idif * 3] *
-                         (ops::magnitude(std::array<double, 3>{{vel[0], vel[1], vel[2]}}) * sp.TIMESTEP) *
-												 .5,
-                     r = sp.h * sqrt(tempRand[idif * 3 + 1]), theta = tempRand[idif * 3 + 2] * 2 * M_PI;
-
-              // Position of newly created diffuse particle
-              diffusePosit[idif] = {{pos[0] + r * cos(theta) * e1[0] +
-                                         r * sin(theta) * e2[0] + h * nvel[0],
-                                     pos[1] + r * cos(theta) * e1[1] +
-                                         r * sin(theta) * e2[1] + h * nvel[1],
-                                     pos[2] + r * cos(theta) * e1[2] +
-                                         r * sin(theta) * e2[2] + h * nvel[2]}};
-
-              // Velocity of newly created diffuse particle
-              diffuseVel[idif] = {
-                  {r * cos(theta) * e1[0] + r * sin(theta) * e2[0] + vel[0],
-                   r * cos(theta) * e1[1] + r * sin(theta) * e2[1] + vel[1],
-                   r * cos(theta) * e1[2] + r * sin(theta) * e2[2] + vel[2]}};
-
-              // Particle ID
-              diffuseIds[idif] = difId;
-
-              // Particle lifetime
-              diffuseTTL[idif] = ndiffuse[i] * sp.LIFEFIME;
-
-              difId++;
-              idif++;
-            }
-          }
-        }
-      }
+  // Let's loop!
+  for (int nstep = nstart; nstep <= sp.nend; nstep++) {
+    prof.beginStep(nstep);
+    prof.beginStage("load");
+
+    std::sprintf(&seqnum[0], formats.c_str(), nstep);
+    std::string fileName = stepFileName(nstep);
+
+    std::cout << "\n\n== [" << " Step " << nstep << " of " << sp.nend << " ] ===================================================================\n";
+
+    if (watcher) {
+      std::string nextName = stepFileName(nstep + 1);
+      bool ready = parallel::rank() != 0 || watcher->waitFor(fileName, nextName, sentinel, sp.followTimeout);
+      if (!parallel::all(ready))
+        break; // No more input files
     }
 
-    // Seventh pass: classify particles
-    //[0-6]Spray [6-20]Foam [20..]Bubbles ¿?
-    std::cerr << "[Stage 7] classify particles... " << std::endl;;
+    std::cout << "Opening: " << fileName << std::endl;
 
-#pragma omp parallel for schedule(guided)
-    for (long i = 0; i < npdiffuse; i++) {
-      auto pxd = diffusePosit[i];
-      auto sbuckets = f.getSurroundingBuckets(pxd);
-      for (auto sb : sbuckets) { // Iterate over surrounding buckets
-        for (auto &pj : *sb) {   // Iterate over each particle in the bucket
-          if (ops::magnitude(ops::substract(pxd, pj.pos)) <= sp.h) {
-            diffuseDensity[i]++;
-          }
-        }
+    Potentials pot;
+    std::vector<int> ndiffuse; // Number of diffuse particles generated by each fluid particle
+    Emission em;
+    FluidCounters counters;
+    long npoints = 0, npdiffuse = 0, nemitted = 0;
+
+    if (nranks > 1) {
+      if (!runRanks(fileName, state, pot, em, counters, nemitted)) // Cannot open the file, finish the simulation!!
+        break;
+
+      npoints = counters.nfluid;
+      npdiffuse = em.ids.size();
+      if (parallel::rank() == 0)
+        prof.count("bytes_read", fileBytes(fileName));
+      prof.count("fluid_particles", npoints);
+      prof.count("fluid_pairs", counters.fluidPairs);
+      prof.count("emitted", npdiffuse);
+      std::cout << "Total fluid particles: " << parallel::sum(npoints) << std::endl
+                << "Diffuse particles generated: " << nemitted << std::endl;
+
+    } else if (sp.slabs > 1) {
+      if (!runSlabs(fileName, state, pot, em, counters)) // Cannot open the file, finish the simulation!!
+        break;
+
+      npoints = counters.nfluid;
+      nemitted = npdiffuse = em.ids.size();
+      prof.count("bytes_read", fileBytes(fileName));
+      prof.count("fluid_particles", npoints);
+      prof.count("fluid_pairs", counters.fluidPairs);
+      prof.count("emitted", npdiffuse);
+      std::cout << "Total fluid particles: " << npoints << std::endl
+                << "Diffuse particles generated: " << npdiffuse << std::endl;
+
+    } else {
+      long long bytes = 0;
+      if (next) // Loaded by the previous step
+        std::swap(file, next);
+      else if ((bytes = loadStep(file, fileName)) < 0) // Cannot open the file, finish the simulation!!
+        break;
+
+      // The next step, to interpolate the velocity of the fluid in the substeps. The particles of
+      // the previous step are updated to it if the grid is incremental
+      if (sp.substeps > 1 && nstep < sp.nend) {
+        std::string nextName = stepFileName(nstep + 1);
+        bool ready = !watcher || watcher->waitFor(nextName, stepFileName(nstep + 2), sentinel, sp.followTimeout);
+        long long nextBytes = ready ? loadStep(next, nextName) : -1;
+        if (nextBytes >= 0)
+          bytes += nextBytes;
+        else
+          next.reset();
+      } else {
+        next.reset();
       }
-    }
 
-    // Update particles
+      BucketContainer<particle> &f = *(file->getBucketContainer());
 
-    std::cerr << "[Stage 8] update particles... " << std::endl;;
+      npoints = f.getNElements(); // output->GetPoints()->GetNumberOfPoints();
+      counters.nfluid = npoints;
+      counters.ncells = f.getBuckets().size();
 
-#pragma omp parallel for schedule(guided)
-    for (long i = 0; i < ppIds.size(); i++) {
-      auto &pxd = ppPosit[i];
-			auto temppos = ppPosit[i];
-      std::array<double, 3> num{{0, 0, 0}};
-      double den = 0;
+      prof.count("bytes_read", bytes);
+      prof.count("fluid_particles", npoints);
 
-			// Recalculate density: should be placed before the new position calculation.
-      ppDensity[i] = 0;
-      for (auto sb : f.getSurroundingBuckets(pxd)) { // Iterate over surrounding buckets
-        for (auto &pj : *sb) { // Iterate over each particle in the bucket
-          if (ops::magnitude(ops::substract(pxd, pj.pos)) <= sp.h) {
-            ppDensity[i]++;
-          }
-        }
+      ndiffuse.assign(npoints, 0);
+
+      std::cout << "Total fluid particles: " << npoints << std::endl;
+
+      if (farm) {
+        npdiffuse = farmFrame(*farm, *farmWatcher, f, nstep, fileName, pot, ndiffuse, counters);
+      } else {
+        counters.fluidPairs = computePotentials(f, pot, nullptr);
+        npdiffuse = countDiffuse(pot, ndiffuse, 0, npoints);
       }
+      prof.count("fluid_pairs", counters.fluidPairs);
+
+      // Memory of the step so far, and maximum number of new diffuse particles within the limit
+      counters.fluidBytes = memory::bytes(f.getBuckets()) +
+                            (next ? memory::bytes(next->getBucketContainer()->getBuckets()) : 0);
+      counters.temporaryBytes = memory::bytes(pot.Ita) + memory::bytes(pot.colorField) +
+                               memory::bytes(pot.waveCrest) + memory::bytes(pot.energy) +
+                               memory::bytes(pot.gradient) + memory::bytes(ndiffuse) +
+                               npoints * sizeof(long);
+      long maxEmission = emissionLimit(counters.fluidBytes + counters.temporaryBytes,
+                                       ppIds.size(), npoints, counters.ncells);
+      std::vector<int> kept; // Diffuse particles created by each fluid particle, if capped
+
+      if (sp.memoryLimit > 0 && npdiffuse > std::max(0L, maxEmission)) {
+        if (sp.memoryPolicy == "stop") {
+          state.nstep = nstep;
+          bool written = state.write(checkpointFile);
+          std::cerr << std::endl << "ERROR: " << npdiffuse << " new diffuse particles exceed the memory limit of "
+                    << sp.memoryLimit << " MB (" << std::max(0L, maxEmission) << " fit)." << std::endl;
+          if (written)
+            std::cerr << "The state before step " << nstep << " was saved to " << checkpointFile
+                      << ". Set ResumeFile to continue from it." << std::endl;
+          else
+            std::cerr << "ERROR: the checkpoint cannot be written: " << checkpointFile << std::endl;
+          prof.endStep();
+          stopped = true;
+          break;
+        }
 
-			if (ppDensity[i] >= sp.SPRAY) { // This is not needed for spray particles.
-				std::vector<std::vector<particle> *> sbuckets = f.getSurroundingBuckets(pxd);
-				for (auto sb : sbuckets) { // Iterate over surrounding buckets
-					for (auto &pj : *sb) {   // Iterate over each particle in the bucket
-						double tval = Wwendland(ops::substract(pxd, pj.pos), sp.h);
-						num = {{num[0] + pj.vel[0] * tval,
-										num[1] + pj.vel[1] * tval,
-										num[2] + pj.vel[2] * tval}};
-						den += tval;
-					}
-				}
-			}
-
-      // Now we can re-clasify and calculate new positions
-      if (ppDensity[i] < sp.SPRAY) { // It's spray!
-        // TODO: we are avoiding external forces (like wind)
-        ppVel[i] = {{ppVel[i][0], ppVel[i][1], ppVel[i][2] + -9.81 * sp.TIMESTEP}};
-        pxd = {{pxd[0] + sp.TIMESTEP * ppVel[i][0],
-                pxd[1] + sp.TIMESTEP * ppVel[i][1],
-                pxd[2] + sp.TIMESTEP * ppVel[i][2]}};
-
-      } else if (ppDensity[i] > sp.BUBBLES) { // It's a bubble!
-        num = {{num[0] / den, num[1] / den, num[2] / den}};
-        ppVel[i] = {{ppVel[i][0] + sp.TIMESTEP * (sp.KD * (num[0] - ppVel[i][0]) / sp.TIMESTEP),
-		    						 ppVel[i][1] + sp.TIMESTEP * (sp.KD * (num[1] - ppVel[i][1]) / sp.TIMESTEP),
-		     						 ppVel[i][2] + sp.TIMESTEP * (-sp.KB * -9.81 + sp.KD * (num[2] - ppVel[i][2]) / sp.TIMESTEP)}};
-        pxd = {{pxd[0] + sp.TIMESTEP * ppVel[i][0],
-                pxd[1] + sp.TIMESTEP * ppVel[i][1],
-                pxd[2] + sp.TIMESTEP * ppVel[i][2]}};
-
-      } else { // It's foam!
-        num = {{num[0] / den, num[1] / den, num[2] / den}};
-        ppVel[i] = {{num[0], num[1], num[2]}};
-	
-        pxd = {{pxd[0] + sp.TIMESTEP * num[0],
-								pxd[1] + sp.TIMESTEP * num[1],
-                pxd[2] + sp.TIMESTEP * num[2]}};
+        // Thin the emission evenly: each particle keeps its share of the allowed total. The
+        // generated counts are kept, since they set the lifetimes and the histogram
+        double fraction = (double)std::max(0L, maxEmission) / npdiffuse;
+        long emitted = 0;
+        kept.resize(npoints);
+        for (long i = 0, n = 0; i < npoints; i++) {
+          kept[i] = (long)((n + ndiffuse[i]) * fraction) - (long)(n * fraction);
+          n += ndiffuse[i];
+          emitted += kept[i];
+        }
+        std::cerr << std::endl << "WARNING: memory limit of " << sp.memoryLimit << " MB, emission capped from "
+                  << npdiffuse << " to " << emitted << " diffuse particles." << std::endl;
+        prof.count("capped", npdiffuse - emitted);
+        npdiffuse = emitted;
       }
+
+      std::cerr << npdiffuse << std::endl;
+      prof.count("emitted", npdiffuse);
+      nemitted = npdiffuse;
+
+      emitDiffuse(f, ndiffuse, kept.empty() ? ndiffuse : kept, difId, gen, em);
+      counters.diffusePairs += classifyDiffuse(f, em, nullptr);
+      counters.diffusePairs += updateDiffuse(f, state, nullptr,
+                                             next ? next->getBucketContainer() : nullptr);
     }
 
+    difId += nemitted;
+
     // Delete particles
+    prof.count("diffuse_pairs", counters.diffusePairs);
+
     std::cerr << "[Stage 9] delete particles... ";
+    prof.beginStage("stage9");
+
+    // Diffuse particles of each class written in this step, counted in stages 7 and 9
+    long nspray = em.nspray, nfoam = em.nfoam, nbubbles = em.nbubbles;
 
     std::vector<std::array<double, 3>> tempPosit, tempVel;
     std::vector<int> tempIds, tempTTL;
     std::vector<double> tempDensity;
+    tempPosit.reserve(ppIds.size());
+    tempVel.reserve(ppIds.size());
+    tempIds.reserve(ppIds.size());
+    tempTTL.reserve(ppIds.size());
+    tempDensity.reserve(ppIds.size());
 
     for (long i = 0; i < ppIds.size(); i++) {
       // Decrease TTL for foam particles
@@ -590,34 +1724,61 @@ void DiffuseCalculator::runSimulation() {
         tempIds.push_back(ppIds[i]);
         tempTTL.push_back(ppTTL[i]);
         tempDensity.push_back(ppDensity[i]);
+
+        if (ppDensity[i] < sp.SPRAY)
+          nspray++;
+        else if (ppDensity[i] > sp.BUBBLES)
+          nbubbles++;
+        else
+          nfoam++;
       }
     }
 
+    long ndeleted = ppIds.size() - tempIds.size();
+
 		ppIds = std::move(tempIds);
 		ppPosit = std::move(tempPosit);
 		ppVel = std::move(tempVel);
 		ppDensity = std::move(tempDensity);
 		ppTTL = std::move(tempTTL);
 
-    std::cout << "Deleted: " << ppIds.size() - tempIds.size() << std::endl;
+    std::cout << "Deleted: " << parallel::sum(ndeleted) << std::endl;
+    prof.count("deleted", ndeleted);
+    prof.count("spray", nspray);
+    prof.count("foam", nfoam);
+    prof.count("bubbles", nbubbles);
 
 
     // Append new particles
     std::cerr << "[Stage 10] append new particles. Total diffuse particles: "
-              << ppIds.size() << std::endl;
+              << parallel::sum(ppIds.size()) << std::endl;
+    prof.beginStage("stage10");
 
     if (npdiffuse > 0) {
-      std::copy(diffuseIds.begin(), diffuseIds.end(), std::back_inserter(ppIds));
-      std::copy(diffusePosit.begin(), diffusePosit.end(), std::back_inserter(ppPosit));
-      std::copy(diffuseVel.begin(), diffuseVel.end(), std::back_inserter(ppVel));
-      std::copy(diffuseDensity.begin(), diffuseDensity.end(), std::back_inserter(ppDensity));
-      std::copy(diffuseTTL.begin(), diffuseTTL.end(), std::back_inserter(ppTTL));
+      ppIds.reserve(ppIds.size() + npdiffuse);
+      ppPosit.reserve(ppIds.size() + npdiffuse);
+      ppVel.reserve(ppIds.size() + npdiffuse);
+      ppDensity.reserve(ppIds.size() + npdiffuse);
+      ppTTL.reserve(ppIds.size() + npdiffuse);
+      std::copy(em.ids.begin(), em.ids.end(), std::back_inserter(ppIds));
+      std::copy(em.posit.begin(), em.posit.end(), std::back_inserter(ppPosit));
+      std::copy(em.vel.begin(), em.vel.end(), std::back_inserter(ppVel));
+      std::copy(em.density.begin(), em.density.end(), std::back_inserter(ppDensity));
+      std::copy(em.ttl.begin(), em.ttl.end(), std::back_inserter(ppTTL));
     }
 
     /*
      * Write diffuse particle files
      */
     std::cerr << "[Stage 11] save to file... " << std::endl; 
+    prof.beginStage("stage11");
+    prof.count("diffuse_particles", ppIds.size());
+
+    std::string textFilename = rankFileName((fs::path(sp.outputPath) / (sp.outputPreffix + seqnum + ".txt")).generic_string()),
+      vtkFilename = rankFileName((fs::path(sp.outputPath) / (sp.outputPreffix + seqnum + ".vtk")).generic_string()),
+      diffuseFilename = rankFileName((fs::path(sp.outputPath) / (sp.outputPreffix + seqnum + "_diffuse.vtk")).generic_string()),
+      volumeFilename = rankFileName((fs::path(sp.outputPath) / (sp.outputPreffix + seqnum + ".fvol")).generic_string()),
+      fluidFilename = (fs::path(sp.outputPath) / (sp.outputPreffix + seqnum + "_fluid.vtk")).generic_string();
 
 #ifndef _MSVC
 #pragma omp parallel sections
@@ -628,9 +1789,9 @@ void DiffuseCalculator::runSimulation() {
 #pragma omp section
 #endif
       if (sp.text_files) {
+        trace::Span span("text writer");
         // Save diffuse particles to simple text files
-		std::string outFilename = (fs::path(sp.outputPath) / (sp.outputPreffix + seqnum + ".txt")).generic_string();
-        std::ofstream tfile(outFilename, std::ios::trunc);
+        std::ofstream tfile(textFilename, std::ios::trunc);
         tfile.setf(std::ios::scientific);
 
         for (long i = 0; i < ppIds.size(); i++) {
@@ -651,8 +1812,7 @@ void DiffuseCalculator::runSimulation() {
 #pragma omp section
 #endif
       if (sp.vtk_files) {
-        std::string vtkFilename =
-            (fs::path(sp.outputPath) / (sp.outputPreffix + seqnum + ".vtk")).generic_string();
+        trace::Span span("vtk writer");
         VtkDWriter output(vtkFilename, sp.MINX, sp.MAXX, sp.MINY, sp.MAXY,
                           sp.MINZ, sp.MAXZ, sp.h);
         output.setData(&ppPosit, &ppVel);
@@ -663,6 +1823,7 @@ void DiffuseCalculator::runSimulation() {
 #pragma omp section
 #endif
       if (sp.vtk_diffuse_data) {
+        trace::Span span("diffuse data writer");
 
         // Save diffuse particle data
         vtkSmartPointer<vtkPoints> dpoints = vtkSmartPointer<vtkPoints>::New();
@@ -714,30 +1875,44 @@ void DiffuseCalculator::runSimulation() {
         difpolydata->GetPointData()->AddArray(dvels);
         difpolydata->GetPointData()->AddArray(density);
 
-        std::string outFilename =
-            (fs::path(sp.outputPath) / (sp.outputPreffix + seqnum + "_diffuse.vtk")).generic_string();
-
         vtkSmartPointer<vtkPolyDataWriter> writer =
             vtkSmartPointer<vtkPolyDataWriter>::New();
 				writer->SetFileTypeToBinary();
-        writer->SetFileName(outFilename.c_str());
+        writer->SetFileName(diffuseFilename.c_str());
         writer->SetInputData(difpolydata);
         writer->Write();
       }
 
+#ifndef _MSVC
+#pragma omp section
+#endif
+      if (sp.volumeFiles) {
+        trace::Span span("volume writer");
+        // Density volumes of each class, for volumetric rendering
+        VolumeWriter output(volumeFilename, {{sp.MINX, sp.MINY, sp.MINZ}},
+                            sp.h / sp.volumeResolution);
+        output.setData(&ppPosit, &ppDensity, sp.SPRAY, sp.BUBBLES);
+        if (!output.write()) {
+          std::cerr << "ERROR: the volume file cannot be written: " << volumeFilename << std::endl;
+          failed = true;
+        }
+      }
+
       /*
        * Write intermediary files
        */
 #ifndef _MSVC
 #pragma omp section
 #endif
-      if (sp.vtk_fluid_data) {
+      if (sp.vtk_fluid_data && file && !pot.Ita.empty()) { // Potentials taken from the farm are not available
+        trace::Span span("fluid data writer");
+        auto &Ita = pot.Ita, &waveCrest = pot.waveCrest, &energy = pot.energy;
 
         vtkSmartPointer<vtkPoints> ppoints = vtkSmartPointer<vtkPoints>::New();
 
         // int nbucket = 0;
 
-        for (auto &bucket : f.getBuckets()) { // Iterate over surrounding buckets
+        for (auto &bucket : file->getBucketContainer()->getBuckets()) { // Iterate over surrounding buckets
           for (auto &pi : bucket) { // Iterate over each particle in the bucket
             ppoints->InsertNextPoint(pi.pos.data());
           }
@@ -783,18 +1958,372 @@ void DiffuseCalculator::runSimulation() {
 
         vtkSmartPointer<vtkPolyDataWriter> writer =
             vtkSmartPointer<vtkPolyDataWriter>::New();
-        std::string outFilename =
-            (fs::path(sp.outputPath) / (sp.outputPreffix + seqnum + "_fluid.vtk")).generic_string();
 				writer->SetFileTypeToBinary();
-        writer->SetFileName(outFilename.c_str());
+        writer->SetFileName(fluidFilename.c_str());
         writer->SetInputData(ppolydata);
         writer->Write();
       }
     }
 
+    if (sp.text_files)
+      prof.count("bytes_written", fileBytes(textFilename));
+    if (sp.vtk_files)
+      prof.count("bytes_written", fileBytes(vtkFilename));
+    if (sp.vtk_diffuse_data)
+      prof.count("bytes_written", fileBytes(diffuseFilename));
+    if (sp.vtk_fluid_data && file && !pot.Ita.empty())
+      prof.count("bytes_written", fileBytes(fluidFilename));
+    if (sp.volumeFiles)
+      prof.count("bytes_written", fileBytes(volumeFilename));
+    if (sp.text_files || sp.vtk_files || sp.vtk_diffuse_data || sp.volumeFiles)
+      prof.count("written", ppIds.size());
+
+    // One line per step with the files and the number of particles of each process
+    std::vector<double> written;
+    if (nranks > 1)
+      parallel::gather(std::vector<double>(1, ppIds.size()), written);
+    if (index.is_open()) {
+      index << "{\"step\": " << nstep << ", \"particles\": "
+            << (long)std::accumulate(written.begin(), written.end(), 0.0) << ", \"parts\": [";
+      for (int r = 0; r < written.size(); r++) {
+        std::string suffix = "_r" + std::to_string(r);
+        index << (r > 0 ? ", " : "") << "{\"rank\": " << r << ", \"particles\": " << (long)written[r]
+              << ", \"files\": [";
+        std::string sep = "";
+        if (sp.text_files)
+          index << sep << "\"" << sp.outputPreffix + seqnum + suffix + ".txt\"", sep = ", ";
+        if (sp.vtk_files)
+          index << sep << "\"" << sp.outputPreffix + seqnum + suffix + ".vtk\"", sep = ", ";
+        if (sp.vtk_diffuse_data)
+          index << sep << "\"" << sp.outputPreffix + seqnum + "_diffuse" + suffix + ".vtk\"", sep = ", ";
+        if (sp.volumeFiles)
+          index << sep << "\"" << sp.outputPreffix + seqnum + suffix + ".fvol\"";
+        index << "]}";
+      }
+      index << "]}" << std::endl;
+    }
+
+    // Memory accounting, with the random numbers of stage 6
+    double fluidMemory = counters.fluidBytes,
+           temporaryMemory = counters.temporaryBytes + memory::bytes(em.posit) +
+                             memory::bytes(em.vel) + memory::bytes(em.ids) +
+                             memory::bytes(em.ttl) + memory::bytes(em.density) +
+                             npdiffuse * 3 * sizeof(double);
+    double poolMemory = memory::bytes(ppPosit) + memory::bytes(ppVel) + memory::bytes(ppIds) +
+                        memory::bytes(ppTTL) + memory::bytes(ppDensity),
+           writerMemory = writersBytes(ppIds.size(), file ? npoints : 0, counters.ncells),
+           resident = memory::residentBytes(), peak = memory::peakResidentBytes();
+    const double MB = 1024. * 1024.;
+
+    std::cout << "Memory (MB): fluid " << fluidMemory / MB << ", temporaries " << temporaryMemory / MB
+              << ", diffuse " << poolMemory / MB << ", writers " << writerMemory / MB
+              << ", resident " << resident / MB << " (peak " << peak / MB << ")" << std::endl;
+    prof.count("mem_fluid", fluidMemory);
+    prof.count("mem_temporaries", temporaryMemory);
+    prof.count("mem_diffuse", poolMemory);
+    prof.count("mem_writers", writerMemory);
+    prof.count("mem_resident", resident);
+    prof.count("mem_peak", peak);
+
+    prof.endStep();
+
+    nspray = parallel::sum(nspray);
+    nfoam = parallel::sum(nfoam);
+    nbubbles = parallel::sum(nbubbles);
+
     std::cerr << std::endl
       << "=== Statistics:" << std::endl
-      << stats;
+      << "Wave crests: " << pot.crestStats.toString() << std::endl
+      << "Trapped air: " << pot.taStats.toString() << std::endl
+      << "Energy:      " << pot.energyStats.toString() << std::endl
+      << "Diffuse:     [Spray: " << nspray << " ] [Foam: " << nfoam
+      << " ] [Bubbles: " << nbubbles << " ]" << std::endl
+      << "Emission:    ";
+    for (int b = 0; b < em.histogram.size(); b++)
+      if (em.histogram[b] > 0)
+        std::cerr << "[" << b + 1 << (b == EMISSION_BINS - 1 ? "+" : "") << ": "
+                  << em.histogram[b] << " ] ";
+    std::cerr << std::endl;
+
+  }
+
+  // The final state can be saved to continue the simulation later
+  if (!stopped && sp.checkpointFile != "") {
+    state.nstep = sp.nend + 1;
+    gatherDiffuse(state);
+    if (parallel::rank() == 0 && !state.write(sp.checkpointFile)) {
+      std::cerr << "ERROR: the checkpoint cannot be written: " << sp.checkpointFile << std::endl;
+      failed = true;
+    }
+  }
+
+  prof.printSummary(std::cout);
+
+  if (sp.traceFile != "" && !trace::write(rankFileName(sp.traceFile)))
+    std::cerr << "WARNING: the trace file cannot be written: " << sp.traceFile << std::endl;
+  return !stopped && !failed;
+}
+
+bool DiffuseCalculator::runWorker() {
+  setupThreads();
+  if (sp.farmPath == "") {
+    std::cerr << "ERROR: a farm worker needs FarmPath." << std::endl;
+    return false;
+  }
+
+  std::string seqnum(sp.nzeros, '0'),
+      formats = std::string("%.") + std::to_string(sp.nzeros) + std::string("d");
+  FrameFarm farm(sp.farmPath, sp.outputPreffix);
+
+  if (sp.profileFile != "" && !prof.open(sp.profileFile))
+    std::cerr << "WARNING: the profile file cannot be opened: " << sp.profileFile << std::endl;
+
+  std::unique_ptr<FileWatcher> watcher;
+  std::string sentinel;
+  if (sp.follow) {
+    watcher.reset(new FileWatcher(sp.dataPath, sp.followPollInterval));
+    if (sp.followSentinel != "")
+      sentinel = (fs::path(sp.dataPath) / sp.followSentinel).generic_string();
+  }
+
+  long ntaken = 0;
+  bool failed = false;
+  for (int nstep = sp.nstart; nstep <= sp.nend; nstep++) {
+    if (!farm.claim(nstep)) // Taken by another process
+      continue;
+
+    std::sprintf(&seqnum[0], formats.c_str(), nstep);
+    std::string fileName = (fs::path(sp.dataPath) / (sp.filePrefix + seqnum + ".vtk")).generic_string();
+
+    if (watcher) {
+      std::string nextName(seqnum);
+      std::sprintf(&nextName[0], formats.c_str(), nstep + 1);
+      nextName = (fs::path(sp.dataPath) / (sp.filePrefix + nextName + ".vtk")).generic_string();
+      if (!watcher->waitFor(fileName, nextName, sentinel, sp.followTimeout)) {
+        farm.release(nstep);
+        break; // No more input files
+      }
+    }
+
+    std::cout << "\n== [ Farm step " << nstep << " of " << sp.nend << " ] ==========\n"
+              << "Opening: " << fileName << std::endl;
+    prof.beginStep(nstep);
+    prof.beginStage("load");
+
+    FluidData file(sp.MINX, sp.MAXX, sp.MINY, sp.MAXY, sp.MINZ, sp.MAXZ, sp.h);
+    if (loadFluid(file, sp.cachePath, fileName, false) < 0) { // The simulation finds that the file is missing and stops there
+      farm.release(nstep);
+      prof.endStep();
+      break;
+    }
+    BucketContainer<particle> &f = *(file.getBucketContainer());
+    arrangeFluid(f);
 
+    Potentials pot;
+    std::vector<int> ndiffuse;
+    FrameResult res;
+    long npdiffuse = computeFrame(f, nstep, fileName, pot, ndiffuse, res);
+    std::cerr << npdiffuse << std::endl;
+
+    prof.beginStage("write");
+    if (!res.write(farm.resultFile(nstep))) {
+      std::cerr << "ERROR: the farm result cannot be written: " << farm.resultFile(nstep) << std::endl;
+      farm.release(nstep);
+      prof.endStep();
+      failed = true;
+      break;
+    }
+
+    prof.count("fluid_particles", res.nfluid);
+    prof.count("fluid_pairs", res.fluidPairs);
+    prof.count("emitted", npdiffuse);
+    prof.endStep();
+    ntaken++;
+  }
+
+  std::cout << "Steps computed by this worker: " << ntaken << std::endl;
+  prof.printSummary(std::cout);
+  return !failed;
+}
+
+// Mixes the bits of an integer (splitmix64), to sample blocks of buckets
+static unsigned long long mixBits(unsigned long long x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+bool DiffuseCalculator::runAnalysis() {
+  setupThreads();
+
+  auto start = std::chrono::steady_clock::now();
+
+  std::string seqnum(sp.nzeros, '0'),
+      formats = std::string("%.") + std::to_string(sp.nzeros) + std::string("d");
+
+  // Steps evenly spaced over the run
+  int nrun = sp.nend - sp.nstart + 1,
+      nsample = std::max(1, std::min(sp.analyzeSteps, nrun));
+  std::vector<int> steps;
+  for (int s = 0; s < nsample; s++)
+    steps.push_back(sp.nstart + (nsample > 1 ? (long)s * (nrun - 1) / (nsample - 1) : 0));
+
+  // Buckets are sampled in blocks, so that most of the neighbours of a sampled particle are sampled too
+  const long BLOCK = 8;
+  bool sampleAll = sp.analyzeFraction >= 1;
+
+  // Positive values of each potential in all the sampled steps
+  StreamStats taStats, crestStats, energyStats;
+
+  // Sampled potentials of each step: trapped air, wave crests and energy
+  std::vector<std::vector<std::array<double, 3>>> samples;
+  std::vector<long> fluidParticles;
+  long maxBuckets = 0;
+
+  for (int nstep : steps) {
+    std::sprintf(&seqnum[0], formats.c_str(), nstep);
+    std::string fileName = (fs::path(sp.dataPath) / (sp.filePrefix + seqnum + ".vtk")).generic_string();
+
+    std::cout << "\n== [ Analysis of step " << nstep << " ] ==\n";
+    std::cout << "Opening: " << fileName << std::endl;
+
+    prof.beginStep(nstep);
+    prof.beginStage("load");
+
+    FluidData file(sp.MINX, sp.MAXX, sp.MINY, sp.MAXY, sp.MINZ, sp.MAXZ, sp.h);
+    if (loadFluid(file, sp.cachePath, fileName, false) < 0)
+      break;
+
+    BucketContainer<particle> &f = *(file.getBucketContainer());
+    auto &buckets = f.getNoEmptyBuckets();
+    long npoints = f.getNElements();
+    maxBuckets = std::max(maxBuckets, (long)f.getBuckets().size());
+
+    // Sampled buckets get level 3, their neighbours 2 and the neighbours of those 1
+    std::vector<char> level;
+    if (!sampleAll) {
+      level.assign(f.getBuckets().size(), 0);
+      for (auto &b : buckets) {
+        auto c = f.getBucketCoords(b.first);
+        unsigned long long block = (c[0] / BLOCK) + 0x10000ULL * (c[1] / BLOCK) +
+                                   0x100000000ULL * (c[2] / BLOCK);
+        if ((mixBits(block ^ ((unsigned long long)sp.seed << 48)) >> 11) * 0x1.0p-53 < sp.analyzeFraction)
+          level[b.first] = 3;
+      }
+      for (char l = 3; l > 1; l--)
+        for (auto &b : buckets)
+          if (level[b.first] == l)
+            for (long n : f.getSurroundingBucketNumbers(b.first))
+              level[n] = std::max(level[n], (char)(l - 1));
+    }
+
+    Potentials pot;
+    prof.count("fluid_pairs", computePotentials(f, pot, sampleAll ? nullptr : &level));
+    prof.endStep();
+
+    std::vector<std::array<double, 3>> stepSamples;
+    for (auto &b : buckets) {
+      if (!sampleAll && level[b.first] < 3)
+        continue;
+      for (auto &pi : b.second) {
+        long i = pi.id;
+        stepSamples.push_back({{pot.Ita[i], pot.waveCrest[i], pot.energy[i]}});
+        if (pot.Ita[i] > 0)
+          taStats.add(pot.Ita[i]);
+        if (pot.waveCrest[i] > 0)
+          crestStats.add(pot.waveCrest[i]);
+        if (pot.energy[i] > 0)
+          energyStats.add(pot.energy[i]);
+      }
+    }
+
+    std::cout << "Sampled " << stepSamples.size() << " of " << npoints << " fluid particles" << std::endl;
+    samples.push_back(std::move(stepSamples));
+    fluidParticles.push_back(npoints);
   }
+
+  if (samples.empty()) {
+    std::cerr << "ERROR: no steps could be analyzed." << std::endl;
+    return false;
+  }
+
+  double lo = sp.analyzeLowPercentile / 100., hi = sp.analyzeHighPercentile / 100.;
+  double pMINTA = taStats.quantile(lo), pMAXTA = taStats.quantile(hi),
+         pMINWC = crestStats.quantile(lo), pMAXWC = crestStats.quantile(hi),
+         pMINK = energyStats.quantile(lo), pMAXK = energyStats.quantile(hi);
+
+  // Diffuse particles emitted by the sample, scaled to all the fluid particles
+  auto emitted = [&](std::vector<std::array<double, 3>> const &s, long nfluid,
+                     double minta, double maxta, double minwc, double maxwc,
+                     double mink, double maxk) {
+    double n = 0;
+    for (auto &v : s)
+      n += std::floor(phi(v[2], mink, maxk) *
+                      (sp.KTA * phi(v[0], minta, maxta) + sp.KWC * phi(v[1], minwc, maxwc)) *
+                      sp.TIMESTEP);
+    return s.size() > 0 ? n * nfluid / s.size() : 0.;
+  };
+
+  double currentSum = 0, proposedSum = 0, currentMax = 0, proposedMax = 0;
+  long nsampled = 0, maxFluid = 0;
+  for (long s = 0; s < samples.size(); s++) {
+    double c = emitted(samples[s], fluidParticles[s], sp.MINTA, sp.MAXTA, sp.MINWC, sp.MAXWC, sp.MINK, sp.MAXK),
+           p = emitted(samples[s], fluidParticles[s], pMINTA, pMAXTA, pMINWC, pMAXWC, pMINK, pMAXK);
+    currentSum += c;
+    proposedSum += p;
+    currentMax = std::max(currentMax, c);
+    proposedMax = std::max(proposedMax, p);
+    nsampled += samples[s].size();
+    maxFluid = std::max(maxFluid, fluidParticles[s]);
+  }
+
+  // Spray and bubbles are only deleted when they leave the domain, so every emitted particle
+  // may be alive at the end of the run: the total is an upper bound of the diffuse particles.
+  double currentTotal = currentSum / samples.size() * nrun,
+         proposedTotal = proposedSum / samples.size() * nrun;
+
+  // Memory of the fluid particles with their fields and of the diffuse particles, which are
+  // copied when the deleted ones are removed
+  const double fluidBytes = sizeof(particle) + 4 * sizeof(double) + sizeof(std::array<double, 3>) +
+                            sizeof(int) + sizeof(long),
+               diffuseBytes = 2 * (2 * sizeof(std::array<double, 3>) + 2 * sizeof(int) + sizeof(double)),
+               MB = 1024. * 1024.;
+  double fluidMemory = (maxFluid * fluidBytes + maxBuckets * sizeof(std::vector<particle>)) / MB;
+
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::cout << std::endl
+            << "=== Threshold analysis: " << samples.size() << " of " << nrun << " steps, "
+            << nsampled << " fluid particles sampled, " << elapsed << " s" << std::endl
+            << std::endl
+            << "Percentiles of the non-zero values:" << std::endl
+            << "Trapped air: " << taStats.toString() << std::endl
+            << "Wave crests: " << crestStats.toString() << std::endl
+            << "Energy:      " << energyStats.toString() << std::endl
+            << std::endl
+            << "Proposed thresholds (percentiles " << sp.analyzeLowPercentile << " and "
+            << sp.analyzeHighPercentile << "):" << std::endl
+            << "MinTrappedAirThreshold = " << pMINTA << std::endl
+            << "MaxTrappedAirThreshold = " << pMAXTA << std::endl
+            << "MinWaveCrestsThreshold = " << pMINWC << std::endl
+            << "MaxWaveCrestsThreshold = " << pMAXWC << std::endl
+            << "MinKineticEnergyThreshold = " << pMINK << std::endl
+            << "MaxKineticEnergyThreshold = " << pMAXK << std::endl
+            << std::endl
+            << "Estimated diffuse particles    Current thresholds   Proposed thresholds" << std::endl
+            << std::fixed << std::setprecision(0)
+            << "  Emitted per step (mean)   " << std::setw(20) << currentSum / samples.size()
+            << std::setw(22) << proposedSum / samples.size() << std::endl
+            << "  Emitted per step (max)    " << std::setw(20) << currentMax
+            << std::setw(22) << proposedMax << std::endl
+            << "  Emitted in the run        " << std::setw(20) << currentTotal
+            << std::setw(22) << proposedTotal << std::endl
+            << "  Memory, upper bound (MB)  " << std::setw(20) << fluidMemory + currentTotal * diffuseBytes / MB
+            << std::setw(22) << fluidMemory + proposedTotal * diffuseBytes / MB << std::endl;
+  std::cout.unsetf(std::ios::fixed);
+  std::cout << std::setprecision(6);
+
+  prof.printSummary(std::cout);
+  return true;
 }
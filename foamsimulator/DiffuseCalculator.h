@@ -19,7 +19,18 @@
 
 #include <string>
 #include <array>
+#include <random>
+#include <vector>
+#include "Checkpoint.h"
+#include "CostScheduler.h"
+#include "FileWatcher.h"
+#include "FrameFarm.h"
+#include "Numa.h"
 #include "SimulationParams.h"
+#include "FluidData.h"
+#include "Profiler.h"
+#include "PerfCounters.h"
+#include "StreamStats.h"
 
 /**
    \brief This class provides the main functionality to compute the foam simulation.
@@ -39,12 +50,254 @@ class DiffuseCalculator {
   DiffuseCalculator(SimulationParams p);
 
   /**
-     Starts the simulation.
+     Starts the simulation. It ends at the last step, or at the first missing input file.
+     \return False if it failed: the checkpoint to resume from cannot be read, the memory limit
+     stopped it or an output file cannot be written.
    */
-  void runSimulation();
+  bool runSimulation();
+
+  /**
+     Analyzes the case instead of simulating it, to help choosing the thresholds.
+     Only some steps and a fraction of the fluid particles are processed. The trapped air,
+     wave crest and kinetic energy potentials of the sample are computed as in the simulation
+     and the thresholds are proposed from their percentiles. The number of diffuse particles
+     and the memory of the whole run are estimated with the current and the proposed thresholds.
+     \see SimulationParams
+     \return False if no step could be analyzed.
+   */
+  bool runAnalysis();
+
+  /**
+     Runs a worker of the frame farm: takes the steps that no other process has taken and
+     computes their stages 1 to 5, leaving the results in the farm directory for the simulation.
+     Several workers can run at the same time, in the same or in other nodes.
+     \see SimulationParams
+     \return False if FarmPath is not set or a result cannot be written.
+   */
+  bool runWorker();
+
+  /**
+     \return The timings and counters collected during the simulation.
+   */
+  Profiler const& getProfiler() const;
   
  private:
   SimulationParams sp;
+  Profiler prof;
+  PerfCounters hw;
+  CostScheduler sched;
+
+  /**
+     Fields of the fluid particles computed in the stages 1 to 3, indexed by particle id.
+   */
+  struct Potentials {
+    numa::vector<double> Ita,                     ///< Trapped air potential.
+      colorField,                                 ///< Smoothed color field.
+      waveCrest,                                  ///< Wave crest potential.
+      energy;                                     ///< Kinetic energy.
+    numa::vector<std::array<double,3>> gradient;  ///< Gradient of the color field.
+    StreamStats taStats,                          ///< Statistics of the trapped air potential.
+      crestStats,                                 ///< Statistics of the wave crest potential.
+      energyStats;                                ///< Statistics of the kinetic energy.
+  };
+
+  /**
+     Sets the schedule of the loops over the fluid buckets and pins the threads, as set in the
+     parameters. A static schedule keeps each bucket in the same thread in all the stages, so
+     that its particles and fields stay in the NUMA node where they were first touched.
+     With the balanced scheduler, the neighbour loops run cost-balanced chunks with work stealing.
+   */
+  void setupThreads();
+
+  /**
+     Arranges the fluid particles after loading them: sorts the cells along the Morton curve,
+     if it is enabled, and moves the particles of each cell to memory allocated by the thread
+     that computes it, in the order of the cells.
+     \param f Fluid particles.
+   */
+  void arrangeFluid(BucketContainer<particle> &f);
+
+  /**
+     Computes the trapped air potential, the kinetic energy, the color field, its gradient and the
+     wave crest potential of the fluid particles (stages 1 to 3), and their statistics.
+     A sample of the buckets can be given as a level for each bucket: 3 for the sampled buckets,
+     2 for their neighbours and 1 for the neighbours of those. The color field is computed for the
+     levels 1 to 3, the gradient for the levels 2 and 3, and the potentials only for the level 3.
+     \param f Fluid particles.
+     \param pot Computed fields.
+     \param level Level of each bucket, indexed by bucket number. Null computes all the particles.
+     \return Number of particle pairs evaluated.
+   */
+  long long computePotentials(BucketContainer<particle> &f, Potentials &pot,
+			      std::vector<char> const * level);
+
+  /**
+     Diffuse particles created in a time step (stages 6 and 7).
+   */
+  struct Emission {
+    std::vector<std::array<double,3>> posit,      ///< Positions.
+      vel;                                        ///< Velocities.
+    std::vector<int> ids,                         ///< Ids.
+      ttl;                                        ///< Lifetimes.
+    std::vector<double> density;                  ///< Number of fluid particles around them.
+    std::vector<long> histogram;                  ///< Number of fluid particles that emit 1, 2, ... or more diffuse particles.
+    long nspray = 0,                              ///< Number of new spray particles.
+      nfoam = 0,                                  ///< Number of new foam particles.
+      nbubbles = 0;                               ///< Number of new bubbles.
+  };
+
+  /**
+     Counters of the fluid stages of a time step.
+   */
+  struct FluidCounters {
+    long nfluid = 0;                              ///< Number of fluid particles.
+    long ncells = 0;                              ///< Number of cells of the domain.
+    long long fluidPairs = 0,                     ///< Fluid particle pairs evaluated in the stages 1 to 3.
+      diffusePairs = 0;                           ///< Diffuse-fluid particle pairs evaluated in the stages 7 and 8.
+    double fluidBytes = 0,                        ///< Memory of the fluid particles. The largest slab, if the domain is split.
+      temporaryBytes = 0;                         ///< Memory of the fluid fields. The largest slab, if the domain is split.
+  };
+
+  /**
+     Clamps the potentials (stage 4) and computes the number of diffuse particles generated by
+     each fluid particle (stage 5).
+     \param pot Potentials of the fluid particles.
+     \param ndiffuse Number of diffuse particles generated by each fluid particle.
+     \param first Id of the first fluid particle.
+     \param last Id after the last fluid particle.
+     \return Number of diffuse particles generated.
+   */
+  long countDiffuse(Potentials &pot, std::vector<int> &ndiffuse, long first, long last);
+
+  /**
+     Creates the diffuse particles around the fluid particles that generate them (stage 6).
+     The particles are numbered in the order of the ids of the fluid particles, and three random
+     numbers are taken for each of them in the same order.
+     \param f Fluid particles.
+     \param ndiffuse Number of diffuse particles generated by each fluid particle. It sets their
+     lifetime and the emission histogram.
+     \param kept Number of them that are created: ndiffuse, or less when the emission is capped.
+     \param firstId Id of the first new diffuse particle.
+     \param gen Random generator.
+     \param em Emission where the new particles are appended.
+   */
+  void emitDiffuse(BucketContainer<particle> &f, std::vector<int> const &ndiffuse,
+		   std::vector<int> const &kept, long firstId, std::mt19937 &gen, Emission &em);
+
+  /**
+     Computes the density of the new diffuse particles and classifies them (stage 7).
+     \param f Fluid particles.
+     \param em New diffuse particles.
+     \param index Indices of the particles to classify. Null classifies all of them.
+     \return Number of particle pairs evaluated.
+   */
+  long long classifyDiffuse(BucketContainer<particle> &f, Emission &em,
+			    std::vector<long> const * index);
+
+  /**
+     Updates the density, velocity and position of the existing diffuse particles (stage 8).
+     The particles are partitioned by the class of their new density: spray particles move
+     ballistically without looking at the fluid, while foam and bubbles follow the velocity
+     of the fluid around them. The time step is split into sp.substeps substeps, and the
+     velocity of the fluid at each one is interpolated linearly between this step and the
+     next one. The class of the particles does not change within the time step.
+     \param f Fluid particles.
+     \param state Diffuse particles.
+     \param index Indices of the particles to update. Null updates all of them.
+     \param next Fluid particles of the next step. If null, every substep takes the velocity of f.
+     \return Number of particle pairs evaluated.
+   */
+  long long updateDiffuse(BucketContainer<particle> &f, Checkpoint &state,
+			  std::vector<long> const * index,
+			  BucketContainer<particle> * next = nullptr);
+
+  /**
+     Runs the stages 1 to 8 of a time step splitting the domain into slabs of layers of cells
+     along the z axis, so that only the fluid particles of a slab and its halo are in memory.
+     The input file is split into a binary file per slab. The result is the same as processing
+     the whole domain at once.
+     \param fileName Fluid particle file.
+     \param state Diffuse particles, updated in stage 8.
+     \param pot Receives the statistics of the potentials.
+     \param em Receives the new diffuse particles.
+     \param counters Receives the counters of the step.
+     \return False if the fluid particles cannot be loaded.
+   */
+  bool runSlabs(std::string const& fileName, Checkpoint &state, Potentials &pot,
+		Emission &em, FluidCounters &counters);
+
+  /**
+     Runs the stages 1 to 8 of a time step splitting the domain among the MPI processes, each
+     one with a slab of layers of cells along the z axis. The first process splits the input
+     file into a binary file per process, each process reads its own file and receives the
+     halo layers from the processes that own them. The diffuse particles are sent to the process
+     that owns their position before the stages 7 and 8. The result is the same as processing
+     the whole domain in one process.
+     \param fileName Fluid particle file.
+     \param state Diffuse particles of this process, updated in stage 8.
+     \param pot Receives the statistics of the potentials of all the processes, in the first one.
+     \param em Receives the new diffuse particles of this process.
+     \param counters Receives the counters of this process.
+     \param nemitted Receives the number of new diffuse particles of all the processes.
+     \return False if the fluid particles cannot be loaded.
+   */
+  bool runRanks(std::string const& fileName, Checkpoint &state, Potentials &pot,
+		Emission &em, FluidCounters &counters, long &nemitted);
+
+  /**
+     \return Parameters of the stages 1 to 5, stored with the results of the frame farm.
+   */
+  std::vector<double> frameParams() const;
+
+  /**
+     Computes the stages 1 to 5 of a time step and keeps the result for the frame farm.
+     \param f Fluid particles.
+     \param nstep Time step.
+     \param fileName Input file of the step. Its size and modification time are kept with the result.
+     \param pot Computed fields.
+     \param ndiffuse Number of diffuse particles generated by each fluid particle.
+     \param res Receives the result.
+     \return Number of diffuse particles generated.
+   */
+  long computeFrame(BucketContainer<particle> &f, int nstep, std::string const& fileName,
+		    Potentials &pot, std::vector<int> &ndiffuse, FrameResult &res);
+
+  /**
+     Takes the result of the stages 1 to 5 of a time step from the frame farm. If no worker
+     has taken the step, or its result does not arrive in time, they are computed here.
+     \param farm Frame farm.
+     \param watcher Watcher of the farm directory.
+     \param f Fluid particles.
+     \param nstep Time step.
+     \param fileName Input file of the step. A result computed from another version of it is not used.
+     \param pot Receives the statistics of the potentials, and the fields if they are computed here.
+     \param ndiffuse Number of diffuse particles generated by each fluid particle.
+     \param counters Receives the fluid pairs evaluated.
+     \return Number of diffuse particles generated.
+   */
+  long farmFrame(FrameFarm &farm, FileWatcher &watcher, BucketContainer<particle> &f,
+		 int nstep, std::string const& fileName, Potentials &pot,
+		 std::vector<int> &ndiffuse, FluidCounters &counters);
+
+  /**
+     Estimates the memory used by the enabled vtk writers.
+     \param ndiffuse Number of diffuse particles written.
+     \param nfluid Number of fluid particles.
+     \param ncells Number of cells of the fluid grid.
+     \return Bytes.
+   */
+  double writersBytes(long ndiffuse, long nfluid, long ncells) const;
+
+  /**
+     Computes the maximum number of diffuse particles that can be created in a step without
+     exceeding the memory limit.
+     \param stepBytes Memory of the fluid particles and the temporary fields of the step.
+     \param npool Number of diffuse particles before the step.
+     \param nfluid Number of fluid particles.
+     \param ncells Number of cells of the fluid grid.
+     \return Maximum number of new diffuse particles. It is negative if the limit is exceeded even without new particles.
+   */
+  long emissionLimit(double stepBytes, long npool, long nfluid, long ncells) const;
 
   /**
      Maps a value I between zero and one according to a max and min thresolds.
@@ -0,0 +1,126 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "FileWatcher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <experimental/filesystem>
+#include <iostream>
+#include <thread>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::experimental::filesystem;
+
+typedef std::chrono::steady_clock clk;
+
+FileWatcher::FileWatcher(std::string const &dir, double pollInterval)
+    : poll(pollInterval), fd(-1), wd(-1) {
+#ifdef __linux__
+  fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd >= 0) {
+    wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MODIFY);
+    if (wd < 0) { // Polling fallback
+      close(fd);
+      fd = -1;
+    }
+  }
+#endif
+}
+
+FileWatcher::~FileWatcher() {
+#ifdef __linux__
+  if (fd >= 0)
+    close(fd);
+#endif
+}
+
+void FileWatcher::wait(double seconds) {
+#ifdef __linux__
+  if (fd >= 0) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (::poll(&pfd, 1, (int)(seconds * 1000)) > 0) {
+      alignas(struct inotify_event) char buffer[4096];
+      ssize_t n;
+      while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+        for (char *p = buffer; p < buffer + n;) {
+          struct inotify_event *ev = (struct inotify_event *)p;
+          if (ev->len > 0 && (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)))
+            closed.insert(ev->name);
+          p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    return;
+  }
+#endif
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+}
+
+bool FileWatcher::waitFor(std::string const &fileName, std::string const &nextFileName,
+                          std::string const &sentinel, double timeout) {
+  std::string name = fs::path(fileName).filename().string();
+  auto deadline = clk::now() + std::chrono::duration_cast<clk::duration>(
+                                   std::chrono::duration<double>(timeout));
+  std::uintmax_t lastSize = -1;
+  fs::file_time_type lastTime;
+  clk::time_point changed = clk::now();
+  bool waited = false;
+
+  while (true) {
+    std::error_code ec;
+    bool exists = fs::exists(fileName, ec);
+
+    if (exists) {
+      if (fs::exists(nextFileName, ec) || closed.count(name) > 0 ||
+          (sentinel != "" && fs::exists(sentinel, ec)))
+        break;
+
+      // Unchanged for a whole poll interval
+      std::uintmax_t size = fs::file_size(fileName, ec);
+      fs::file_time_type time = fs::last_write_time(fileName, ec);
+      if (size != lastSize || time != lastTime) {
+        if (size != lastSize) // Still growing, so the writer is alive
+          deadline = clk::now() + std::chrono::duration_cast<clk::duration>(
+                                      std::chrono::duration<double>(timeout));
+        lastSize = size;
+        lastTime = time;
+        changed = clk::now();
+      } else if (std::chrono::duration<double>(clk::now() - changed).count() >= poll)
+        break;
+    } else if (sentinel != "" && fs::exists(sentinel, ec)) {
+      std::cout << "Sentinel file found: " << sentinel << std::endl;
+      return false;
+    }
+
+    if (clk::now() >= deadline) {
+      std::cout << "No new data after " << timeout << " s waiting for " << fileName << std::endl;
+      return false;
+    }
+
+    if (!waited)
+      std::cout << "Waiting for " << fileName << "..." << std::endl;
+    waited = true;
+    wait(std::max(0., std::min(poll, std::chrono::duration<double>(deadline - clk::now()).count())));
+  }
+
+  closed.erase(name);
+  return true;
+}
@@ -0,0 +1,64 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef FILEWATCHER_H
+#define FILEWATCHER_H
+
+#include <set>
+#include <string>
+
+/**
+   \brief Waits for the files of a directory while another program writes them.
+   On Linux it sleeps on inotify events of the directory, otherwise it polls. A file is
+   considered completely written when the writer closes it, when the file of the next step
+   appears, or when its size and modification time do not change for a poll interval.
+ */
+class FileWatcher {
+
+ public:
+  /**
+     Class constructor.
+     \param dir Watched directory.
+     \param pollInterval Maximum time between two checks, in seconds.
+   */
+  FileWatcher(std::string const& dir, double pollInterval);
+
+  ~FileWatcher();
+
+  FileWatcher(FileWatcher const&) = delete;
+  FileWatcher& operator=(FileWatcher const&) = delete;
+
+  /**
+     Waits until a file is completely written.
+     \param fileName File.
+     \param nextFileName File written after it. When it exists, fileName is complete.
+     \param sentinel File that marks the end of the writer. Ignored if empty.
+     \param timeout Maximum waiting time without any change of the file, in seconds.
+     \return True if the file is ready. False if the sentinel appeared or the timeout expired
+     before the file.
+   */
+  bool waitFor(std::string const& fileName, std::string const& nextFileName,
+	       std::string const& sentinel, double timeout);
+
+ private:
+  double poll;
+  int fd, wd;                   // inotify descriptors, -1 if not available
+  std::set<std::string> closed; // Files closed after writing since the last wait
+
+  void wait(double seconds);
+};
+
+#endif
@@ -15,6 +15,8 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "FluidData.h"
+#include "BinaryFile.h"
+#include "LegacyVtkReader.h"
 
 #include <vtkDataArray.h>
 #include <vtkPointData.h>
@@ -22,7 +24,40 @@
 #include <vtkCommand.h>
 //#include <vtkSelectEnclosedPoints.h>
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define _SILENCE_EXPERIMENTAL_FILESYSTEM_DEPRECATION_WARNING
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+
+#define CACHE_MAGIC "VSPHFC02"
+#define SPLIT_CHUNK 65536L // Particles read at once when a file is split into slabs
+
+// Header of the fluid cache files. It is followed by the offset of the first particle of each
+// cell (one more than cells, as int64_t), the positions, the velocities and the densities, as
+// floats. Fixed-size integers, so that the files are the same where long is 32-bit
+struct CacheHeader {
+  char magic[8];
+  double limits[7];   // Domain limits and cell size
+  int64_t dims[3];    // Number of cells on each dimension
+  int64_t nparticles;
+  int64_t sourceSize; // Size and modification time of the vtk file it was written from
+  int64_t sourceTime;
+};
 
 // ErrorObserver class copied from: https://vtk.org/Wiki/VTK/Examples/Cxx/Utilities/ObserveError
 class ErrorObserver : public vtkCommand
@@ -93,11 +128,18 @@ private:
 
 FluidData::FluidData(double xmin, double xmax, double ymin, double ymax,
                      double zmin, double zmax, double h)
-    : bc(xmin, xmax, ymin, ymax, zmin, zmax, h), exclude(false) {
+    : exclude(false), bc(xmin, xmax, ymin, ymax, zmin, zmax, h),
+      limits{{xmin, xmax, ymin, ymax, zmin, zmax, h}}, rebinned(0) {
 
   std::cout << "Number of buckets: " << bc.getBuckets().size() << std::endl;
 }
 
+FluidData::FluidData(double xmin, double xmax, double ymin, double ymax,
+                     double zmin, double zmax, double h, long firstLayer,
+                     long lastLayer)
+    : exclude(false), bc(xmin, xmax, ymin, ymax, zmin, zmax, h, firstLayer, lastLayer),
+      limits{{xmin, xmax, ymin, ymax, zmin, zmax, h}}, rebinned(0) {}
+
 BucketContainer<particle> *FluidData::getBucketContainer() { return &bc; }
 
 void FluidData::setExclusionZone(std::string const &fileName) {
@@ -105,7 +147,8 @@ void FluidData::setExclusionZone(std::string const &fileName) {
   exFile = fileName;
 }
 
-bool FluidData::loadFile(std::string const &fileName) {
+// Reads a vtk file. Returns a null pointer if it cannot be read.
+static vtkSmartPointer<vtkPolyDataReader> readFile(std::string const &fileName) {
   vtkSmartPointer<ErrorObserver> errorObserver =
       vtkSmartPointer<ErrorObserver>::New();
   vtkSmartPointer<vtkPolyDataReader> reader =
@@ -117,9 +160,16 @@ bool FluidData::loadFile(std::string const &fileName) {
   
   if (errorObserver->GetError()){
     std::cerr << "ERROR: the file cannot be loaded." << std::endl;
-    return false;
+    return nullptr;
   }
-  
+  return reader;
+}
+
+bool FluidData::loadFile(std::string const &fileName) {
+  vtkSmartPointer<vtkPolyDataReader> reader = readFile(fileName);
+  if (reader == nullptr)
+    return false;
+
   vtkPolyData *output = reader->GetOutput();
 
   vtkDataArray *points = output->GetPoints()->GetData();
@@ -158,23 +208,497 @@ bool FluidData::loadFile(std::string const &fileName) {
     bc.addElement(pi, p[0], p[1], p[2]);
   }
 
-  // Remove doubles
-  for (auto &bucket : bc.getBuckets()) {
-    for (long i = 0; i < bucket.size(); i++) {
-      for (long j = 0; j < bucket.size(); j++) {
-        if (j != i) {
-          if (bucket[i].pos[0] == bucket[j].pos[0] &&
-              bucket[i].pos[1] == bucket[j].pos[1] &&
-              bucket[i].pos[2] == bucket[j].pos[2]) {
-            bucket.erase(bucket.begin() + i);
-            i--;
-            break;
-          }
-        }
+  finishLoad();
+  return true;
+}
+
+bool FluidData::updateFile(std::string const &fileName) {
+  vtkSmartPointer<vtkPolyDataReader> reader = readFile(fileName);
+  if (reader == nullptr)
+    return false;
+
+  vtkPolyData *output = reader->GetOutput();
+  vtkDataArray *points = output->GetPoints()->GetData();
+  vtkDataArray *pvel = output->GetPointData()->GetArray("Vel");
+  vtkDataArray *rhop = output->GetPointData()->GetArray("Rhop");
+  vtkDataArray *pidp = output->GetPointData()->GetArray("Idp");
+  long npoints = output->GetPoints()->GetNumberOfPoints();
+
+  auto &buckets = bc.getBuckets();
+  if (pidp == nullptr)
+    where.clear();
+  inPlace.resize(buckets.size(), 0);
+
+  // While updating, the id of each loaded particle is -1 - its position in the file, so the
+  // particles of the previous step that are not overwritten keep a positive id
+  std::vector<long> idps(npoints, -1);
+  std::vector<std::pair<long, particle>> moved;
+  for (long i = 0; i < npoints; i++) {
+    double *p = points->GetTuple(i);
+    long nbucket = bc.findBucket(p[0], p[1], p[2]);
+    if (nbucket < 0)
+      continue;
+
+    particle pi;
+    pi.id = -1 - i;
+    pi.pos = {p[0], p[1], p[2]};
+    double *v = pvel->GetTuple(i);
+    pi.vel = {v[0], v[1], v[2]};
+    pi.rhop = rhop->GetTuple(i)[0];
+
+    // Entries of the particles that are gone are not cleared: a particle that takes a slot that
+    // is not its own only sends the owner to the moved ones
+    long idp = pidp != nullptr ? (long)pidp->GetTuple(i)[0] : -1;
+    idps[i] = idp;
+    if (idp >= 0 && idp < where.size() && where[idp].first == nbucket &&
+        where[idp].second < buckets[nbucket].size() &&
+        buckets[nbucket][where[idp].second].id >= 0) {
+      buckets[nbucket][where[idp].second] = pi; // Same cell: overwritten in place
+      inPlace[nbucket]++;
+    } else {
+      moved.push_back(std::make_pair(nbucket, pi));
+    }
+  }
+  rebinned = moved.size();
+
+  // Buckets that change: those of the previous step and those that receive particles
+  std::vector<long> targets;
+  for (auto &m : moved) {
+    buckets[m.first].push_back(m.second);
+    targets.push_back(m.first);
+  }
+  std::sort(targets.begin(), targets.end());
+  targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+  std::vector<long> changed;
+  std::set_union(occupied.begin(), occupied.end(), targets.begin(), targets.end(),
+                 std::back_inserter(changed));
+
+  // A bucket whose particles were all overwritten in place, and which received no other, keeps
+  // its particles in their slots. If they are still in the order of the file and have no doubles
+  // it is what loadFile() builds, and the positions of its Idps do not change
+  std::vector<char> dirty(changed.size());
+#pragma omp parallel
+  {
+    std::vector<std::array<double, 3>> positions;
+#pragma omp for schedule(runtime)
+    for (long c = 0; c < changed.size(); c++) {
+      long nbucket = changed[c];
+      auto const &bucket = buckets[nbucket];
+      bool same = inPlace[nbucket] == bucket.size();
+      inPlace[nbucket] = 0;
+      for (long j = 1; same && j < bucket.size(); j++)
+        same = bucket[j - 1].id > bucket[j].id;
+      if (same) {
+        positions.clear();
+        for (auto const &pi : bucket)
+          positions.push_back({pi.pos[0], pi.pos[1], pi.pos[2]});
+        std::sort(positions.begin(), positions.end());
+        same = std::adjacent_find(positions.begin(), positions.end()) == positions.end();
+      }
+      dirty[c] = !same;
+    }
+  }
+
+  for (long c = 0; c < changed.size(); c++) {
+    if (!dirty[c])
+      continue;
+    long nbucket = changed[c];
+    auto &bucket = buckets[nbucket];
+    bucket.erase(std::remove_if(bucket.begin(), bucket.end(),
+                                [](particle const &pi) { return pi.id >= 0; }),
+                 bucket.end());
+
+    // Restore the order of the file, as loadFile() does. Insertion sort, since the buckets
+    // are almost sorted when the order of the file does not change much
+    for (long j = 1; j < bucket.size(); j++) {
+      particle pi = bucket[j];
+      long k = j;
+      for (; k > 0 && bucket[k - 1].id < pi.id; k--)
+        bucket[k] = bucket[k - 1];
+      bucket[k] = pi;
+    }
+    removeDoubles(bucket);
+
+    // Position of each Idp for the next step
+    for (long j = 0; j < bucket.size(); j++) {
+      long idp = idps[-1 - bucket[j].id];
+      if (idp >= 0) {
+        if (idp >= where.size())
+          where.resize(idp + 1, std::make_pair(-1L, -1L));
+        where[idp] = std::make_pair(nbucket, j);
+      }
+    }
+  }
+
+  // Ids in the order of the buckets, from the first id of each one
+  occupied.clear();
+  for (long nbucket : changed)
+    if (buckets[nbucket].size() > 0)
+      occupied.push_back(nbucket);
+  std::vector<long> first(occupied.size() + 1, 0);
+  for (long i = 0; i < occupied.size(); i++)
+    first[i + 1] = first[i] + buckets[occupied[i]].size();
+#pragma omp parallel for schedule(runtime)
+  for (long i = 0; i < occupied.size(); i++) {
+    auto &bucket = buckets[occupied[i]];
+    for (long j = 0; j < bucket.size(); j++)
+      bucket[j].id = first[i] + j;
+  }
+  bc.setNoEmptyBuckets(occupied);
+  return true;
+}
+
+long FluidData::getRebinned() const { return rebinned; }
+
+// Read-only memory map of a whole file. Without mmap, the file is read into a buffer.
+class MappedFile {
+ public:
+  MappedFile(std::string const &fileName) : data(nullptr), size(0) {
+#ifdef _WIN32
+    std::ifstream in(fileName, std::ios::binary | std::ios::ate);
+    if (!in)
+      return;
+    buffer.resize(in.tellg());
+    in.seekg(0);
+    if (in.read(buffer.data(), buffer.size())) {
+      data = buffer.data();
+      size = buffer.size();
+    }
+#else
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+      return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        data = (const char *)p;
+        size = st.st_size;
+      }
+    }
+    close(fd);
+#endif
+  }
+
+  ~MappedFile() {
+#ifndef _WIN32
+    if (data)
+      munmap((void *)data, size);
+#endif
+  }
+
+  const char *data;
+  size_t size;
+
+ private:
+#ifdef _WIN32
+  std::vector<char> buffer;
+#endif
+};
+
+long FluidData::writeCache(std::string const &fileName, std::string const &sourceName) {
+  auto dims = bc.getDimensions();
+  if (bc.getFirstLayer() != 0 || bc.getLastLayer() != dims[2]) {
+    std::cerr << "ERROR: only the whole domain can be written to a cache file." << std::endl;
+    return -1;
+  }
+
+  auto &buckets = bc.getBuckets();
+  CacheHeader header;
+  std::memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  std::copy(limits.begin(), limits.end(), header.limits);
+  std::copy(dims.begin(), dims.end(), header.dims);
+  if (!binary::fileStamp(sourceName, header.sourceSize, header.sourceTime)) {
+    std::cerr << "ERROR: the vtk file of the cache file cannot be found: " << sourceName << std::endl;
+    return -1;
+  }
+
+  std::vector<int64_t> offsets(1, 0);
+  for (auto &bucket : buckets)
+    offsets.push_back(offsets.back() + bucket.size());
+  header.nparticles = offsets.back();
+
+  long rounded = 0;
+  auto toFloat = [&rounded](double v) {
+    float f = v;
+    rounded += (double)f != v;
+    return f;
+  };
+
+  std::vector<float> pos, vel, rhop;
+  pos.reserve(3 * header.nparticles);
+  vel.reserve(3 * header.nparticles);
+  rhop.reserve(header.nparticles);
+  for (auto &bucket : buckets) {
+    for (auto &pi : bucket) {
+      for (int c = 0; c < 3; c++) {
+        pos.push_back(toFloat(pi.pos[c]));
+        vel.push_back(toFloat(pi.vel[c]));
+      }
+      rhop.push_back(toFloat(pi.rhop));
+    }
+  }
+
+  // Written to a temporary file first, so that a simulation never finds a partial file
+  std::string tmpName = fileName + ".tmp";
+  {
+    std::ofstream out(tmpName, std::ios::binary | std::ios::trunc);
+    out.write((const char *)&header, sizeof(header));
+    out.write((const char *)offsets.data(), offsets.size() * sizeof(int64_t));
+    out.write((const char *)pos.data(), pos.size() * sizeof(float));
+    out.write((const char *)vel.data(), vel.size() * sizeof(float));
+    out.write((const char *)rhop.data(), rhop.size() * sizeof(float));
+    if (!out.good()) {
+      std::cerr << "ERROR: the cache file cannot be written: " << fileName << std::endl;
+      return -1;
+    }
+  }
+  std::error_code ec;
+  fs::rename(tmpName, fileName, ec);
+  if (ec) {
+    std::cerr << "ERROR: the cache file cannot be written: " << fileName << std::endl;
+    return -1;
+  }
+  return rounded;
+}
+
+bool FluidData::loadCache(std::string const &fileName, std::string const &sourceName) {
+  MappedFile file(fileName);
+  if (file.data == nullptr || file.size < sizeof(CacheHeader)) {
+    std::cerr << "ERROR: the cache file cannot be read: " << fileName << std::endl;
+    return false;
+  }
+
+  CacheHeader header;
+  std::memcpy(&header, file.data, sizeof(header));
+  auto dims = bc.getDimensions();
+  long ncells = dims[0] * dims[1] * dims[2];
+  if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+      !std::equal(limits.begin(), limits.end(), header.limits) ||
+      !std::equal(dims.begin(), dims.end(), header.dims) || header.nparticles < 0 ||
+      file.size != sizeof(header) + (ncells + 1) * sizeof(int64_t) +
+                       7 * header.nparticles * sizeof(float)) {
+    std::cerr << "ERROR: the cache file does not match the domain: " << fileName << std::endl;
+    return false;
+  }
+
+  // Without the vtk file there is nothing else to read, so the cache file is used as it is
+  int64_t sourceSize, sourceTime;
+  if (binary::fileStamp(sourceName, sourceSize, sourceTime) &&
+      (sourceSize != header.sourceSize || sourceTime != header.sourceTime)) {
+    std::cerr << "ERROR: the cache file is older than its vtk file: " << fileName << std::endl;
+    return false;
+  }
+
+  const int64_t *offsets = (const int64_t *)(file.data + sizeof(header));
+  const float *pos = (const float *)(offsets + ncells + 1), *vel = pos + 3 * header.nparticles,
+              *rhop = vel + 3 * header.nparticles;
+
+  // Cells of the stored layers, and the first particle of them
+  auto &buckets = bc.getBuckets();
+  long first = bc.getFirstLayer() * dims[0] * dims[1], firstParticle = offsets[first];
+
+  for (long nbucket : occupied)
+    buckets[nbucket].clear();
+  occupied.clear();
+  for (long nbucket = 0; nbucket < buckets.size(); nbucket++)
+    if (offsets[first + nbucket + 1] > offsets[first + nbucket])
+      occupied.push_back(nbucket);
+  where.clear();
+  rebinned = offsets[first + buckets.size()] - firstParticle;
+
+  // Each bucket is allocated by the thread that processes it in the loops with schedule(runtime)
+#pragma omp parallel for schedule(runtime)
+  for (long i = 0; i < occupied.size(); i++) {
+    long nbucket = occupied[i];
+    auto &bucket = buckets[nbucket];
+    long begin = offsets[first + nbucket], end = offsets[first + nbucket + 1];
+    bucket.resize(end - begin);
+    for (long j = begin; j < end; j++) {
+      particle &pi = bucket[j - begin];
+      pi.id = j - firstParticle;
+      pi.pos = {pos[3 * j], pos[3 * j + 1], pos[3 * j + 2]};
+      pi.vel = {vel[3 * j], vel[3 * j + 1], vel[3 * j + 2]};
+      pi.rhop = rhop[j];
+    }
+  }
+  bc.setNoEmptyBuckets(occupied);
+  return true;
+}
+
+std::string FluidData::cacheFileName(std::string const &cachePath, std::string const &fileName) {
+  return (fs::path(cachePath) / fs::path(fileName).filename().replace_extension(".fcache"))
+      .generic_string();
+}
+
+bool FluidData::splitFile(std::string const &fileName, std::string const &prefix,
+                          int nslabs, std::vector<long> &layers) {
+  long nlayers = bc.getDimensions()[2];
+  auto layerAt = [&](double const *p) {
+    long l = bc.getBucketCoords(p[0], p[1], p[2])[2];
+    return std::min(std::max(l, 0L), nlayers - 1);
+  };
+
+  // Legacy vtk files are read in chunks, side by side in each array. Other files are loaded at once
+  LegacyVtkReader vtk(fileName);
+  LegacyVtkReader::Stream posStream, velStream, rhopStream;
+  vtkSmartPointer<vtkPolyDataReader> reader;
+  vtkDataArray *points = nullptr, *pvel = nullptr, *rhop = nullptr;
+  long npoints;
+  bool streamed = vtk.open();
+  if (streamed) {
+    npoints = vtk.getNumberOfPoints();
+  } else {
+    std::cerr << "WARNING: " << fileName << " cannot be read in chunks, the whole step is loaded."
+              << std::endl;
+    reader = readFile(fileName);
+    if (reader == nullptr)
+      return false;
+    vtkPolyData *output = reader->GetOutput();
+    points = output->GetPoints()->GetData();
+    pvel = output->GetPointData()->GetArray("Vel");
+    rhop = output->GetPointData()->GetArray("Rhop");
+    npoints = output->GetPoints()->GetNumberOfPoints();
+  }
+
+  // Starts reading the positions, and the velocities and densities if all is set
+  auto start = [&](bool all) {
+    if (streamed && !(vtk.stream("POINTS", posStream) &&
+                      (!all || (vtk.stream("Vel", velStream) && velStream.getComponents() == 3 &&
+                                vtk.stream("Rhop", rhopStream))))) {
+      std::cerr << "ERROR: the file cannot be loaded." << std::endl;
+      return false;
+    }
+    return true;
+  };
+
+  // Reads a chunk of particles: their positions, and their velocities and densities if all is set
+  std::vector<double> pos, vel, rho;
+  auto read = [&](long first, long n, bool all) {
+    if (streamed) {
+      bool ok = posStream.read(n, pos) &&
+                (!all || (velStream.read(n, vel) && rhopStream.read(n, rho)));
+      if (!ok)
+        std::cerr << "ERROR: the file cannot be loaded." << std::endl;
+      return ok;
+    }
+    pos.resize(3 * n);
+    vel.resize(3 * n);
+    rho.resize(n);
+    for (long i = 0; i < n; i++) {
+      std::copy_n(points->GetTuple(first + i), 3, &pos[3 * i]);
+      if (all) {
+        std::copy_n(pvel->GetTuple(first + i), 3, &vel[3 * i]);
+        rho[i] = rhop->GetTuple(first + i)[0];
       }
     }
+    return true;
+  };
+
+  // Slabs of consecutive layers with about the same number of particles
+  std::vector<long> perLayer(nlayers, 0);
+  if (!start(false))
+    return false;
+  for (long first = 0; first < npoints; first += SPLIT_CHUNK) {
+    long n = std::min(SPLIT_CHUNK, npoints - first);
+    if (!read(first, n, false))
+      return false;
+    for (long i = 0; i < n; i++)
+      perLayer[layerAt(&pos[3 * i])]++;
+  }
+
+  layers.assign(1, 0);
+  for (long l = 0, n = 0; l < nlayers && (int)layers.size() < nslabs; l++) {
+    n += perLayer[l];
+    if (n * nslabs >= npoints * (long)layers.size())
+      layers.push_back(l + 1);
+  }
+  if (layers.back() != nlayers)
+    layers.push_back(nlayers);
+  nslabs = layers.size() - 1;
+
+  std::vector<long> slabOf(nlayers);
+  for (int s = 0; s < nslabs; s++)
+    for (long l = layers[s]; l < layers[s + 1]; l++)
+      slabOf[l] = s;
+
+  std::vector<std::ofstream> files(nslabs);
+  for (int s = 0; s < nslabs; s++) {
+    files[s].open(prefix + std::to_string(s) + ".bin", std::ios::binary | std::ios::trunc);
+    if (!files[s]) {
+      std::cerr << "ERROR: the slab file cannot be written: " << prefix << s << ".bin" << std::endl;
+      return false;
+    }
   }
 
+  if (!start(true))
+    return false;
+  int rstride = streamed ? rhopStream.getComponents() : 1;
+  for (long first = 0; first < npoints; first += SPLIT_CHUNK) {
+    long n = std::min(SPLIT_CHUNK, npoints - first);
+    if (!read(first, n, true))
+      return false;
+    for (long i = 0; i < n; i++) {
+      double record[SLAB_RECORD];
+      std::copy_n(&pos[3 * i], 3, record);
+      std::copy_n(&vel[3 * i], 3, record + 3);
+      record[6] = rho[i * rstride];
+      files[slabOf[layerAt(record)]].write((const char *)record, sizeof(record));
+    }
+  }
+
+  for (auto &f : files)
+    if (!f.good()) {
+      std::cerr << "ERROR: the slab files cannot be written: " << prefix << std::endl;
+      return false;
+    }
+  return true;
+}
+
+bool FluidData::loadSlabFiles(std::string const &prefix, int first, int last) {
+  std::vector<double> records;
+  for (int s = first; s < last; s++) {
+    if (!readSlabFile(prefix + std::to_string(s) + ".bin", records))
+      return false;
+    addRecords(records);
+  }
+
+  finishLoad();
+  return true;
+}
+
+bool FluidData::readSlabFile(std::string const &fileName, std::vector<double> &records) {
+  std::ifstream in(fileName, std::ios::binary | std::ios::ate);
+  if (!in) {
+    std::cerr << "ERROR: the slab file cannot be read: " << fileName << std::endl;
+    return false;
+  }
+  records.resize(in.tellg() / (SLAB_RECORD * sizeof(double)) * SLAB_RECORD);
+  in.seekg(0);
+  in.read((char *)records.data(), records.size() * sizeof(double));
+  return true;
+}
+
+void FluidData::loadRecords(std::vector<double> const &records) {
+  addRecords(records);
+  finishLoad();
+}
+
+void FluidData::addRecords(std::vector<double> const &records) {
+  for (long i = 0; i + SLAB_RECORD <= records.size(); i += SLAB_RECORD) {
+    const double *record = &records[i];
+    particle pi;
+    pi.pos = {record[0], record[1], record[2]};
+    pi.vel = {record[3], record[4], record[5]};
+    pi.rhop = record[6];
+    bc.addElement(pi, record[0], record[1], record[2]);
+  }
+}
+
+void FluidData::finishLoad() {
+  for (auto &bucket : bc.getBuckets())
+    removeDoubles(bucket);
+
   // Assign ids
   long idp = 0;
   for (auto &bucket : bc.getBuckets()) { // Iterate over all buckets
@@ -183,6 +707,20 @@ bool FluidData::loadFile(std::string const &fileName) {
       idp++;
     }
   }
+}
 
-  return true;
+void FluidData::removeDoubles(std::vector<particle> &bucket) {
+  for (long i = 0; i < bucket.size(); i++) {
+    for (long j = 0; j < bucket.size(); j++) {
+      if (j != i) {
+        if (bucket[i].pos[0] == bucket[j].pos[0] &&
+            bucket[i].pos[1] == bucket[j].pos[1] &&
+            bucket[i].pos[2] == bucket[j].pos[2]) {
+          bucket.erase(bucket.begin() + i);
+          i--;
+          break;
+        }
+      }
+    }
+  }
 }
@@ -27,6 +27,9 @@
 
 #include "BucketContainer.h"
 
+// Doubles of a particle record in the slab files: position, velocity and density
+#define SLAB_RECORD 7
+
 /**
    This structure stores all the data of a fluid particle.
  */
@@ -49,6 +52,21 @@ class FluidData{
   std::string exFile;
 
   BucketContainer<particle> bc;
+  std::array<double, 7> limits; // Domain limits and cell size
+
+  std::vector<std::pair<long, long>> where; // Bucket and position in it of each Idp in the last update
+  std::vector<long> occupied;                // Non-empty buckets after the last update, in order
+  std::vector<long> inPlace;                 // Particles overwritten in place in each bucket, while updating
+  long rebinned;
+
+  // Adds the particles of some slab file records
+  void addRecords(std::vector<double> const& records);
+
+  // Removes the duplicated particles and assigns the ids
+  void finishLoad();
+
+  // Removes the particles with the same position as a later one of the bucket
+  static void removeDoubles(std::vector<particle> &bucket);
 
  public:
     /**
@@ -65,6 +83,24 @@ class FluidData{
 	    double ymin, double ymax,
 	    double zmin, double zmax, double h);
 
+  /**
+     Class constructor. Creates an empty data structure that only stores some layers of the domain.
+     \param xmin Domain limits: min x value.
+     \param xmax Domain limits: max x value.
+     \param ymin Domain limits: min y value.
+     \param ymax Domain limits: max y value.
+     \param zmin Domain limits: min z value.
+     \param zmax Domain limits: max z value.
+     \param h Cell size.
+     \param firstLayer First stored layer of cells.
+     \param lastLayer Layer after the last stored one.
+     \see BucketContainer
+   */
+  FluidData(double xmin, double xmax,
+	    double ymin, double ymax,
+	    double zmin, double zmax, double h,
+	    long firstLayer, long lastLayer);
+
   /**
      Load a vtk file with data of fluid particles.
      \param fileName File name.
@@ -72,6 +108,96 @@ class FluidData{
    */
   bool loadFile(std::string const& fileName);
 
+  /**
+     Loads the next time step of the fluid particles, updating the particles loaded by the
+     previous call instead of building the grid again. Particles are matched by their DualSPHysics
+     index (Idp): those that stay in the same cell are overwritten in place, and only those that
+     changed cells are moved. The result, ids included, is the same as loadFile() in a new object.
+     If the file has no Idp array, the grid is built from scratch.
+     \param fileName File name.
+     \return True if the file was correctly loaded.
+   */
+  bool updateFile(std::string const& fileName);
+
+  /**
+     \return Number of particles that were added or changed cells in the last updateFile(), or
+     loaded by the last loadCache().
+   */
+  long getRebinned() const;
+
+  /**
+     Writes the loaded particles to a fluid cache file: a header with the domain limits and the
+     cell size, the offset of the first particle of each cell and the positions, velocities and
+     densities of the particles sorted by cell, in single precision. Only a container of the
+     whole domain can be written. The size and modification time of the vtk file are stored too,
+     so that a cache file older than its vtk file is not loaded.
+     \param fileName File name.
+     \param sourceName Vtk file the particles were loaded from.
+     \return Number of values that were rounded to single precision. -1 if the file cannot be written.
+   */
+  long writeCache(std::string const& fileName, std::string const& sourceName);
+
+  /**
+     Loads a fluid cache file written by writeCache(), mapping it to memory. The particles are
+     already sorted by cell, so they are copied to their buckets without parsing or sorting.
+     Only the stored layers are loaded. Ids are assigned in the same order as loadFile() does.
+     The container must be empty, or loaded by loadCache() or updateFile().
+     \param fileName File name.
+     \param sourceName Vtk file of the step. If it exists, its size and modification time must be
+     those stored in the cache file.
+     \return True if the file was correctly loaded. False if it cannot be read, its domain
+     or cell size are not those of this container or the vtk file changed after writing it.
+   */
+  bool loadCache(std::string const& fileName, std::string const& sourceName);
+
+  /**
+     Name of the fluid cache file of a vtk file: the same name with extension .fcache.
+     \param cachePath Directory of the cache files.
+     \param fileName Vtk file name.
+     \return Cache file name.
+   */
+  static std::string cacheFileName(std::string const& cachePath, std::string const& fileName);
+
+  /**
+     Splits a vtk file with data of fluid particles into binary files with the particles of
+     slabs of consecutive layers of cells, so that each slab can be loaded separately. The
+     slabs have about the same number of particles. Legacy vtk files are read in chunks of
+     particles, in two passes: the positions to count the particles of each layer, and then
+     the records of the slabs. Other files are loaded at once.
+     \param fileName File name.
+     \param prefix Prefix of the slab files. Slab s is written to prefix + s + ".bin".
+     \param nslabs Number of slabs. There can be less slabs if there are less layers.
+     \param layers Returns the first layer of each slab, followed by the number of layers.
+     \return True if the file was correctly split.
+   */
+  bool splitFile(std::string const& fileName, std::string const& prefix,
+		 int nslabs, std::vector<long> &layers);
+
+  /**
+     Loads the particles of some slab files written by splitFile(). Only those in the stored
+     layers are kept. Ids are assigned in the same order as loadFile() does.
+     \param prefix Prefix of the slab files.
+     \param first First slab.
+     \param last Slab after the last one.
+     \return True if the files were correctly loaded.
+   */
+  bool loadSlabFiles(std::string const& prefix, int first, int last);
+
+  /**
+     Reads the particle records of a slab file written by splitFile().
+     \param fileName File name.
+     \param records Receives the records, SLAB_RECORD doubles per particle.
+     \return True if the file was correctly read.
+   */
+  static bool readSlabFile(std::string const& fileName, std::vector<double> &records);
+
+  /**
+     Loads the particles of some records in the slab file format. Only those in the stored
+     layers are kept. Ids are assigned in the same order as loadFile() does.
+     \param records Particle records, SLAB_RECORD doubles per particle.
+   */
+  void loadRecords(std::vector<double> const& records);
+
   /**
      Loads a file with thte geometry of an exclusion zone.
      Warning: very slow.
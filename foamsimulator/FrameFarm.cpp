@@ -0,0 +1,105 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "FrameFarm.h"
+#include "BinaryFile.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#define _SILENCE_EXPERIMENTAL_FILESYSTEM_DEPRECATION_WARNING
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+
+#define MAGIC "VSPHFRM2"
+
+bool FrameResult::write(std::string const &fileName) const {
+  std::string tmpName = fileName + ".tmp";
+  {
+    std::ofstream out(tmpName, std::ios::binary | std::ios::trunc);
+    out.write(MAGIC, std::strlen(MAGIC));
+    out.write((const char *)&nstep, sizeof(nstep));
+    out.write((const char *)&nfluid, sizeof(nfluid));
+    out.write((const char *)&sourceSize, sizeof(sourceSize));
+    out.write((const char *)&sourceTime, sizeof(sourceTime));
+    out.write((const char *)&fluidPairs, sizeof(fluidPairs));
+    binary::writeVector(out, params);
+    binary::writeVector(out, stats);
+    binary::writeVector(out, emitters);
+    binary::writeVector(out, ndiffuse);
+    if (!out.good())
+      return false;
+  }
+
+  std::error_code ec;
+  fs::rename(tmpName, fileName, ec);
+  return !ec;
+}
+
+bool FrameResult::read(std::string const &fileName) {
+  std::ifstream in(fileName, std::ios::binary);
+  char magic[sizeof(MAGIC)] = {0};
+
+  return in.read(magic, std::strlen(MAGIC)) && std::string(magic) == MAGIC &&
+         in.read((char *)&nstep, sizeof(nstep)) && in.read((char *)&nfluid, sizeof(nfluid)) &&
+         in.read((char *)&sourceSize, sizeof(sourceSize)) &&
+         in.read((char *)&sourceTime, sizeof(sourceTime)) &&
+         in.read((char *)&fluidPairs, sizeof(fluidPairs)) && binary::readVector(in, params) &&
+         binary::readVector(in, stats) && binary::readVector(in, emitters) &&
+         binary::readVector(in, ndiffuse) &&
+         emitters.size() == ndiffuse.size();
+}
+
+FrameFarm::FrameFarm(std::string const &d, std::string const &p) : dir(d), prefix(p) {
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+}
+
+std::string FrameFarm::claimFile(int nstep) const {
+  return (fs::path(dir) / (prefix + std::to_string(nstep) + ".claim")).generic_string();
+}
+
+std::string FrameFarm::resultFile(int nstep) const {
+  return (fs::path(dir) / (prefix + std::to_string(nstep) + ".frame")).generic_string();
+}
+
+std::string const &FrameFarm::getDir() const { return dir; }
+
+// Creating a file that must not exist is atomic, also in shared file systems
+bool FrameFarm::claim(int nstep) {
+  int fd = open(claimFile(nstep).c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+  if (fd < 0)
+    return false;
+  close(fd);
+  return true;
+}
+
+void FrameFarm::release(int nstep) {
+  std::error_code ec;
+  fs::remove(claimFile(nstep), ec);
+}
+
+bool FrameFarm::isClaimed(int nstep) const {
+  std::error_code ec;
+  return fs::exists(claimFile(nstep), ec);
+}
@@ -0,0 +1,109 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef FRAMEFARM_H
+#define FRAMEFARM_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+   \brief Result of the stages 1 to 5 of a time step, computed by a farm worker: the number of
+   diffuse particles generated by each fluid particle and the statistics of the potentials.
+   The parameters of those stages and the size and modification time of the input file are
+   stored with it, so that a result computed with other parameters or input is not used.
+ */
+struct FrameResult {
+  int nstep = 0;                                ///< Time step.
+  std::vector<double> params;                   ///< Parameters of the stages 1 to 5.
+  int64_t nfluid = 0;                           ///< Number of fluid particles.
+  int64_t sourceSize = 0;                       ///< Size of the input file.
+  int64_t sourceTime = 0;                       ///< Modification time of the input file.
+  int64_t fluidPairs = 0;                       ///< Fluid particle pairs evaluated.
+  std::vector<double> stats;                    ///< Statistics of the trapped air, wave crest and kinetic energy potentials, packed.
+  std::vector<int64_t> emitters;                ///< Ids of the fluid particles that generate diffuse particles.
+  std::vector<int> ndiffuse;                    ///< Number of diffuse particles generated by each emitter.
+
+  /**
+     Writes the result to a binary file. It is written to a temporary file that is renamed
+     at the end, so that the file never appears partially written.
+     \param fileName File name.
+     \return True if the file was correctly written.
+   */
+  bool write(std::string const& fileName) const;
+
+  /**
+     Reads a result from a file written by write().
+     \param fileName File name.
+     \return True if the file was correctly read.
+   */
+  bool read(std::string const& fileName);
+};
+
+/**
+   \brief File-based job queue to compute the stages 1 to 5 of the time steps in several
+   processes, possibly in several nodes sharing a directory.
+   A process takes a step by creating its claim file, which only succeeds for one of them.
+   The result of the step is written next to it.
+ */
+class FrameFarm {
+
+ public:
+  /**
+     Class constructor.
+     \param dir Shared directory. It is created if it does not exist.
+     \param prefix Prefix of the files.
+   */
+  FrameFarm(std::string const& dir, std::string const& prefix);
+
+  /**
+     Takes a step, if no other process has taken it.
+     \param nstep Time step.
+     \return True if this process has taken the step.
+   */
+  bool claim(int nstep);
+
+  /**
+     Gives up a step taken with claim(), so that another process can take it.
+     \param nstep Time step.
+   */
+  void release(int nstep);
+
+  /**
+     \param nstep Time step.
+     \return True if the step has been taken by some process.
+   */
+  bool isClaimed(int nstep) const;
+
+  /**
+     \param nstep Time step.
+     \return Name of the result file of a step.
+   */
+  std::string resultFile(int nstep) const;
+
+  /**
+     \return Shared directory.
+   */
+  std::string const& getDir() const;
+
+ private:
+  std::string dir, prefix;
+
+  std::string claimFile(int nstep) const;
+};
+
+#endif
@@ -0,0 +1,299 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+
+#include "LegacyVtkReader.h"
+
+// Size in bytes of a binary value of a type, zero if it is not supported
+static int typeSize(std::string const &type) {
+  if (type == "unsigned_char" || type == "char")
+    return 1;
+  if (type == "short" || type == "unsigned_short")
+    return 2;
+  if (type == "int" || type == "unsigned_int" || type == "float")
+    return 4;
+  if (type == "long" || type == "unsigned_long" || type == "double" || type == "vtkIdType" ||
+      type == "vtktypeint64" || type == "vtktypeuint64")
+    return 8;
+  return 0;
+}
+
+// Value of a binary value of a type, already in the byte order of the host
+static double toDouble(char const *p, std::string const &type) {
+  if (type == "float") {
+    float v;
+    std::memcpy(&v, p, 4);
+    return v;
+  } else if (type == "double") {
+    double v;
+    std::memcpy(&v, p, 8);
+    return v;
+  } else if (type == "char") {
+    return (signed char)*p;
+  } else if (type == "unsigned_char") {
+    return (unsigned char)*p;
+  } else if (type == "short") {
+    int16_t v;
+    std::memcpy(&v, p, 2);
+    return v;
+  } else if (type == "unsigned_short") {
+    uint16_t v;
+    std::memcpy(&v, p, 2);
+    return v;
+  } else if (type == "int") {
+    int32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+  } else if (type == "unsigned_int") {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+  } else if (type == "unsigned_long" || type == "vtktypeuint64") {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return (double)v;
+  } else {
+    int64_t v;
+    std::memcpy(&v, p, 8);
+    return (double)v;
+  }
+}
+
+// Next line that is not empty, without the end of line
+static bool nextLine(std::istream &in, std::string &line) {
+  while (std::getline(in, line)) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (line.find_first_not_of(" \t") != std::string::npos)
+      return true;
+  }
+  return false;
+}
+
+// Skips the values of a section, without reading them in binary files
+static bool skipValues(std::istream &in, bool binary, long long count, std::string const &type) {
+  if (binary) {
+    int size = typeSize(type);
+    if (size == 0 && type != "bit")
+      return false;
+    in.seekg(size > 0 ? count * size : (count + 7) / 8, std::ios::cur);
+  } else {
+    std::string token;
+    for (long long i = 0; i < count; i++)
+      in >> token;
+  }
+  return (bool)in;
+}
+
+// Skips a METADATA block, if it follows
+static void skipMetadata(std::istream &in) {
+  std::streampos at = in.tellg();
+  std::string line;
+  if (nextLine(in, line) && line.compare(0, 8, "METADATA") == 0) {
+    while (std::getline(in, line) && line.find_first_not_of(" \t\r") != std::string::npos)
+      ;
+  } else {
+    in.clear();
+    in.seekg(at);
+  }
+}
+
+LegacyVtkReader::LegacyVtkReader(std::string const &fileName)
+    : fileName(fileName), binary(false), npoints(0) {}
+
+long LegacyVtkReader::getNumberOfPoints() const { return npoints; }
+
+bool LegacyVtkReader::open() {
+  std::ifstream in(fileName, std::ios::binary);
+  std::string line;
+  if (!std::getline(in, line) || line.compare(0, 14, "# vtk DataFile") != 0 ||
+      !std::getline(in, line) || !nextLine(in, line))
+    return false;
+  if (line.compare(0, 6, "BINARY") == 0)
+    binary = true;
+  else if (line.compare(0, 5, "ASCII") == 0)
+    binary = false;
+  else
+    return false;
+
+  arrays.clear();
+  npoints = 0;
+  bool pointData = false;
+  long ntuples = 0; // Tuples of the arrays of the current section
+  bool polydata = false;
+
+  while (nextLine(in, line)) {
+    std::istringstream ss(line);
+    std::string keyword, name, type;
+    ss >> keyword;
+
+    if (keyword == "DATASET") {
+      ss >> type;
+      if (type != "POLYDATA")
+        return false;
+      polydata = true;
+
+    } else if (keyword == "POINTS") {
+      ss >> npoints >> type;
+      arrays.push_back(Array{"POINTS", type, 3, (std::streamoff)in.tellg()});
+      if (!skipValues(in, binary, 3LL * npoints, type))
+        return false;
+
+    } else if (keyword == "VERTICES" || keyword == "LINES" || keyword == "POLYGONS" ||
+               keyword == "TRIANGLE_STRIPS") {
+      long long ncells, size;
+      ss >> ncells >> size;
+      std::streampos at = in.tellg();
+      if (nextLine(in, line) && line.compare(0, 7, "OFFSETS") == 0) { // Format 5.1
+        std::istringstream os(line.substr(7));
+        os >> type;
+        if (!skipValues(in, binary, ncells, type) || !nextLine(in, line) ||
+            line.compare(0, 12, "CONNECTIVITY") != 0)
+          return false;
+        std::istringstream cs(line.substr(12));
+        cs >> type;
+        if (!skipValues(in, binary, size, type))
+          return false;
+      } else {
+        in.clear();
+        in.seekg(at);
+        if (!skipValues(in, binary, size, "int"))
+          return false;
+      }
+
+    } else if (keyword == "POINT_DATA" || keyword == "CELL_DATA") {
+      ss >> ntuples;
+      pointData = keyword == "POINT_DATA";
+
+    } else if (keyword == "SCALARS") {
+      int components = 1;
+      ss >> name >> type;
+      if (!(ss >> components))
+        components = 1;
+      std::streampos at = in.tellg();
+      if (!nextLine(in, line) || line.compare(0, 12, "LOOKUP_TABLE") != 0) { // It is optional
+        in.clear();
+        in.seekg(at);
+      }
+      if (pointData)
+        arrays.push_back(Array{name, type, components, (std::streamoff)in.tellg()});
+      if (!skipValues(in, binary, (long long)ntuples * components, type))
+        return false;
+
+    } else if (keyword == "VECTORS" || keyword == "NORMALS" || keyword == "TENSORS" ||
+               keyword == "TENSORS6" || keyword == "TEXTURE_COORDINATES") {
+      int components = keyword == "TENSORS" ? 9 : (keyword == "TENSORS6" ? 6 : 3);
+      ss >> name;
+      if (keyword == "TEXTURE_COORDINATES")
+        ss >> components;
+      ss >> type;
+      if (pointData)
+        arrays.push_back(Array{name, type, components, (std::streamoff)in.tellg()});
+      if (!skipValues(in, binary, (long long)ntuples * components, type))
+        return false;
+
+    } else if (keyword == "COLOR_SCALARS") {
+      int components;
+      ss >> name >> components;
+      if (!skipValues(in, binary, (long long)ntuples * components,
+                      binary ? "unsigned_char" : "float"))
+        return false;
+
+    } else if (keyword == "LOOKUP_TABLE") {
+      long long size;
+      ss >> name >> size;
+      if (!skipValues(in, binary, 4 * size, binary ? "unsigned_char" : "float"))
+        return false;
+
+    } else if (keyword == "FIELD") {
+      int narrays;
+      ss >> name >> narrays;
+      for (int a = 0; a < narrays; a++) {
+        if (!nextLine(in, line))
+          return false;
+        std::istringstream as(line);
+        int components;
+        long long count;
+        as >> name;
+        if (name == "NULL_ARRAY")
+          continue;
+        as >> components >> count >> type;
+        if (pointData)
+          arrays.push_back(Array{name, type, components, (std::streamoff)in.tellg()});
+        if (!skipValues(in, binary, count * components, type))
+          return false;
+        skipMetadata(in);
+      }
+
+    } else if (keyword == "METADATA") {
+      while (std::getline(in, line) && line.find_first_not_of(" \t\r") != std::string::npos)
+        ;
+
+    } else {
+      return false;
+    }
+  }
+
+  return polydata && !arrays.empty();
+}
+
+bool LegacyVtkReader::stream(std::string const &name, Stream &stream) const {
+  auto array = std::find_if(arrays.begin(), arrays.end(),
+                            [&name](Array const &a) { return a.name == name; });
+  if (array == arrays.end() || (binary && typeSize(array->type) == 0))
+    return false;
+
+  stream.in.close();
+  stream.in.clear();
+  stream.in.open(fileName, std::ios::binary);
+  stream.in.seekg(array->offset);
+  stream.array = *array;
+  stream.binary = binary;
+  return (bool)stream.in;
+}
+
+int LegacyVtkReader::Stream::getComponents() const { return array.components; }
+
+bool LegacyVtkReader::Stream::read(long ntuples, std::vector<double> &values) {
+  long count = ntuples * array.components;
+  values.resize(count);
+
+  if (!binary) {
+    for (long i = 0; i < count; i++)
+      in >> values[i];
+    return (bool)in;
+  }
+
+  // Binary values are big endian
+  int size = typeSize(array.type);
+  buffer.resize(count * size);
+  if (!in.read(buffer.data(), buffer.size()))
+    return false;
+  const uint16_t one = 1;
+  bool swap = *(const char *)&one == 1;
+  for (long i = 0; i < count; i++) {
+    char *p = &buffer[i * size];
+    if (swap)
+      std::reverse(p, p + size);
+    values[i] = toDouble(p, array.type);
+  }
+  return true;
+}
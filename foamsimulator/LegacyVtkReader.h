@@ -0,0 +1,103 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef LEGACYVTKREADER_H
+#define LEGACYVTKREADER_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+   \brief Sequential reader of the point arrays of a legacy vtk polydata file (ASCII or binary),
+   that does not load the whole file.
+   open() parses the sections of the file and records where the positions and each point data
+   array start, skipping their data. Then each array can be read in chunks of tuples with its own
+   Stream, so that several arrays are read side by side with a bounded memory.
+ */
+class LegacyVtkReader {
+
+ public:
+  /**
+     Location of an array in the file.
+   */
+  struct Array {
+    std::string name;     ///< Array name. "POINTS" for the positions.
+    std::string type;     ///< Data type, as written in the file.
+    int components;       ///< Number of components of each tuple.
+    std::streamoff offset; ///< Position of its first value in the file.
+  };
+
+  /**
+     \brief Sequential reading of an array, in chunks of tuples.
+   */
+  class Stream {
+   public:
+    /**
+       Reads the next tuples of the array.
+       \param ntuples Number of tuples.
+       \param values Receives ntuples * getComponents() values.
+       \return False if the file cannot be read.
+     */
+    bool read(long ntuples, std::vector<double> &values);
+
+    /**
+       \return Number of components of each tuple.
+     */
+    int getComponents() const;
+
+   private:
+    friend class LegacyVtkReader;
+    std::ifstream in;
+    Array array;
+    bool binary;
+    std::vector<char> buffer;
+  };
+
+  /**
+     Class constructor.
+     \param fileName File name.
+   */
+  LegacyVtkReader(std::string const& fileName);
+
+  /**
+     Parses the sections of the file, without reading their data.
+     \return False if it is not a legacy vtk polydata file or it has sections that are not supported.
+   */
+  bool open();
+
+  /**
+     \return Number of points.
+   */
+  long getNumberOfPoints() const;
+
+  /**
+     Starts the reading of an array from its first tuple.
+     \param name Array name: "POINTS" for the positions, or the name of a point data array.
+     \param stream Stream positioned at the first value of the array.
+     \return False if the array does not exist or the file cannot be opened.
+   */
+  bool stream(std::string const& name, Stream &stream) const;
+
+ private:
+  std::string fileName;
+  bool binary;
+  long npoints;
+  std::vector<Array> arrays; // Positions and point data arrays
+};
+
+#endif
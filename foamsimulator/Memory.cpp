@@ -0,0 +1,55 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "Memory.h"
+
+#include <fstream>
+#include <string>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+namespace memory {
+
+#ifdef __linux__
+
+  double residentBytes() {
+    std::ifstream statm("/proc/self/statm");
+    long size, resident;
+    if (!(statm >> size >> resident))
+      return 0;
+    return (double)resident * sysconf(_SC_PAGESIZE);
+  }
+
+  double peakResidentBytes() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+      if (line.compare(0, 6, "VmHWM:") == 0)
+        return std::stod(line.substr(6)) * 1024; // In kB
+    return 0;
+  }
+
+#else
+
+  double residentBytes() { return 0; }
+
+  double peakResidentBytes() { return 0; }
+
+#endif
+
+}
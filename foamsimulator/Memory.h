@@ -0,0 +1,63 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <vector>
+
+/**
+   \brief This namespace groups some helpers to account the memory used by the simulation.
+   The memory of each data structure is computed from the capacity of its vectors, and the
+   resident memory of the process is read from the operating system.
+ */
+namespace memory {
+
+  /**
+     Memory reserved by a vector, without the vector object itself.
+     \param v Vector.
+     \return Bytes.
+   */
+  template <class T, class A>
+  inline double bytes(std::vector<T, A> const& v) {
+    return (double)v.capacity() * sizeof(T);
+  }
+
+  /**
+     Memory reserved by a vector of vectors, including the inner vector objects.
+     \param v Vector of vectors.
+     \return Bytes.
+   */
+  template <class T, class B, class A>
+  inline double bytes(std::vector<std::vector<T, B>, A> const& v) {
+    double b = (double)v.capacity() * sizeof(std::vector<T, B>);
+    for (auto &i : v)
+      b += bytes(i);
+    return b;
+  }
+
+  /**
+     \return Current resident memory of the process in bytes. Zero if it is not available (only Linux).
+   */
+  double residentBytes();
+
+  /**
+     \return Peak resident memory of the process in bytes. Zero if it is not available (only Linux).
+   */
+  double peakResidentBytes();
+}
+
+#endif
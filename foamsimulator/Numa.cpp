@@ -0,0 +1,113 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "Numa.h"
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+
+#define _SILENCE_EXPERIMENTAL_FILESYSTEM_DEPRECATION_WARNING
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+
+#include <omp.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+// Node of a cpu, from its nodeN link in sysfs. Zero if it is not available.
+static int nodeOf(int cpu) {
+  std::error_code ec;
+  fs::path dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+  for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+    std::string name = it->path().filename().string();
+    if (name.compare(0, 4, "node") == 0 && name.size() > 4 &&
+        std::all_of(name.begin() + 4, name.end(), ::isdigit))
+      return std::stoi(name.substr(4));
+  }
+  return 0;
+}
+
+int numa::nodes() {
+  std::error_code ec;
+  int n = 0;
+  for (fs::directory_iterator it("/sys/devices/system/node", ec), end; !ec && it != end;
+       it.increment(ec)) {
+    std::string name = it->path().filename().string();
+    if (name.compare(0, 4, "node") == 0 && name.size() > 4 &&
+        std::all_of(name.begin() + 4, name.end(), ::isdigit))
+      n++;
+  }
+  return std::max(n, 1);
+}
+
+#ifdef __linux__
+
+bool numa::pinThreads(std::string const &policy) {
+  if (policy != "compact" && policy != "spread") {
+    std::cerr << "WARNING: unknown thread pinning policy '" << policy << "'." << std::endl;
+    return false;
+  }
+
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    return false;
+
+  // Allowed cores sorted by node
+  std::vector<std::pair<int, int>> cpus; // Node and cpu
+  for (int c = 0; c < CPU_SETSIZE; c++)
+    if (CPU_ISSET(c, &allowed))
+      cpus.push_back({nodeOf(c), c});
+  std::sort(cpus.begin(), cpus.end());
+
+  // Spread: take one core of each node in turn
+  if (policy == "spread") {
+    std::vector<std::pair<int, int>> order;
+    for (long round = 0; order.size() < cpus.size(); round++) {
+      for (long i = 0; i < cpus.size();) {
+        long j = i;
+        while (j < cpus.size() && cpus[j].first == cpus[i].first)
+          j++;
+        if (i + round < j)
+          order.push_back(cpus[i + round]);
+        i = j;
+      }
+    }
+    cpus = order;
+  }
+
+  bool ok = true;
+#pragma omp parallel reduction(&& : ok)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[omp_get_thread_num() % cpus.size()].second, &set);
+    ok = sched_setaffinity(0, sizeof(set), &set) == 0;
+  }
+  return ok;
+}
+
+#else
+
+bool numa::pinThreads(std::string const &policy) {
+  std::cerr << "WARNING: thread pinning is only supported on Linux." << std::endl;
+  return false;
+}
+
+#endif
@@ -0,0 +1,83 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+   \brief This namespace groups the helpers to place the data of each thread in its NUMA node.
+   Linux places a page in the node of the thread that writes it first. The fields of the fluid
+   particles are allocated without initializing them, and each thread initializes the part that
+   it computes later, so that the threads of each socket work on local memory. This only
+   works when the threads stay in their cores (see pinThreads() or OMP_PROC_BIND) and the loops
+   assign the same buckets to the same threads (static schedule).
+ */
+namespace numa {
+
+  /**
+     Allocator that default-initializes the elements, so resize() does not touch the memory
+     of trivial types: each page is placed in the node of the thread that writes it first.
+   */
+  template <class T>
+  struct Allocator : std::allocator<T> {
+    template <class U>
+    struct rebind {
+      typedef Allocator<U> other;
+    };
+
+    Allocator() = default;
+
+    template <class U>
+    Allocator(Allocator<U> const &) {}
+
+    template <class U>
+    void construct(U *p) noexcept(std::is_nothrow_default_constructible<U>::value) {
+      ::new ((void *)p) U;
+    }
+
+    template <class U, class... Args>
+    void construct(U *p, Args &&... args) {
+      ::new ((void *)p) U(std::forward<Args>(args)...);
+    }
+  };
+
+  /**
+     Vector that does not initialize its elements on resize().
+   */
+  template <class T>
+  using vector = std::vector<T, Allocator<T>>;
+
+  /**
+     \return Number of NUMA nodes of the machine. One if it is not available (only Linux).
+   */
+  int nodes();
+
+  /**
+     Pins each thread of the OpenMP team to a core of the ones allowed for the process.
+     \param policy "compact" fills the cores of a node before using the next one, "spread"
+     places consecutive threads in different nodes.
+     \return True if all the threads were pinned.
+   */
+  bool pinThreads(std::string const& policy);
+}
+
+#endif
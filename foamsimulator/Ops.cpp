@@ -25,32 +25,6 @@
 
 namespace ops {
 
-  std::string vectorStats(std::vector<double> &vec){
-    auto v(vec);
-    auto q1 = v.size() / 4,
-         q2 = v.size() / 2,
-         q3 = 3 * v.size() / 4;
-
-    std::ostringstream s;
-
-    std::nth_element(v.begin(), v.begin(), v.end());
-    s << "[Min: " << std::setw(11) << *v.begin() << " ] ";
-
-    std::nth_element(v.begin(), v.begin() + q1, v.end());
-    s << "[Q1: " << std::setw(11) << v[q1] << " ] ";
- 
-    std::nth_element(v.begin(), v.begin() + q2, v.end());
-    s << "[Q2: " << std::setw(11) << v[q2] << " ] ";
-    
-    std::nth_element(v.begin(), v.begin() + q3, v.end());
-    s << "[Q3: " << std::setw(11) << v[q3] << " ] ";    
- 
-    std::nth_element(v.begin(), v.end()-1, v.end());
-    s << "[Max: " << std::setw(11) << *(v.end()-1) << " ] ";
-
-    return s.str();
-  }
-
   // Velocity difference between two particles
   // double * substract(double *  xi, double *  xj){
   //   double * rval = new double(3);
@@ -27,14 +27,6 @@
  */
 namespace ops {
 
-  /**
-     Compute several statistics of a vector.
-     The statistics computed are the minimum, maximum and Q1, Q2 and Q3 quartiles.
-     \param vec Vector of type double.
-     \param std::string with the stats
-  */
-  std::string vectorStats(std::vector<double> &vec);
-
   /**
      Substraction component by component of two double arrays of three components.
      \param xi Double array of three components.
@@ -0,0 +1,167 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "Parallel.h"
+
+#ifdef USE_MPI
+#include <mpi.h>
+
+static bool initialized = false;
+
+// True if MPI can be used. The Python module never initializes it.
+static bool running() {
+  int flag = 0, finalized = 0;
+  MPI_Initialized(&flag);
+  MPI_Finalized(&finalized);
+  return flag && !finalized;
+}
+
+void parallel::init(int *argc, char ***argv) {
+  if (!running()) {
+    MPI_Init(argc, argv);
+    initialized = true;
+  }
+}
+
+void parallel::finalize() {
+  if (initialized && running())
+    MPI_Finalize();
+  initialized = false;
+}
+
+int parallel::rank() {
+  int r = 0;
+  if (running())
+    MPI_Comm_rank(MPI_COMM_WORLD, &r);
+  return r;
+}
+
+int parallel::size() {
+  int n = 1;
+  if (running())
+    MPI_Comm_size(MPI_COMM_WORLD, &n);
+  return n;
+}
+
+bool parallel::all(bool ok) {
+  int in = ok, out = ok;
+  if (running())
+    MPI_Allreduce(&in, &out, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+  return out != 0;
+}
+
+long long parallel::sum(long long value) {
+  long long out = value;
+  if (running())
+    MPI_Allreduce(&value, &out, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  return out;
+}
+
+void parallel::sum(std::vector<double> &values) {
+  if (running())
+    MPI_Allreduce(MPI_IN_PLACE, values.data(), values.size(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+}
+
+long long parallel::exclusiveSum(long long value) {
+  long long out = 0;
+  if (running())
+    MPI_Exscan(&value, &out, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  // MPI_Exscan leaves the result of the first process undefined
+  return rank() == 0 ? 0 : out;
+}
+
+void parallel::broadcast(std::vector<double> &data) {
+  if (!running())
+    return;
+  long long n = data.size();
+  MPI_Bcast(&n, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+  data.resize(n);
+  MPI_Bcast(data.data(), n, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+}
+
+void parallel::gather(std::vector<double> const &send, std::vector<double> &recv) {
+  if (!running()) {
+    recv = send;
+    return;
+  }
+
+  int nprocs = size(), n = send.size();
+  std::vector<int> counts(nprocs), displs(nprocs, 0);
+  MPI_Gather(&n, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+  for (int p = 1; p < nprocs; p++)
+    displs[p] = displs[p - 1] + counts[p - 1];
+  if (rank() == 0)
+    recv.resize(displs[nprocs - 1] + counts[nprocs - 1]);
+  MPI_Gatherv(send.data(), n, MPI_DOUBLE, recv.data(), counts.data(), displs.data(),
+              MPI_DOUBLE, 0, MPI_COMM_WORLD);
+}
+
+void parallel::exchange(std::vector<std::vector<double>> const &send,
+                        std::vector<double> &recv) {
+  if (!running()) {
+    recv = send.empty() ? std::vector<double>() : send[0];
+    return;
+  }
+
+  int nprocs = size();
+  std::vector<int> sendCounts(nprocs), sendDispls(nprocs, 0), recvCounts(nprocs),
+      recvDispls(nprocs, 0);
+  std::vector<double> buffer;
+  for (int p = 0; p < nprocs; p++) {
+    sendCounts[p] = send[p].size();
+    sendDispls[p] = buffer.size();
+    buffer.insert(buffer.end(), send[p].begin(), send[p].end());
+  }
+
+  MPI_Alltoall(sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+  for (int p = 1; p < nprocs; p++)
+    recvDispls[p] = recvDispls[p - 1] + recvCounts[p - 1];
+  recv.resize(recvDispls[nprocs - 1] + recvCounts[nprocs - 1]);
+
+  MPI_Alltoallv(buffer.data(), sendCounts.data(), sendDispls.data(), MPI_DOUBLE, recv.data(),
+                recvCounts.data(), recvDispls.data(), MPI_DOUBLE, MPI_COMM_WORLD);
+}
+
+#else
+
+void parallel::init(int *argc, char ***argv) {}
+
+void parallel::finalize() {}
+
+int parallel::rank() { return 0; }
+
+int parallel::size() { return 1; }
+
+bool parallel::all(bool ok) { return ok; }
+
+long long parallel::sum(long long value) { return value; }
+
+void parallel::sum(std::vector<double> &values) {}
+
+long long parallel::exclusiveSum(long long value) { return 0; }
+
+void parallel::broadcast(std::vector<double> &data) {}
+
+void parallel::gather(std::vector<double> const &send, std::vector<double> &recv) {
+  recv = send;
+}
+
+void parallel::exchange(std::vector<std::vector<double>> const &send,
+                        std::vector<double> &recv) {
+  recv = send.empty() ? std::vector<double>() : send[0];
+}
+
+#endif
@@ -0,0 +1,97 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <vector>
+
+/**
+   \brief This namespace wraps the few MPI operations used to split the domain among several
+   processes. Data is exchanged as vectors of doubles.
+   When the simulator is built without MPI (USE_MPI not defined), or MPI has not been
+   initialized, there is a single process and every operation returns its own input.
+ */
+namespace parallel {
+
+  /**
+     Initializes MPI. Does nothing without MPI.
+     \param argc Pointer to the number of command line arguments.
+     \param argv Pointer to the command line arguments.
+   */
+  void init(int *argc, char ***argv);
+
+  /**
+     Finalizes MPI, if it was initialized by init().
+   */
+  void finalize();
+
+  /**
+     \return Rank of this process.
+   */
+  int rank();
+
+  /**
+     \return Number of processes.
+   */
+  int size();
+
+  /**
+     \param ok Value of this process.
+     \return True if the value of every process is true.
+   */
+  bool all(bool ok);
+
+  /**
+     \param value Value of this process.
+     \return Sum of the values of all the processes.
+   */
+  long long sum(long long value);
+
+  /**
+     Adds up the vectors of all the processes, element by element. All of them must have the same size.
+     \param values Values of this process. Receives the sums.
+   */
+  void sum(std::vector<double> &values);
+
+  /**
+     \param value Value of this process.
+     \return Sum of the values of the processes with a lower rank.
+   */
+  long long exclusiveSum(long long value);
+
+  /**
+     Sends a vector from the first process to all the others.
+     \param data Data to send, in the first process. Receives it in the others.
+   */
+  void broadcast(std::vector<double> &data);
+
+  /**
+     Collects the vectors of all the processes in the first one.
+     \param send Data of this process.
+     \param recv Receives the data of all the processes in rank order, only in the first process.
+   */
+  void gather(std::vector<double> const& send, std::vector<double> &recv);
+
+  /**
+     Sends a vector to each process and receives the vectors sent to this one.
+     \param send Data sent to each process, indexed by rank.
+     \param recv Receives the data sent to this process, in rank order.
+   */
+  void exchange(std::vector<std::vector<double>> const& send, std::vector<double> &recv);
+}
+
+#endif
@@ -0,0 +1,130 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "PerfCounters.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <omp.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const char *const PerfCounters::names[NCOUNTERS] = {
+    "cycles", "instructions", "llc_misses", "branch_misses", "node_loads", "node_misses",
+    "dtlb_misses"};
+
+// Counters from this one on are optional
+#define NREQUIRED 4
+
+PerfCounters::PerfCounters() {}
+
+PerfCounters::~PerfCounters() { close(); }
+
+bool PerfCounters::isOpen() const { return fds.size() > 0; }
+
+#ifdef __linux__
+
+bool PerfCounters::open() {
+  close();
+
+  const unsigned int types[NCOUNTERS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+                                         PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+                                         PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE,
+                                         PERF_TYPE_HW_CACHE};
+  const unsigned long long configs[NCOUNTERS] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+      PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+          (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16),
+      PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+      PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+
+  std::vector<int> tfds(omp_get_max_threads() * NCOUNTERS, -1);
+  bool ok = true;
+
+  // Each thread opens its own counters: pid 0 measures the calling thread
+#pragma omp parallel reduction(&& : ok)
+  {
+    int tid = omp_get_thread_num();
+    for (int c = 0; c < NCOUNTERS; c++) {
+      struct perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = types[c];
+      attr.config = configs[c];
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format =
+          PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+      int fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+      tfds[tid * NCOUNTERS + c] = fd;
+      ok = ok && (fd >= 0 || c >= NREQUIRED);
+    }
+  }
+
+  fds = tfds;
+  if (!ok) {
+    std::cerr << "WARNING: hardware counters are not available ("
+              << std::strerror(errno) << "). Check /proc/sys/kernel/perf_event_paranoid."
+              << std::endl;
+    close();
+  }
+  return ok;
+}
+
+PerfCounters::values PerfCounters::read() const {
+  values v;
+  v.fill(0);
+  for (long i = 0; i < fds.size(); i++) {
+    unsigned long long data[3]; // value, time enabled, time running
+    if (fds[i] >= 0 && ::read(fds[i], data, sizeof(data)) == sizeof(data) && data[2] > 0)
+      v[i % NCOUNTERS] += (double)data[0] * data[1] / data[2];
+  }
+  return v;
+}
+
+void PerfCounters::close() {
+  for (int fd : fds)
+    if (fd >= 0)
+      ::close(fd);
+  fds.clear();
+}
+
+#else
+
+bool PerfCounters::open() {
+  std::cerr << "WARNING: hardware counters are only supported on Linux." << std::endl;
+  return false;
+}
+
+PerfCounters::values PerfCounters::read() const {
+  values v;
+  v.fill(0);
+  return v;
+}
+
+void PerfCounters::close() {}
+
+#endif
@@ -0,0 +1,71 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <array>
+#include <vector>
+
+/**
+   \brief Hardware performance counters of all the OpenMP threads.
+   The counters are opened with perf_event_open for each thread of the OpenMP team, and read()
+   returns the sum over all of them. Counting happens only in user space, so it works with the
+   default perf_event_paranoid setting of most distributions. On systems other than Linux, or
+   when the kernel refuses the counters, open() fails and nothing is measured.
+   The memory accesses served by the local and by a remote NUMA node and the data TLB misses
+   are optional: they read zero if the processor does not support them.
+ */
+class PerfCounters {
+
+ public:
+  static const int NCOUNTERS = 7;
+
+  /**
+     Counter names: cycles, instructions, last level cache misses, branch misses, memory
+     accesses served by a NUMA node, those served by a remote node and data TLB load misses.
+   */
+  static const char * const names[NCOUNTERS];
+
+  typedef std::array<double, NCOUNTERS> values;
+
+  PerfCounters();
+  ~PerfCounters();
+
+  /**
+     Opens and starts the counters for every thread of the OpenMP team.
+     \return True if all the counters were opened.
+   */
+  bool open();
+
+  /**
+     \return True if the counters are opened.
+   */
+  bool isOpen() const;
+
+  /**
+     Reads the counters. Values are scaled when the kernel multiplexes them.
+     \return Sum of each counter over all the threads since they were opened.
+   */
+  values read() const;
+
+ private:
+  std::vector<int> fds; // NCOUNTERS descriptors per thread, -1 for the unsupported optional ones
+
+  void close();
+};
+
+#endif
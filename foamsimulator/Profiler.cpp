@@ -0,0 +1,250 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "Profiler.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <iomanip>
+
+Profiler::Profiler() : nstep(0), hw(nullptr), totalTime(0), nsteps(0) {}
+
+bool Profiler::open(std::string const &fileName) {
+  report.open(fileName, std::ios::trunc);
+  return report.is_open();
+}
+
+void Profiler::setHardwareCounters(PerfCounters const *counters) {
+  hw = counters;
+}
+
+void Profiler::beginStep(int n) {
+  nstep = n;
+  stage.clear();
+  stages.clear();
+  counters.clear();
+  imbalances.clear();
+  hwStages.clear();
+  stepStart = clock::now();
+}
+
+void Profiler::beginStage(std::string const &name) {
+  endStage();
+  stage = name;
+  if (hw)
+    hwStart = hw->read();
+  stageStart = clock::now();
+}
+
+void Profiler::endStage() {
+  if (stage.empty())
+    return;
+  auto now = clock::now();
+  double t = std::chrono::duration<double>(now - stageStart).count();
+
+  // A stage that runs several times in a step (once per slab) is added up
+  auto s = std::find_if(stages.begin(), stages.end(),
+                        [this](std::pair<std::string, double> const &p) { return p.first == stage; });
+  if (s == stages.end())
+    stages.push_back(std::make_pair(stage, t));
+  else
+    s->second += t;
+
+  if (hw) {
+    PerfCounters::values v = hw->read();
+    for (int c = 0; c < PerfCounters::NCOUNTERS; c++)
+      v[c] -= hwStart[c];
+    auto h = std::find_if(hwStages.begin(), hwStages.end(),
+                          [this](std::pair<std::string, PerfCounters::values> const &p) {
+                            return p.first == stage;
+                          });
+    if (h == hwStages.end()) {
+      hwStages.push_back(std::make_pair(stage, v));
+    } else {
+      for (int c = 0; c < PerfCounters::NCOUNTERS; c++)
+        h->second[c] += v[c];
+    }
+  }
+  if (trace::enabled())
+    trace::record(stage.c_str(), stageStart, now);
+  stage.clear();
+}
+
+void Profiler::count(std::string const &name, long long value) {
+  for (auto &c : counters) {
+    if (c.first == name) {
+      c.second += value;
+      return;
+    }
+  }
+  counters.push_back(std::make_pair(name, value));
+}
+
+void Profiler::imbalance(double value) {
+  for (auto &i : imbalances) {
+    if (i.first == stage) {
+      i.second = std::max(i.second, value);
+      return;
+    }
+  }
+  imbalances.push_back(std::make_pair(stage, value));
+}
+
+void Profiler::endStep() {
+  endStage();
+  auto now = clock::now();
+  double t = std::chrono::duration<double>(now - stepStart).count();
+  if (trace::enabled())
+    trace::record("step", stepStart, now, nstep, nstep);
+
+  for (auto &s : stages)
+    accumulate(stageTotals, s.first, s.second);
+  for (auto &c : counters)
+    accumulate(counterTotals, c.first, c.second);
+  for (auto &i : imbalances)
+    accumulate(imbalanceTotals, i.first, i.second);
+  for (auto &s : hwStages) {
+    auto t = std::find_if(hwTotals.begin(), hwTotals.end(),
+                          [&s](std::pair<std::string, PerfCounters::values> const &p) {
+                            return p.first == s.first;
+                          });
+    if (t == hwTotals.end()) {
+      hwTotals.push_back(s);
+    } else {
+      for (int c = 0; c < PerfCounters::NCOUNTERS; c++)
+        t->second[c] += s.second[c];
+    }
+  }
+  totalTime += t;
+  nsteps++;
+
+  if (report.is_open()) {
+    report << "{\"step\": " << nstep << ", \"time\": " << t << ", \"stages\": {";
+    for (long i = 0; i < stages.size(); i++)
+      report << (i ? ", " : "") << "\"" << stages[i].first << "\": " << stages[i].second;
+    report << "}, \"counters\": {";
+    for (long i = 0; i < counters.size(); i++)
+      report << (i ? ", " : "") << "\"" << counters[i].first << "\": " << counters[i].second;
+    report << "}";
+    if (imbalances.size() > 0) {
+      report << ", \"imbalance\": {";
+      for (long i = 0; i < imbalances.size(); i++)
+        report << (i ? ", " : "") << "\"" << imbalances[i].first << "\": " << imbalances[i].second;
+      report << "}";
+    }
+    if (hwStages.size() > 0) {
+      report << ", \"hw\": {";
+      for (long i = 0; i < hwStages.size(); i++) {
+        report << (i ? ", " : "") << "\"" << hwStages[i].first << "\": {";
+        for (int c = 0; c < PerfCounters::NCOUNTERS; c++)
+          report << (c ? ", " : "") << "\"" << PerfCounters::names[c]
+                 << "\": " << (long long)hwStages[i].second[c];
+        report << "}";
+      }
+      report << "}";
+    }
+    report << "}" << std::endl;
+  }
+}
+
+std::vector<Profiler::Total> const &Profiler::getStageTotals() const {
+  return stageTotals;
+}
+
+std::vector<Profiler::Total> const &Profiler::getCounterTotals() const {
+  return counterTotals;
+}
+
+std::vector<Profiler::Total> const &Profiler::getImbalanceTotals() const {
+  return imbalanceTotals;
+}
+
+std::vector<std::pair<std::string, PerfCounters::values>> const &
+Profiler::getHardwareTotals() const {
+  return hwTotals;
+}
+
+void Profiler::accumulate(std::vector<Total> &totals, std::string const &name,
+                          double value) {
+  for (auto &t : totals) {
+    if (t.name == name) {
+      t.sum += value;
+      t.min = std::min(t.min, value);
+      t.max = std::max(t.max, value);
+      t.n++;
+      return;
+    }
+  }
+  totals.push_back(Total{name, value, value, value, 1});
+}
+
+void Profiler::printSummary(std::ostream &os) const {
+  if (nsteps == 0)
+    return;
+
+  std::ios::fmtflags flags(os.flags());
+
+  os << "\n=== Profile: " << nsteps << " steps, " << totalTime << " s" << std::endl;
+  os << std::left << std::setw(12) << "Stage" << std::right
+     << std::setw(13) << "Total (s)" << std::setw(13) << "Mean (s)"
+     << std::setw(13) << "Min (s)" << std::setw(13) << "Max (s)"
+     << std::setw(9) << "%" << std::setw(13) << "Imbalance %" << std::endl;
+
+  os << std::fixed;
+  for (auto &t : stageTotals) {
+    os << std::left << std::setw(12) << t.name << std::right << std::setprecision(4)
+       << std::setw(13) << t.sum << std::setw(13) << t.sum / t.n
+       << std::setw(13) << t.min << std::setw(13) << t.max << std::setprecision(1)
+       << std::setw(9) << (totalTime > 0 ? 100. * t.sum / totalTime : 0.);
+    // Mean over the steps
+    for (auto &i : imbalanceTotals)
+      if (i.name == t.name)
+        os << std::setw(13) << 100. * i.sum / i.n;
+    os << std::endl;
+  }
+
+  os << std::left << std::setw(16) << "\nCounter" << std::right
+     << std::setw(17) << "Total" << std::setw(17) << "Mean/step"
+     << std::setw(17) << "Min" << std::setw(17) << "Max" << std::endl;
+
+  os << std::setprecision(0);
+  for (auto &t : counterTotals) {
+    os << std::left << std::setw(15) << t.name << std::right
+       << std::setw(17) << t.sum << std::setw(17) << t.sum / t.n
+       << std::setw(17) << t.min << std::setw(17) << t.max << std::endl;
+  }
+
+  if (hwTotals.size() > 0) {
+    os << std::left << std::setw(13) << "\nStage" << std::right
+       << std::setw(17) << "Cycles" << std::setw(17) << "Instructions"
+       << std::setw(7) << "IPC" << std::setw(15) << "LLC misses"
+       << std::setw(15) << "Branch misses" << std::setw(12) << "LLC/kinstr"
+       << std::setw(10) << "Remote %" << std::setw(15) << "dTLB misses" << std::endl;
+    for (auto &t : hwTotals) {
+      auto &v = t.second;
+      double kinstr = v[1] / 1000.;
+      os << std::left << std::setw(12) << t.first << std::right << std::setprecision(0)
+         << std::setw(17) << v[0] << std::setw(17) << v[1] << std::setprecision(2)
+         << std::setw(7) << (v[0] > 0 ? v[1] / v[0] : 0.) << std::setprecision(0)
+         << std::setw(15) << v[2] << std::setw(15) << v[3] << std::setprecision(3)
+         << std::setw(12) << (kinstr > 0 ? v[2] / kinstr : 0.) << std::setprecision(1)
+         << std::setw(10) << (v[4] > 0 ? 100. * v[5] / v[4] : 0.) << std::setprecision(0)
+         << std::setw(15) << v[6] << std::endl;
+    }
+  }
+
+  os.flags(flags);
+}
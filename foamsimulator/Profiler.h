@@ -0,0 +1,160 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "PerfCounters.h"
+
+/**
+   \brief Collects the wall time of each stage and some event counters for every time step.
+   Stages are opened one after the other with beginStage(); opening a new stage closes the
+   previous one. A stage opened several times in the same step is added up. When a step ends,
+   its record is appended as one JSON object per line to the report file (if any) and
+   accumulated for the summary table printed at the end of the run.
+   Optionally, the hardware counters of each stage are also recorded, and the load imbalance
+   of the threads in the stages that measure it.
+   All the methods must be called from the master thread, outside of parallel regions.
+ */
+class Profiler {
+
+ public:
+  /**
+     Aggregated values of a stage or a counter over all the steps.
+   */
+  struct Total {
+    std::string name;   ///< Stage or counter name.
+    double sum;         ///< Sum over all the steps.
+    double min;         ///< Minimum value of a step.
+    double max;         ///< Maximum value of a step.
+    long n;             ///< Number of steps in which it appears.
+  };
+
+  /**
+     Class constructor. The report file is disabled by default.
+   */
+  Profiler();
+
+  /**
+     Opens the JSON-lines report file. Each finished step is written as a line.
+     \param fileName File name.
+     \return True if the file was correctly opened.
+   */
+  bool open(std::string const& fileName);
+
+  /**
+     Records the hardware counters of each stage.
+     \param counters Opened counters. Null to disable them.
+   */
+  void setHardwareCounters(PerfCounters const * counters);
+
+  /**
+     Starts the record of a new time step.
+     \param nstep Time step number.
+   */
+  void beginStep(int nstep);
+
+  /**
+     Starts timing a stage. Closes the stage that was running, if any.
+     \param name Stage name.
+   */
+  void beginStage(std::string const& name);
+
+  /**
+     Stops timing the running stage.
+   */
+  void endStage();
+
+  /**
+     Adds a value to a counter of the current step.
+     \param name Counter name.
+     \param value Value to add.
+   */
+  void count(std::string const& name, long long value);
+
+  /**
+     Records the load imbalance of the threads in the running stage. If it runs several
+     times in the step, the largest one is kept.
+     \param value Busy time of the slowest thread over the mean, minus one.
+   */
+  void imbalance(double value);
+
+  /**
+     Finishes the current step: closes the running stage, writes the report line and updates the totals.
+   */
+  void endStep();
+
+  /**
+     \return Aggregated wall time in seconds of each stage, in order of appearance.
+   */
+  std::vector<Total> const& getStageTotals() const;
+
+  /**
+     \return Aggregated value of each counter, in order of appearance.
+   */
+  std::vector<Total> const& getCounterTotals() const;
+
+  /**
+     \return Aggregated load imbalance of each stage that measures it, in order of appearance.
+   */
+  std::vector<Total> const& getImbalanceTotals() const;
+
+  /**
+     \return Aggregated hardware counters of each stage, in order of appearance. Empty if they are not enabled.
+   */
+  std::vector<std::pair<std::string, PerfCounters::values>> const& getHardwareTotals() const;
+
+  /**
+     Prints a table with the time of each stage and the counter totals.
+     \param os Output stream.
+   */
+  void printSummary(std::ostream &os) const;
+
+ private:
+  typedef std::chrono::steady_clock clock;
+
+  std::ofstream report;
+
+  int nstep;
+  clock::time_point stepStart, stageStart;
+  std::string stage;
+
+  std::vector<std::pair<std::string, double>> stages;      // Current step stage times
+  std::vector<std::pair<std::string, long long>> counters; // Current step counters
+  std::vector<std::pair<std::string, double>> imbalances;  // Current step load imbalances
+
+  std::vector<Total> stageTotals, counterTotals, imbalanceTotals;
+
+  PerfCounters const * hw;
+  PerfCounters::values hwStart;
+  std::vector<std::pair<std::string, PerfCounters::values>> hwStages, hwTotals;
+  double totalTime;
+  long nsteps;
+
+  /**
+     Adds a value of the current step to the aggregated totals.
+   */
+  static void accumulate(std::vector<Total> &totals, std::string const& name, double value);
+};
+
+#endif
@@ -0,0 +1,124 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "SimulationParams.h"
+#include "ConfigFile.h"
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+using config::toBool;
+using config::toDouble;
+using config::toLong;
+
+bool SimulationParams::setOption(std::string const &key,
+                                 std::string const &value) {
+  std::string k(key);
+  std::transform(k.begin(), k.end(), k.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+
+  try {
+    if (k == "profilefile") {
+      profileFile = value;
+    } else if (k == "tracefile") {
+      traceFile = value;
+    } else if (k == "tracebuffersize") {
+      traceBufferSize = toLong(value);
+    } else if (k == "hardwarecounters") {
+      hardwareCounters = toBool(value);
+    } else if (k == "seed") {
+      seed = toLong(value);
+    } else if (k == "analyze") {
+      analyze = toBool(value);
+    } else if (k == "analyzesteps") {
+      analyzeSteps = toLong(value);
+    } else if (k == "analyzefraction") {
+      analyzeFraction = toDouble(value);
+    } else if (k == "analyzelowpercentile") {
+      analyzeLowPercentile = toDouble(value);
+    } else if (k == "analyzehighpercentile") {
+      analyzeHighPercentile = toDouble(value);
+    } else if (k == "memorylimit") {
+      memoryLimit = toDouble(value);
+    } else if (k == "memorypolicy") {
+      std::string v(value);
+      std::transform(v.begin(), v.end(), v.begin(),
+                     [](unsigned char c) { return std::tolower(c); });
+      if (v != "cap" && v != "stop")
+        return false;
+      memoryPolicy = v;
+    } else if (k == "checkpointfile") {
+      checkpointFile = value;
+    } else if (k == "resumefile") {
+      resumeFile = value;
+    } else if (k == "follow") {
+      follow = toBool(value);
+    } else if (k == "followtimeout") {
+      followTimeout = toDouble(value);
+    } else if (k == "followpollinterval") {
+      followPollInterval = toDouble(value);
+    } else if (k == "followsentinel") {
+      followSentinel = value;
+    } else if (k == "slabs") {
+      slabs = toLong(value);
+    } else if (k == "slabpath") {
+      slabPath = value;
+    } else if (k == "numafirsttouch") {
+      numaFirstTouch = toBool(value);
+    } else if (k == "pinthreads") {
+      pinThreads = value;
+    } else if (k == "incrementalgrid") {
+      incrementalGrid = toBool(value);
+    } else if (k == "cachepath") {
+      cachePath = value;
+    } else if (k == "cellorder") {
+      std::string v(value);
+      std::transform(v.begin(), v.end(), v.begin(),
+                     [](unsigned char c) { return std::tolower(c); });
+      if (v != "linear" && v != "morton")
+        return false;
+      cellOrder = v;
+    } else if (k == "velocitygrid") {
+      velocityGrid = toBool(value);
+    } else if (k == "velocitygridresolution") {
+      velocityGridResolution = toLong(value);
+      if (velocityGridResolution < 1)
+        return false;
+    } else if (k == "volumefiles") {
+      volumeFiles = toBool(value);
+    } else if (k == "volumeresolution") {
+      volumeResolution = toLong(value);
+      if (volumeResolution < 1)
+        return false;
+    } else if (k == "substeps") {
+      substeps = toLong(value);
+      if (substeps < 1)
+        return false;
+    } else if (k == "balancedscheduler") {
+      balancedScheduler = toBool(value);
+    } else if (k == "farmpath") {
+      farmPath = value;
+    } else if (k == "farmworker") {
+      farmWorker = toBool(value);
+    } else {
+      return false;
+    }
+  } catch (std::exception &) { // Not a number or out of range
+    return false;
+  }
+  return true;
+}
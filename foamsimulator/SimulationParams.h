@@ -65,6 +65,57 @@ struct SimulationParams {
     LIFEFIME, 				                  ///< Life time of diffuse particles.
     KB, 				                        ///< Buoyancy factor for bubble particles.
     KD; 				                        ///< Drag factor for buoyancy particles.
+
+  /* Advanced options. They are optional, so they have default values. */
+
+  std::string profileFile;              ///< JSON-lines file for the per-step timing report. Disabled if empty.
+  std::string traceFile;                ///< Chrome trace JSON file with the timeline of each thread. Disabled if empty.
+  long traceBufferSize = 1 << 16;       ///< Maximum number of trace spans kept for each thread.
+  int hardwareCounters = 0;             ///< Points if the hardware counters of each stage are recorded (Linux only).
+  unsigned seed = 0;                    ///< Seed of the random generator. Zero takes a random seed.
+
+  int analyze = 0;                      ///< Points if the threshold analysis runs instead of the simulation.
+  int analyzeSteps = 10;                ///< Number of steps sampled by the analysis, evenly spaced.
+  double analyzeFraction = 0.05;        ///< Fraction of the fluid particles sampled by the analysis.
+  double analyzeLowPercentile = 75.;    ///< Percentile of each potential proposed as minimum threshold.
+  double analyzeHighPercentile = 99.;   ///< Percentile of each potential proposed as maximum threshold.
+
+  double memoryLimit = 0;               ///< Memory limit in MB. Zero disables it.
+  std::string memoryPolicy = "cap";     ///< What to do if a step would exceed the memory limit: "cap" the emission or "stop" with a checkpoint.
+  std::string checkpointFile;           ///< Checkpoint written when the simulation stops or ends. If empty, it is only written when it stops, to the output path.
+  std::string resumeFile;               ///< Checkpoint to resume the simulation from. Disabled if empty.
+
+  int follow = 0;                       ///< Points if the simulation waits for the input files that are not written yet.
+  double followTimeout = 600.;          ///< Maximum waiting time for an input file, in seconds.
+  double followPollInterval = 1.;       ///< Time between two checks of the input files, in seconds.
+  std::string followSentinel;           ///< File written when there are no more input files. Relative to the input path. Disabled if empty.
+
+  int slabs = 1;                        ///< Number of slabs the domain is split into along the z axis, to bound the memory. One disables it.
+  std::string slabPath;                 ///< Directory of the temporary slab files. The output path if empty.
+
+  int numaFirstTouch = 0;               ///< Points if each thread first touches the particles and fields that it computes, with a static schedule.
+  std::string pinThreads;               ///< Thread pinning policy: "compact" or "spread". Disabled if empty.
+  int incrementalGrid = 0;              ///< Points if the grid of each step is updated from the previous one, matching the particles by Idp.
+  std::string cachePath;                ///< Directory of the fluid cache files written by foamcache. Disabled if empty.
+  std::string cellOrder = "linear";     ///< Order of the loops over the fluid cells and the diffuse particles: "linear" (x fastest) or "morton".
+  int velocityGrid = 0;                 ///< Points if foam and bubbles sample the fluid velocity rasterized onto a grid instead of averaging the fluid particles around.
+  int velocityGridResolution = 2;       ///< Nodes of the velocity grid per cell edge.
+  int volumeFiles = 0;                  ///< Points if the diffuse particles are also written as sparse density volumes of each class.
+  int volumeResolution = 2;             ///< Voxels of the density volumes per cell edge.
+  int substeps = 1;                     ///< Substeps of the diffuse particle advection per time step, with the fluid velocity interpolated up to the next step.
+  int balancedScheduler = 0;            ///< Points if the neighbour loops run cost-balanced chunks with work stealing instead of the OpenMP schedule.
+
+  std::string farmPath;                 ///< Shared directory of the frame farm, where the workers leave the results of the stages 1 to 5. Disabled if empty.
+  int farmWorker = 0;                   ///< Points if this process is a farm worker instead of running the simulation.
+
+  /**
+     Sets an advanced option given its name and its value as text, as read from the [ADVANCED]
+     section of the configuration file. Names are case insensitive.
+     \param key Option name.
+     \param value Option value.
+     \return False if the option does not exist or its value cannot be parsed.
+   */
+  bool setOption(std::string const& key, std::string const& value);
 };
 
 #endif
@@ -0,0 +1,187 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "StreamStats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+#define MIN_VALUE 1e-30
+
+StreamStats::StreamStats(double accuracy)
+    : gamma((1 + accuracy) / (1 - accuracy)), logGamma(std::log(gamma)),
+      count(0), zeros(0), min(std::numeric_limits<double>::max()),
+      max(std::numeric_limits<double>::lowest()), sum(0), posOffset(0),
+      negOffset(0) {}
+
+int StreamStats::index(double x) const {
+  return (int)std::ceil(std::log(x) / logGamma);
+}
+
+// Center of a bucket, with the same relative error to both limits
+double StreamStats::value(int index) const {
+  return 2 * std::pow(gamma, index) / (gamma + 1);
+}
+
+void StreamStats::addTo(std::vector<long> &store, int &offset, int index,
+                        long n) {
+  if (store.empty()) {
+    offset = index;
+    store.push_back(0);
+  } else if (index < offset) {
+    store.insert(store.begin(), offset - index, 0);
+    offset = index;
+  } else if (index >= offset + (long)store.size()) {
+    store.resize(index - offset + 1, 0);
+  }
+  store[index - offset] += n;
+}
+
+void StreamStats::add(double x) {
+  count++;
+  sum += x;
+  min = std::min(min, x);
+  max = std::max(max, x);
+
+  if (x > MIN_VALUE)
+    addTo(pos, posOffset, index(x), 1);
+  else if (x < -MIN_VALUE)
+    addTo(neg, negOffset, index(-x), 1);
+  else
+    zeros++;
+}
+
+void StreamStats::merge(StreamStats const &other) {
+  count += other.count;
+  zeros += other.zeros;
+  sum += other.sum;
+  min = std::min(min, other.min);
+  max = std::max(max, other.max);
+
+  for (long i = 0; i < other.pos.size(); i++)
+    if (other.pos[i] > 0)
+      addTo(pos, posOffset, other.posOffset + i, other.pos[i]);
+  for (long i = 0; i < other.neg.size(); i++)
+    if (other.neg[i] > 0)
+      addTo(neg, negOffset, other.negOffset + i, other.neg[i]);
+}
+
+// Layout: count, zeros, min, max, sum, then each store as offset, size and buckets
+void StreamStats::pack(std::vector<double> &buffer) const {
+  buffer.insert(buffer.end(), {(double)count, (double)zeros, min, max, sum});
+  for (auto store : {std::make_pair(&pos, posOffset), std::make_pair(&neg, negOffset)}) {
+    buffer.push_back(store.second);
+    buffer.push_back(store.first->size());
+    buffer.insert(buffer.end(), store.first->begin(), store.first->end());
+  }
+}
+
+void StreamStats::mergePacked(std::vector<double> const &buffer, long &position) {
+  StreamStats other(*this);
+  other.count = buffer[position++];
+  other.zeros = buffer[position++];
+  other.min = buffer[position++];
+  other.max = buffer[position++];
+  other.sum = buffer[position++];
+  for (auto store : {std::make_pair(&other.pos, &other.posOffset),
+                     std::make_pair(&other.neg, &other.negOffset)}) {
+    *store.second = buffer[position++];
+    long n = buffer[position++];
+    store.first->assign(buffer.begin() + position, buffer.begin() + position + n);
+    position += n;
+  }
+  merge(other);
+}
+
+long StreamStats::getCount() const { return count; }
+
+double StreamStats::getMin() const { return count > 0 ? min : 0; }
+
+double StreamStats::getMax() const { return count > 0 ? max : 0; }
+
+double StreamStats::getMean() const { return count > 0 ? sum / count : 0; }
+
+double StreamStats::quantile(double q) const {
+  if (count == 0)
+    return 0;
+  if (q <= 0)
+    return min;
+  if (q >= 1)
+    return max;
+
+  long rank = (long)(q * (count - 1)), seen = 0;
+  double v = 0;
+  bool found = false;
+
+  // Negative values, from the largest magnitude
+  for (long i = (long)neg.size() - 1; i >= 0 && !found; i--) {
+    seen += neg[i];
+    if (seen > rank) {
+      v = -value(negOffset + i);
+      found = true;
+    }
+  }
+
+  seen += zeros;
+  if (!found && seen > rank)
+    found = true;
+
+  for (long i = 0; i < pos.size() && !found; i++) {
+    seen += pos[i];
+    if (seen > rank) {
+      v = value(posOffset + i);
+      found = true;
+    }
+  }
+
+  return std::min(max, std::max(min, v));
+}
+
+std::vector<long> StreamStats::histogram(double lo, double hi,
+                                         int nbins) const {
+  std::vector<long> bins(nbins, 0);
+  if (nbins <= 0)
+    return bins;
+
+  auto addBin = [&](double x, long n) {
+    long b = hi > lo ? (long)std::floor((x - lo) / (hi - lo) * nbins) : 0;
+    bins[std::min((long)nbins - 1, std::max(0L, b))] += n;
+  };
+
+  for (long i = 0; i < neg.size(); i++)
+    if (neg[i] > 0)
+      addBin(-value(negOffset + i), neg[i]);
+  if (zeros > 0)
+    addBin(0, zeros);
+  for (long i = 0; i < pos.size(); i++)
+    if (pos[i] > 0)
+      addBin(value(posOffset + i), pos[i]);
+
+  return bins;
+}
+
+std::string StreamStats::toString() const {
+  std::ostringstream s;
+  s << "[Min: " << std::setw(11) << getMin() << " ] "
+    << "[Q1: " << std::setw(11) << quantile(0.25) << " ] "
+    << "[Q2: " << std::setw(11) << quantile(0.5) << " ] "
+    << "[Q3: " << std::setw(11) << quantile(0.75) << " ] "
+    << "[Max: " << std::setw(11) << getMax() << " ] ";
+  return s.str();
+}
@@ -0,0 +1,123 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef STREAMSTATS_H
+#define STREAMSTATS_H
+
+#include <string>
+#include <vector>
+
+/**
+   \brief Streaming statistics of a sequence of values: count, minimum, maximum, mean and
+   approximate quantiles.
+   Quantiles are estimated with a logarithmic histogram (as in DDSketch): a value x falls in
+   the bucket ceil(log(|x|) / log(gamma)), so the relative error of any quantile is bounded by
+   the accuracy given in the constructor, whatever the distribution of the values. Values
+   smaller than 1e-30 in magnitude are counted as zero. Two sketches with the same accuracy
+   can be merged, so each thread feeds its own sketch and they are merged at the end of the
+   parallel region.
+ */
+class StreamStats {
+
+ public:
+  /**
+     Class constructor.
+     \param accuracy Relative accuracy of the quantiles.
+   */
+  StreamStats(double accuracy = 0.01);
+
+  /**
+     Adds a value.
+     \param x Value.
+   */
+  void add(double x);
+
+  /**
+     Adds all the values of another sketch. Both must have the same accuracy.
+     \param other Sketch to merge.
+   */
+  void merge(StreamStats const& other);
+
+  /**
+     Appends the sketch to a buffer, to send it to another process.
+     \param buffer Buffer.
+   */
+  void pack(std::vector<double> &buffer) const;
+
+  /**
+     Adds all the values of a sketch packed with pack(). Both must have the same accuracy.
+     \param buffer Buffer.
+     \param position Position of the packed sketch in the buffer. Returns the position after it.
+   */
+  void mergePacked(std::vector<double> const& buffer, long &position);
+
+  /**
+     \return Number of values.
+   */
+  long getCount() const;
+
+  /**
+     \return Minimum value. Zero if there are no values.
+   */
+  double getMin() const;
+
+  /**
+     \return Maximum value. Zero if there are no values.
+   */
+  double getMax() const;
+
+  /**
+     \return Mean value. Zero if there are no values.
+   */
+  double getMean() const;
+
+  /**
+     Estimates a quantile.
+     \param q Quantile, between 0 and 1.
+     \return Value with a rank of q * (count - 1), within the relative accuracy.
+   */
+  double quantile(double q) const;
+
+  /**
+     Approximate histogram with equal width bins. The values of each bucket of the sketch are
+     assigned to the bin of the bucket center.
+     \param lo Lower limit of the first bin.
+     \param hi Upper limit of the last bin.
+     \param nbins Number of bins.
+     \return Number of values in each bin. Values out of [lo, hi] are added to the first or last bin.
+   */
+  std::vector<long> histogram(double lo, double hi, int nbins) const;
+
+  /**
+     \return The minimum, maximum and Q1, Q2 and Q3 quartiles as text.
+   */
+  std::string toString() const;
+
+ private:
+  double gamma, logGamma;
+  long count, zeros;
+  double min, max, sum;
+
+  // Buckets of positive and negative values. Bucket i of a store is offset + i.
+  std::vector<long> pos, neg;
+  int posOffset, negOffset;
+
+  int index(double x) const;
+  double value(int index) const;
+  static void addTo(std::vector<long> &store, int &offset, int index, long n);
+};
+
+#endif
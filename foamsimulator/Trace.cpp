@@ -0,0 +1,128 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "Trace.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <omp.h>
+
+namespace trace {
+
+  bool active = false;
+
+  namespace {
+
+    struct event {
+      char name[32];
+      clock::time_point start, end;
+      long first, last;
+    };
+
+    // Ring buffer written only by its owner thread
+    struct buffer {
+      int tid;        // Registration order
+      int ompThread;  // OpenMP thread number when registered
+      long next;      // Total number of events recorded
+      std::vector<event> events;
+    };
+
+    long bufferCapacity = 1 << 16;
+    clock::time_point epoch = clock::now();
+
+    std::mutex registryMutex;
+    std::vector<std::unique_ptr<buffer>> registry;
+
+    thread_local buffer * local = nullptr;
+
+    // Creates the buffer of the calling thread. Only the first span of each thread takes the lock.
+    buffer * threadBuffer() {
+      if (local == nullptr) {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	registry.emplace_back(new buffer);
+	local = registry.back().get();
+	local->tid = registry.size() - 1;
+	local->ompThread = omp_get_thread_num();
+	local->next = 0;
+	local->events.resize(bufferCapacity);
+      }
+      return local;
+    }
+
+    double micros(clock::time_point t) {
+      return std::chrono::duration<double, std::micro>(t - epoch).count();
+    }
+  }
+
+  void enable(long capacity) {
+    bufferCapacity = capacity > 0 ? capacity : 1;
+    epoch = clock::now();
+    active = true;
+  }
+
+  void record(const char *name, clock::time_point start, clock::time_point end,
+	      long first, long last) {
+    buffer *b = threadBuffer();
+    event &e = b->events[b->next % b->events.size()];
+    std::strncpy(e.name, name, sizeof(e.name) - 1);
+    e.name[sizeof(e.name) - 1] = '\0';
+    e.start = start;
+    e.end = end;
+    e.first = first;
+    e.last = last;
+    b->next++;
+  }
+
+  bool write(std::string const &fileName) {
+    std::ofstream out(fileName, std::ios::trunc);
+    if (!out.is_open())
+      return false;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool firstEvent = true;
+    for (auto &b : registry) {
+      out << (firstEvent ? "" : ",\n")
+	  << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << b->tid
+	  << ", \"args\": {\"name\": \"thread " << b->tid
+	  << " (omp " << b->ompThread << ")\"}}";
+      firstEvent = false;
+
+      long n = b->events.size(),
+	begin = b->next > n ? b->next - n : 0;
+      for (long i = begin; i < b->next; i++) {
+	event &e = b->events[i % n];
+	out << ",\n{\"name\": \"" << e.name << "\", \"cat\": \"foam\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+	    << b->tid << ", \"ts\": " << micros(e.start)
+	    << ", \"dur\": " << std::chrono::duration<double, std::micro>(e.end - e.start).count();
+	if (e.first >= 0)
+	  out << ", \"args\": {\"first\": " << e.first << ", \"last\": " << e.last << "}";
+	out << "}";
+      }
+      if (begin > 0)
+	std::cerr << "WARNING: trace buffer of thread " << b->tid << " overflowed, "
+		  << begin << " spans were lost." << std::endl;
+    }
+    out << "\n]}\n";
+    return out.good();
+  }
+}
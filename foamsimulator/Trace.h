@@ -0,0 +1,138 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <string>
+
+/**
+   \brief This namespace implements a per-thread timeline recorder.
+   Each thread that records a span gets its own ring buffer, so recording does not need
+   any lock: when a buffer is full the oldest spans are overwritten. The spans of all the
+   threads are dumped in the Chrome trace event format, that can be opened with Perfetto
+   (https://ui.perfetto.dev) or chrome://tracing.
+   When tracing is disabled, recording a span only costs a test of a global flag.
+ */
+namespace trace {
+
+  typedef std::chrono::steady_clock clock;
+
+  /**
+     Global switch. Use enable() to change it.
+   */
+  extern bool active;
+
+  /**
+     Enables the recording of spans.
+     \param capacity Maximum number of spans stored for each thread.
+   */
+  void enable(long capacity);
+
+  /**
+     \return True if tracing is enabled.
+   */
+  inline bool enabled() { return active; }
+
+  /**
+     Records a finished span in the buffer of the calling thread.
+     \param name Span name. It is truncated to 31 characters.
+     \param start Start time.
+     \param end End time.
+     \param first First iteration of the span, or -1 if it does not apply.
+     \param last Last iteration of the span, or -1 if it does not apply.
+   */
+  void record(const char * name, clock::time_point start, clock::time_point end,
+	      long first = -1, long last = -1);
+
+  /**
+     Writes all the recorded spans to a Chrome trace JSON file.
+     Must not be called while other threads are recording.
+     \param fileName File name.
+     \return True if the file was correctly written.
+   */
+  bool write(std::string const& fileName);
+
+  /**
+     \brief Records a span from its construction to its destruction.
+   */
+  class Span {
+   public:
+    /**
+       Opens the span.
+       \param name Span name.
+     */
+    Span(const char * name) : name(name) {
+      if (active)
+	start = clock::now();
+    }
+
+    ~Span() {
+      if (active)
+	record(name, start, clock::now());
+    }
+
+   private:
+    const char * name;
+    clock::time_point start;
+  };
+
+  /**
+     \brief Records the chunks of iterations that a thread executes in a worksharing loop.
+     An object must be created by each thread inside the parallel region and iteration()
+     called at the beginning of every iteration. Consecutive iterations are merged into a
+     single span, so each chunk handed by the OpenMP scheduler becomes a span.
+   */
+  class ChunkSpan {
+   public:
+    /**
+       Class constructor.
+       \param name Span name.
+     */
+    ChunkSpan(const char * name) : name(name), first(-1), last(-1) {}
+
+    /**
+       Notifies the start of an iteration.
+       \param i Iteration number.
+     */
+    inline void iteration(long i) {
+      if (!active)
+	return;
+      if (i != last + 1 || first < 0) {
+	close();
+	first = i;
+	start = clock::now();
+      }
+      last = i;
+    }
+
+    ~ChunkSpan() { close(); }
+
+   private:
+    const char * name;
+    long first, last;
+    clock::time_point start;
+
+    void close() {
+      if (first >= 0)
+	record(name, start, clock::now(), first, last);
+      first = -1;
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,64 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "VelocityGrid.h"
+
+VelocityGrid::VelocityGrid() : origin{{0, 0, 0}}, dx(1), r(1), nx(0), ny(0), nz(0), z0(0) {}
+
+std::array<double, 4> const *VelocityGrid::node(long a, long b, long c) const {
+  long x = a / r, y = b / r, z = c / r - z0;
+  if (a < 0 || b < 0 || c < 0 || x >= nx || y >= ny || z < 0 || z >= nz)
+    return nullptr;
+  long block = blockOf[x + nx * (y + ny * z)];
+  if (block < 0)
+    return nullptr;
+  return &nodes[block * r * r * r + a % r + r * (b % r + r * (c % r))];
+}
+
+bool VelocityGrid::locate(std::array<double, 3> const &pos, long a[3], double t[3]) const {
+  for (int d = 0; d < 3; d++) {
+    double u = (pos[d] - origin[d]) / dx;
+    if (!(u >= 0 && u < 1e15)) // Out of the grid, or not a number
+      return false;
+    a[d] = (long)u;
+    t[d] = u - a[d];
+  }
+  return true;
+}
+
+double VelocityGrid::sample(std::array<double, 3> const &pos, std::array<double, 3> &num) const {
+  num = {{0, 0, 0}};
+  long a[3];
+  double t[3];
+  if (!locate(pos, a, t))
+    return 0;
+
+  // Trilinear interpolation of the eight nodes around
+  double den = 0;
+  for (int corner = 0; corner < 8; corner++) {
+    int i = corner & 1, j = corner >> 1 & 1, k = corner >> 2;
+    auto n = node(a[0] + i, a[1] + j, a[2] + k);
+    if (n == nullptr)
+      continue;
+    double w = (i ? t[0] : 1 - t[0]) * (j ? t[1] : 1 - t[1]) * (k ? t[2] : 1 - t[2]);
+    num = {{num[0] + w * (*n)[0], num[1] + w * (*n)[1], num[2] + w * (*n)[2]}};
+    den += w * (*n)[3];
+  }
+  return den;
+}
+
+long VelocityGrid::getNodes() const { return nodes.size(); }
@@ -0,0 +1,187 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef VELOCITYGRID_H
+#define VELOCITYGRID_H
+
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include "BucketContainer.h"
+#include "FluidData.h"
+
+/**
+   \brief Velocity of the fluid rasterized onto a grid, so that the diffuse particles can sample
+   it instead of visiting the fluid particles around them.
+   The nodes are spaced h / resolution, and each one stores the SPH sums of the fluid velocity
+   weighted by the kernel and of the kernel, over all the fluid particles within the support
+   (2h). A position is sampled interpolating both sums trilinearly, so that their ratio is the
+   kernel-weighted average velocity of the fluid around it.
+   The grid is sparse: the nodes are stored in blocks of the cells, only for the cells where
+   some position is going to be sampled. The fluid particles within two cells of them are
+   scattered to the nodes in 125 rounds of cells five cells apart, so that the nodes are written
+   by one thread at a time and each one adds up the same particles in the same order with any
+   number of threads.
+ */
+class VelocityGrid {
+
+ public:
+  /**
+     Class constructor. Creates an empty grid.
+   */
+  VelocityGrid();
+
+  /**
+     Rasterizes the velocity of the fluid particles around some positions.
+     \param f Fluid particles. Only the stored layers are rasterized.
+     \param origin Minimum coordinates of the domain.
+     \param h Cell size.
+     \param resolution Nodes per cell edge.
+     \param kernel Smoothing kernel, called as kernel(xij, h).
+     \param npos Number of positions that are going to be sampled.
+     \param position Function that returns each of those positions.
+   */
+  template <class K, class P>
+  void build(BucketContainer<particle> &f, std::array<double,3> const& origin, double h,
+             int resolution, K kernel, long npos, P position);
+
+  /**
+     Samples the rasterized sums at a position.
+     \param pos Position.
+     \param num Receives the sum of the fluid velocities weighted by the kernel.
+     \return Sum of the kernel. Zero if there is no fluid around.
+   */
+  double sample(std::array<double,3> const& pos, std::array<double,3> &num) const;
+
+  /**
+     \return Number of stored nodes.
+   */
+  long getNodes() const;
+
+ private:
+  std::array<double,3> origin;
+  double dx;                  // Node spacing
+  int r;                      // Nodes per cell edge
+  long nx, ny, nz, z0;        // Stored cells
+  std::vector<long> blockOf;  // Block of nodes of each stored cell, -1 if it is not sampled
+  std::vector<std::array<double,4>> nodes; // Weighted velocity and kernel sums, r^3 nodes per block
+
+  /**
+     \return Node coordinates of a position, and its offset from them in node spacings.
+   */
+  bool locate(std::array<double,3> const& pos, long a[3], double t[3]) const;
+
+  /**
+     \return Sums of a node, given its coordinates. Null if it is not stored.
+   */
+  std::array<double,4> const * node(long a, long b, long c) const;
+};
+
+template <class K, class P>
+void VelocityGrid::build(BucketContainer<particle> &f, std::array<double,3> const& origin,
+                         double h, int resolution, K kernel, long npos, P position) {
+  auto dims = f.getDimensions();
+  this->origin = origin;
+  r = std::max(resolution, 1);
+  dx = h / r;
+  nx = dims[0];
+  ny = dims[1];
+  z0 = f.getFirstLayer();
+  nz = f.getLastLayer() - z0;
+  auto &buckets = f.getNoEmptyBuckets();
+
+  // Cells of the nodes around each position
+  blockOf.assign(nx * ny * nz, -1);
+  for (long k = 0; k < npos; k++) {
+    long a[3];
+    double t[3];
+    if (!locate(position(k), a, t))
+      continue;
+    for (int corner = 0; corner < 8; corner++) {
+      long x = (a[0] + (corner & 1)) / r, y = (a[1] + (corner >> 1 & 1)) / r,
+           z = (a[2] + (corner >> 2)) / r - z0;
+      if (x < nx && y < ny && z >= 0 && z < nz)
+        blockOf[x + nx * (y + ny * z)] = 0;
+    }
+  }
+  long nblocks = 0;
+  for (auto &b : blockOf)
+    if (b == 0)
+      b = nblocks++;
+  nodes.assign(nblocks * r * r * r, std::array<double,4>{{0, 0, 0, 0}});
+
+  // Cells with fluid within two cells of a sampled one, in the rounds of the scatter
+  std::vector<std::vector<long>> rounds(125);
+  for (long nebucket = 0; nebucket < buckets.size(); nebucket++) {
+    auto c = f.getBucketCoords(buckets[nebucket].first);
+    bool near = false;
+    for (long z = std::max(c[2] - z0 - 2, 0L); z <= std::min(c[2] - z0 + 2, nz - 1) && !near; z++)
+      for (long y = std::max(c[1] - 2, 0L); y <= std::min(c[1] + 2, ny - 1) && !near; y++)
+        for (long x = std::max(c[0] - 2, 0L); x <= std::min(c[0] + 2, nx - 1) && !near; x++)
+          near = blockOf[x + nx * (y + ny * z)] >= 0;
+    if (near)
+      rounds[c[0] % 5 + 5 * (c[1] % 5) + 25 * ((c[2] - z0) % 5)].push_back(nebucket);
+  }
+
+  for (auto &round : rounds) {
+#pragma omp parallel for schedule(dynamic)
+    for (long k = 0; k < round.size(); k++) {
+      auto &bucket = buckets[round[k]];
+      auto c = f.getBucketCoords(bucket.first);
+      for (auto &pj : bucket.second) {
+        // Nodes within the support, in the cells up to two away
+        long lo[3], hi[3];
+        for (int d = 0; d < 3; d++) {
+          lo[d] = std::max((long)std::ceil((pj.pos[d] - 2 * h - origin[d]) / dx), (c[d] - 2) * r);
+          hi[d] = std::min((long)std::floor((pj.pos[d] + 2 * h - origin[d]) / dx), (c[d] + 3) * r - 1);
+        }
+        // Squared distance along an axis from the particle to the nodes of a cell in the range
+        auto gap = [&](int d, long cell) {
+          double first = origin[d] + std::max(lo[d], cell * r) * dx,
+                 last = origin[d] + std::min(hi[d], cell * r + r - 1) * dx,
+                 g = std::max(std::max(first - pj.pos[d], pj.pos[d] - last), 0.);
+          return g * g;
+        };
+
+        // Blocks of the sampled cells within the support, and the nodes of each one in the range
+        for (long z = std::max(c[2] - 2, z0); z <= std::min(c[2] + 2, z0 + nz - 1); z++)
+          for (long y = std::max(c[1] - 2, 0L); y <= std::min(c[1] + 2, ny - 1); y++)
+            for (long x = std::max(c[0] - 2, 0L); x <= std::min(c[0] + 2, nx - 1); x++) {
+              long block = blockOf[x + nx * (y + ny * (z - z0))];
+              if (block < 0 || gap(0, x) + gap(1, y) + gap(2, z) > 4 * h * h)
+                continue;
+              std::array<double,4> *blk = &nodes[block * r * r * r];
+              for (long cz = std::max(lo[2], z * r); cz <= std::min(hi[2], z * r + r - 1); cz++)
+                for (long b = std::max(lo[1], y * r); b <= std::min(hi[1], y * r + r - 1); b++)
+                  for (long a = std::max(lo[0], x * r); a <= std::min(hi[0], x * r + r - 1); a++) {
+                    std::array<double,3> xij{{origin[0] + a * dx - pj.pos[0],
+                                              origin[1] + b * dx - pj.pos[1],
+                                              origin[2] + cz * dx - pj.pos[2]}};
+                    if (xij[0] * xij[0] + xij[1] * xij[1] + xij[2] * xij[2] > 4 * h * h)
+                      continue; // Out of the support
+                    double w = kernel(xij, h);
+                    std::array<double,4> &n = blk[a - x * r + r * (b - y * r + r * (cz - z * r))];
+                    n = {{n[0] + pj.vel[0] * w, n[1] + pj.vel[1] * w, n[2] + pj.vel[2] * w, n[3] + w}};
+                  }
+            }
+      }
+    }
+  }
+}
+
+#endif
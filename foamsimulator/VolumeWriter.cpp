@@ -0,0 +1,126 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+
+#include "VolumeWriter.h"
+
+VolumeWriter::VolumeWriter(std::string const &name, std::array<double, 3> const &origin,
+                           double voxelSize)
+    : fileName(name), origin(origin), voxelSize(voxelSize) {}
+
+void VolumeWriter::add(int grid, long x, long y, long z, float w) {
+  unsigned long long key = (unsigned long long)(x >> 3) | (unsigned long long)(y >> 3) << 21 |
+                           (unsigned long long)(z >> 3) << 42;
+  auto it = blockOf[grid].find(key);
+  long b;
+  if (it != blockOf[grid].end()) {
+    b = it->second;
+  } else {
+    b = blocks[grid].size();
+    blockOf[grid][key] = b;
+    blocks[grid].emplace_back();
+    blocks[grid].back().fill(0);
+    corners[grid].push_back({{(int)(x & ~7L), (int)(y & ~7L), (int)(z & ~7L)}});
+  }
+  blocks[grid][b][(x & 7) << 6 | (y & 7) << 3 | (z & 7)] += w;
+}
+
+void VolumeWriter::setData(std::vector<std::array<double, 3>> const *d,
+                           std::vector<double> const *density, double spray, double bubbles) {
+  for (long i = 0; i < d->size(); i++) {
+    double den = (*density)[i];
+    int grid = den < spray ? 0 : (den > bubbles ? 2 : 1);
+
+    // Voxel below the particle, and its offset from it in voxels
+    long a[3];
+    double t[3];
+    bool inside = true;
+    for (int c = 0; c < 3; c++) {
+      double u = ((*d)[i][c] - origin[c]) / voxelSize;
+      if (!(u >= 0 && u < (1 << 20))) { // Out of the domain, or not a number
+        inside = false;
+        break;
+      }
+      a[c] = (long)u;
+      t[c] = u - a[c];
+    }
+    if (!inside)
+      continue;
+
+    for (int corner = 0; corner < 8; corner++) {
+      int x = corner & 1, y = corner >> 1 & 1, z = corner >> 2;
+      double w = (x ? t[0] : 1 - t[0]) * (y ? t[1] : 1 - t[1]) * (z ? t[2] : 1 - t[2]);
+      if (w > 0)
+        add(grid, a[0] + x, a[1] + y, a[2] + z, w);
+    }
+  }
+}
+
+int VolumeWriter::write() {
+  std::ofstream out(fileName, std::ios::binary | std::ios::trunc);
+  if (!out)
+    return 0;
+
+  static const char *names[3] = {"spray", "foam", "bubbles"};
+  int32_t ngrids = 3, padding = 0;
+  out.write("VSPHFV01", 8);
+  out.write((char const *)origin.data(), 3 * sizeof(double));
+  out.write((char const *)&voxelSize, sizeof(double));
+  out.write((char const *)&ngrids, sizeof(ngrids));
+  out.write((char const *)&padding, sizeof(padding));
+
+  for (int g = 0; g < 3; g++) {
+    char name[16] = {0};
+    std::strncpy(name, names[g], sizeof(name) - 1);
+    int64_t nblocks = blocks[g].size();
+    out.write(name, sizeof(name));
+    out.write((char const *)&nblocks, sizeof(nblocks));
+
+    // Sorted by their coordinates, like the leaf nodes of OpenVDB
+    std::vector<long> order(nblocks);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(),
+              [this, g](long a, long b) { return corners[g][a] < corners[g][b]; });
+
+    std::vector<float> values;
+    for (long b : order) {
+      auto &block = blocks[g][b];
+      uint64_t mask[8] = {0};
+      values.clear();
+      for (int n = 0; n < 512; n++) {
+        if (block[n] != 0) {
+          mask[n >> 6] |= (uint64_t)1 << (n & 63);
+          values.push_back(block[n]);
+        }
+      }
+      out.write((char const *)corners[g][b].data(), 3 * sizeof(int32_t));
+      out.write((char const *)mask, sizeof(mask));
+      out.write((char const *)values.data(), values.size() * sizeof(float));
+    }
+  }
+
+  return out.good() ? 1 : 0;
+}
+
+long VolumeWriter::getBlocks() const {
+  return blocks[0].size() + blocks[1].size() + blocks[2].size();
+}
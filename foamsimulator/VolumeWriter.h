@@ -0,0 +1,92 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef VOLUMEWRITER_H
+#define VOLUMEWRITER_H
+
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "FileWriter.h"
+
+/**
+   \brief Writes the diffuse particles as sparse density volumes, one per class (spray, foam and
+   bubbles), for volumetric rendering.
+   Each particle is splatted with trilinear weights into the eight voxels around it, so that the
+   value of a voxel is the number of particles around its centre. The voxels are stored in blocks
+   of 8x8x8 with the layout of the OpenVDB leaf nodes: only the blocks with some particle are
+   written, and only the active voxels of each one.
+
+   File format (little endian):
+   - Header: "VSPHFV01", centre of the voxel (0, 0, 0) (3 doubles), voxel size (double) and
+     number of grids (int32), followed by four bytes of padding.
+   - For each grid: its name (16 chars, zero padded) and its number of blocks (int64).
+   - For each block, sorted by x, y and z: the coordinates of its first voxel (3 int32, multiples
+     of 8), the mask of active voxels (8 uint64, bit x * 64 + y * 8 + z) and the values of the
+     active voxels in that order (floats).
+ */
+class VolumeWriter : public FileWriter {
+
+ public:
+  /**
+     Class constructor.
+     \param name File name to write.
+     \param origin Centre of the voxel (0, 0, 0): the minimum coordinates of the domain.
+     \param voxelSize Edge of the voxels.
+   */
+  VolumeWriter(std::string const& name, std::array<double,3> const& origin, double voxelSize);
+
+  /**
+     Splats the diffuse particles into the volume of their class.
+     \param d Position vectors.
+     \param density Density of the fluid around each particle, which gives its class.
+     \param spray Maximum density of spray particles.
+     \param bubbles Minimum density of bubble particles.
+   */
+  void setData(std::vector<std::array<double,3>> const *d, std::vector<double> const *density,
+               double spray, double bubbles);
+
+  /**
+     Dumps the volumes to the file.
+     \return Zero if it fails. Any other value otherwise.
+   */
+  virtual int write();
+
+  /**
+     \return Number of blocks of all the volumes.
+   */
+  long getBlocks() const;
+
+ private:
+  std::string fileName;
+  std::array<double,3> origin;
+  double voxelSize;
+
+  // Blocks of each class, the coordinates of their first voxel and the block of each coordinates
+  std::array<std::vector<std::array<float,512>>,3> blocks;
+  std::array<std::vector<std::array<int,3>>,3> corners;
+  std::array<std::unordered_map<unsigned long long,long>,3> blockOf;
+
+  /**
+     Adds a weight to a voxel of a volume, creating its block if needed.
+   */
+  void add(int grid, long x, long y, long z, float w);
+};
+
+#endif
@@ -0,0 +1,309 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#define _USE_MATH_DEFINES
+
+#include "CaseGenerator.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+
+#define _SILENCE_EXPERIMENTAL_FILESYSTEM_DEPRECATION_WARNING
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+
+#include <vtkCellArray.h>
+#include <vtkFloatArray.h>
+#include <vtkPointData.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkPolyDataWriter.h>
+#include <vtkSmartPointer.h>
+#include <vtkUnsignedIntArray.h>
+
+#define GRAVITY 9.81
+#define RHOP0 1000.
+
+CaseGenerator::CaseGenerator(Type type, long nparticles, unsigned seed)
+    : type(type), seed(seed) {
+  double fluidLength;
+
+  switch (type) {
+  case DAM_BREAK:
+    sc.name = "dambreak";
+    tank = {{3.2, 0.6, 1.0}};
+    depth = 0.6;
+    fluidLength = 1.2; // Water column
+    sc.timeOut = 0.02;
+    break;
+  case BREAKING_WAVE:
+    sc.name = "wave";
+    tank = {{4.0, 0.5, 0.8}};
+    depth = 0.4;
+    fluidLength = tank[0];
+    sc.timeOut = 0.02;
+    break;
+  default:
+    sc.name = "sloshing";
+    tank = {{1.0, 0.4, 0.6}};
+    depth = 0.25;
+    fluidLength = tank[0];
+    sc.timeOut = 0.01;
+  }
+
+  // Spacing that gives the requested number of particles at rest
+  sc.dp = std::cbrt(fluidLength * tank[1] * depth / std::max(nparticles, 1L));
+  sc.h = 1.2 * std::sqrt(3. * sc.dp * sc.dp); // coefh = 1.2, as usual in DualSPHysics
+  sc.mass = RHOP0 * sc.dp * sc.dp * sc.dp;
+  sc.pointMin = {{-0.05, -0.05, -0.05}};
+  sc.pointMax = {{tank[0] + 0.05, tank[1] + 0.05, tank[2] + 0.3}};
+}
+
+bool CaseGenerator::parseType(std::string const &name, Type &type) {
+  if (name == "dambreak")
+    type = DAM_BREAK;
+  else if (name == "wave")
+    type = BREAKING_WAVE;
+  else if (name == "sloshing")
+    type = SLOSHING;
+  else
+    return false;
+  return true;
+}
+
+SyntheticCase const &CaseGenerator::getCase() const { return sc; }
+
+SimulationParams CaseGenerator::getSimulationParams(std::string const &dataPath,
+                                                    int nsteps) const {
+  SimulationParams sp;
+  sp.dataPath = dataPath;
+  sp.filePrefix = "PartFluid_";
+  sp.outputPath = (fs::path(dataPath) / "out").generic_string();
+  sp.outputPreffix = "Diffuse_";
+  sp.exclusionZoneFile = "";
+  sp.nstart = 0;
+  sp.nend = nsteps - 1;
+  sp.nzeros = 4;
+  sp.text_files = 0;
+  sp.vtk_files = 0;
+  sp.vtk_diffuse_data = 0;
+  sp.vtk_fluid_data = 0;
+  sp.h = sc.h;
+  sp.mass = sc.mass;
+  sp.TIMESTEP = sc.timeOut;
+  sp.MINX = sc.pointMin[0];
+  sp.MINY = sc.pointMin[1];
+  sp.MINZ = sc.pointMin[2];
+  sp.MAXX = sc.pointMax[0];
+  sp.MAXY = sc.pointMax[1];
+  sp.MAXZ = sc.pointMax[2];
+  sp.MINTA = 0.5;
+  sp.MAXTA = 4.;
+  sp.MINWC = 0.1;
+  sp.MAXWC = 1.;
+  sp.MINK = 0.5 * sc.mass * 0.1 * 0.1; // Particles faster than 0.1 m/s
+  sp.MAXK = 0.5 * sc.mass * 2. * 2.;   // Saturated above 2 m/s
+  sp.KTA = 200.;
+  sp.KWC = 200.;
+  sp.SPRAY = 6.;
+  sp.BUBBLES = 9.;
+  sp.LIFEFIME = 10.;
+  sp.KB = 0.8;
+  sp.KD = 0.5;
+  return sp;
+}
+
+double CaseGenerator::flow(double x, double z, double t,
+                           std::array<double, 3> &vel) const {
+  vel = {{0, 0, 0}};
+
+  if (type == DAM_BREAK) {
+    // Ritter solution with the gate at the end of the column
+    double c0 = std::sqrt(GRAVITY * depth), xg = x - 1.2;
+    if (t <= 0 || xg <= -c0 * t)
+      return xg <= 0 ? depth : 0;
+    if (xg >= 2 * c0 * t)
+      return 0;
+    double e = 2 * c0 - xg / t;
+    vel[0] = 2. / 3. * (xg / t + c0);
+    // Vertical velocity of the falling column, zero at the bottom
+    vel[2] = -(vel[0] / 3.) * (z / depth);
+    return e * e / (9 * GRAVITY);
+  }
+
+  double k, omega, amp;
+
+  if (type == BREAKING_WAVE) {
+    // Stokes wave shoaling along the flume
+    k = 2 * M_PI / 1.5;
+    omega = std::sqrt(GRAVITY * k * std::tanh(k * depth));
+    amp = 0.04 + 0.04 * x / tank[0];
+    double theta = k * x - omega * t,
+           eta = depth + amp * std::cos(theta) +
+                 0.5 * k * amp * amp * std::cos(2 * theta),
+           s = std::sinh(k * depth);
+    vel[0] = amp * omega * std::cosh(k * z) / s * std::cos(theta);
+    vel[2] = amp * omega * std::sinh(k * z) / s * std::sin(theta);
+
+    // Plunging jet at the steep crests: the top of the crest travels at the phase speed
+    if (k * amp > 0.3 && std::cos(theta) > 0.8 && z > depth + 0.5 * amp)
+      vel[0] = std::max(vel[0], 1.2 * omega / k);
+    return eta;
+  }
+
+  // First sloshing mode
+  k = M_PI / tank[0];
+  omega = std::sqrt(GRAVITY * k * std::tanh(k * depth));
+  amp = 0.06;
+  double s = std::sinh(k * depth);
+  vel[0] = -amp * omega * std::sin(k * x) * std::cosh(k * z) / s * std::cos(omega * t);
+  vel[2] = amp * omega * std::cos(k * x) * std::sinh(k * z) / s * std::cos(omega * t);
+  return depth + amp * std::cos(k * x) * std::sin(omega * t);
+}
+
+std::vector<sparticle> CaseGenerator::generate(int n) const {
+  std::mt19937 gen(seed + n);
+  std::uniform_real_distribution<float> jitter(-0.05 * sc.dp, 0.05 * sc.dp),
+      noise(-0.1, 0.1);
+
+  double t = n * sc.timeOut,
+         c2 = 100 * GRAVITY * depth; // Speed of sound as in DualSPHysics: 10 * sqrt(g * H)
+  long nx = tank[0] / sc.dp, ny = tank[1] / sc.dp, nz = tank[2] / sc.dp;
+
+  std::vector<sparticle> particles;
+  std::array<double, 3> vel;
+
+  for (long k = 0; k < nz; k++) {
+    double z = (k + 0.5) * sc.dp;
+    for (long j = 0; j < ny; j++) {
+      double y = (j + 0.5) * sc.dp;
+      for (long i = 0; i < nx; i++) {
+        double x = (i + 0.5) * sc.dp, eta = flow(x, z, t, vel);
+        if (z >= eta)
+          continue;
+
+        sparticle p;
+        p.idp = i + nx * (j + ny * k);
+        p.pos = {{float(x + jitter(gen)), float(y + jitter(gen)), float(z + jitter(gen))}};
+        p.vel = {{float(vel[0]), float(vel[1]) + 0.01f * noise(gen), float(vel[2])}};
+        p.rhop = RHOP0 * (1 + GRAVITY * (eta - z) / c2) + noise(gen);
+        particles.push_back(p);
+      }
+    }
+  }
+  return particles;
+}
+
+long CaseGenerator::writeStep(std::string const &fileName, int n) const {
+  auto particles = generate(n);
+
+  vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+  points->SetDataTypeToFloat();
+  points->SetNumberOfPoints(particles.size());
+
+  vtkSmartPointer<vtkFloatArray> vel = vtkSmartPointer<vtkFloatArray>::New();
+  vel->SetName("Vel");
+  vel->SetNumberOfComponents(3);
+  vel->SetNumberOfTuples(particles.size());
+
+  vtkSmartPointer<vtkFloatArray> rhop = vtkSmartPointer<vtkFloatArray>::New();
+  rhop->SetName("Rhop");
+  rhop->SetNumberOfTuples(particles.size());
+
+  vtkSmartPointer<vtkUnsignedIntArray> idp =
+      vtkSmartPointer<vtkUnsignedIntArray>::New();
+  idp->SetName("Idp");
+  idp->SetNumberOfTuples(particles.size());
+
+  vtkSmartPointer<vtkCellArray> vertices = vtkSmartPointer<vtkCellArray>::New();
+
+  for (long i = 0; i < particles.size(); i++) {
+    auto &p = particles[i];
+    points->SetPoint(i, p.pos[0], p.pos[1], p.pos[2]);
+    vel->SetTuple3(i, p.vel[0], p.vel[1], p.vel[2]);
+    rhop->SetTuple1(i, p.rhop);
+    idp->SetTuple1(i, p.idp);
+    vtkIdType pt[] = {i};
+    vertices->InsertNextCell(1, pt);
+  }
+
+  vtkSmartPointer<vtkPolyData> polydata = vtkSmartPointer<vtkPolyData>::New();
+  polydata->SetPoints(points);
+  polydata->SetVerts(vertices);
+  polydata->GetPointData()->AddArray(idp);
+  polydata->GetPointData()->AddArray(vel);
+  polydata->GetPointData()->AddArray(rhop);
+
+  vtkSmartPointer<vtkPolyDataWriter> writer =
+      vtkSmartPointer<vtkPolyDataWriter>::New();
+  writer->SetFileTypeToBinary();
+  writer->SetFileName(fileName.c_str());
+  writer->SetInputData(polydata);
+  if (!writer->Write())
+    return -1;
+
+  return particles.size();
+}
+
+bool CaseGenerator::writeXml(std::string const &fileName) const {
+  std::ofstream xml(fileName, std::ios::trunc);
+  xml << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n"
+      << "<!-- Synthetic case \"" << sc.name << "\" generated by foam_casegen -->\n"
+      << "<case>\n"
+      << "  <casedef>\n"
+      << "    <geometry>\n"
+      << "      <definition dp=\"" << sc.dp << "\">\n"
+      << "        <pointmin x=\"" << sc.pointMin[0] << "\" y=\"" << sc.pointMin[1]
+      << "\" z=\"" << sc.pointMin[2] << "\" />\n"
+      << "        <pointmax x=\"" << sc.pointMax[0] << "\" y=\"" << sc.pointMax[1]
+      << "\" z=\"" << sc.pointMax[2] << "\" />\n"
+      << "      </definition>\n"
+      << "    </geometry>\n"
+      << "  </casedef>\n"
+      << "  <execution>\n"
+      << "    <constants>\n"
+      << "      <h value=\"" << sc.h << "\" />\n"
+      << "      <massfluid value=\"" << sc.mass << "\" />\n"
+      << "    </constants>\n"
+      << "    <parameters>\n"
+      << "      <parameter key=\"TimeOut\" value=\"" << sc.timeOut << "\" />\n"
+      << "    </parameters>\n"
+      << "  </execution>\n"
+      << "</case>\n";
+  return xml.good();
+}
+
+long CaseGenerator::writeSequence(std::string const &path,
+                                  std::string const &prefix, int nzeros,
+                                  int nstart, int nend) const {
+  std::string seqnum(nzeros, '0'),
+      formats = std::string("%.") + std::to_string(nzeros) + std::string("d");
+  long total = 0;
+
+  fs::create_directories(path);
+
+  for (int n = nstart; n <= nend; n++) {
+    std::sprintf(&seqnum[0], formats.c_str(), n);
+    std::string fileName = (fs::path(path) / (prefix + seqnum + ".vtk")).generic_string();
+    long np = writeStep(fileName, n);
+    if (np < 0)
+      return -1;
+    total += np;
+  }
+  return total;
+}
@@ -0,0 +1,151 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CASEGENERATOR_H
+#define CASEGENERATOR_H
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "SimulationParams.h"
+
+/**
+   This structure stores a fluid particle of a synthetic case.
+ */
+struct sparticle {
+  unsigned idp;               ///< Stable particle index, as Idp in DualSPHysics.
+  std::array<float,3> pos;    ///< Position.
+  std::array<float,3> vel;    ///< Velocity.
+  float rhop;                 ///< Density.
+};
+
+/**
+   This structure stores the constants of a synthetic case, as they appear in a DualSPHysics XML file.
+ */
+struct SyntheticCase {
+  std::string name;               ///< Case name.
+  double dp,                      ///< Distance between particles.
+    h,                            ///< Smoothing length.
+    mass,                         ///< Mass of each fluid particle.
+    timeOut;                      ///< Time between output steps.
+  std::array<double,3> pointMin,  ///< Domain limits: minimum.
+    pointMax;                     ///< Domain limits: maximum.
+};
+
+/**
+   \brief Generates synthetic DualSPHysics fluid output to benchmark the foam simulator.
+   Particles are placed on a lattice of spacing dp below an analytic free surface, with velocities
+   from a simple flow model and a hydrostatic density. Three cases are available:
+   - Dam break: Ritter solution for the collapse of a water column.
+   - Breaking wave: second order Stokes wave that steepens along a flume, with a plunging jet at the crests.
+   - Sloshing: first mode standing wave in a rectangular tank.
+   Each particle keeps the index of its lattice node as Idp and is jittered randomly at every step,
+   so it moves less than dp between consecutive steps. The results are plausible, not physical.
+ */
+class CaseGenerator {
+
+ public:
+  /**
+     Available cases.
+   */
+  enum Type { DAM_BREAK, BREAKING_WAVE, SLOSHING };
+
+  /**
+     Class constructor. The particle spacing is chosen to reach the given number of particles at the first step.
+     \param type Case type.
+     \param nparticles Approximate number of fluid particles.
+     \param seed Seed of the random jitter.
+   */
+  CaseGenerator(Type type, long nparticles, unsigned seed = 1);
+
+  /**
+     Parses a case name: "dambreak", "wave" or "sloshing".
+     \param name Case name.
+     \param type Parsed case type.
+     \return False if the name is not valid.
+   */
+  static bool parseType(std::string const& name, Type &type);
+
+  /**
+     \return The case constants.
+   */
+  SyntheticCase const& getCase() const;
+
+  /**
+     Parameters to run the foam simulator on the case. The thresholds of trapped air, wave crests
+     and kinetic energy are scaled to the flow of the synthetic cases, so that all of them emit
+     diffuse particles. All the output files are disabled.
+     \param dataPath Directory of the case, written with the prefix "PartFluid_" and 4 digits.
+     \param nsteps Number of steps, starting at zero.
+     \return Simulation parameters.
+   */
+  SimulationParams getSimulationParams(std::string const& dataPath, int nsteps) const;
+
+  /**
+     Generates the fluid particles of an output step.
+     \param n Step number. Step zero is the initial state.
+     \return Particle vector.
+   */
+  std::vector<sparticle> generate(int n) const;
+
+  /**
+     Writes the fluid particles of a step to a vtk file with the arrays Vel, Rhop and Idp, as PartVTK does.
+     \param fileName File name.
+     \param n Step number.
+     \return Number of particles written.
+   */
+  long writeStep(std::string const& fileName, int n) const;
+
+  /**
+     Writes a minimal DualSPHysics XML file with h, massfluid, TimeOut, pointmin and pointmax.
+     \param fileName File name.
+     \return True if the file was written.
+   */
+  bool writeXml(std::string const& fileName) const;
+
+  /**
+     Writes a sequence of steps named prefix + zero padded step number + ".vtk".
+     \param path Output directory.
+     \param prefix File name prefix.
+     \param nzeros Padding of the step number.
+     \param nstart First step.
+     \param nend Last step.
+     \return Total number of particles written.
+   */
+  long writeSequence(std::string const& path, std::string const& prefix, int nzeros,
+		     int nstart, int nend) const;
+
+ private:
+  Type type;
+  unsigned seed;
+  SyntheticCase sc;
+
+  double depth;                 // Water depth (or column height)
+  std::array<double,3> tank;    // Tank size
+
+  /**
+     Computes the free surface height and the fluid velocity at a point.
+     \param x Coordinate x.
+     \param z Coordinate z.
+     \param t Time.
+     \param vel Velocity at (x, z).
+     \return Free surface height at x.
+   */
+  double flow(double x, double z, double t, std::array<double,3> &vel) const;
+};
+
+#endif
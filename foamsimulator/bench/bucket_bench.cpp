@@ -0,0 +1,205 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "BucketContainer.h"
+
+/*
+ * Microbenchmarks of the neighbour search grid.
+ *
+ * Every benchmark is a template on the grid type. A grid backend must provide the
+ * BucketContainer interface used by the simulator: the (xmin, xmax, ymin, ymax, zmin, zmax, h)
+ * constructor, addElement(), getNoEmptyBuckets(), getSurroundingBuckets(long) and
+ * getSurroundingBuckets(std::array<double,3>). Alternative backends are compared by adding
+ * them to the REGISTER_GRID list at the end of this file, with their own arrange() and
+ * cellKey() if they order the cells in another way.
+ *
+ * Particles are uniformly distributed in a unit cube. The arguments of each benchmark are the
+ * number of particles per cell (density) and, where it applies, the cell size h in thousandths
+ * of the cube side.
+ */
+
+// Same layout as the fluid particles of FluidData
+struct bparticle {
+  long id;
+  std::array<double, 3> pos;
+  std::array<double, 3> vel;
+  double rhop;
+};
+
+// Random particles in the unit cube, enough to put "density" particles in each cell of size h
+static std::vector<bparticle> makeParticles(double density, double h, unsigned seed = 7) {
+  long n = std::max(1L, (long)(density / (h * h * h)));
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<double> unif(0.001, 0.999);
+  std::vector<bparticle> particles(n);
+  for (long i = 0; i < n; i++) {
+    particles[i].id = i;
+    particles[i].pos = {{unif(gen), unif(gen), unif(gen)}};
+    particles[i].vel = {{0, 0, 0}};
+    particles[i].rhop = 1000;
+  }
+  return particles;
+}
+
+typedef BucketContainer<bparticle> LinearGrid;
+
+// Same grid, with the non-empty buckets sorted along the Morton curve
+struct MortonGrid : public BucketContainer<bparticle> {
+  using BucketContainer<bparticle>::BucketContainer;
+};
+
+// Done after inserting the particles, as the simulator does after loading them
+static void arrange(LinearGrid &grid) {}
+
+static void arrange(MortonGrid &grid) {
+  grid.mortonOrder();
+  grid.firstTouch();
+}
+
+// Position of the cell of a point in the order of the grid
+static unsigned long long cellKey(LinearGrid &grid, std::array<double, 3> const &pos) {
+  return grid.getBucketNumber(pos[0], pos[1], pos[2]);
+}
+
+static unsigned long long cellKey(MortonGrid &grid, std::array<double, 3> const &pos) {
+  return MortonGrid::getMortonCode(grid.getBucketCoords(pos[0], pos[1], pos[2]));
+}
+
+template <class Grid>
+static void fill(Grid &grid, std::vector<bparticle> const &particles) {
+  for (auto &p : particles)
+    grid.addElement(p, p.pos[0], p.pos[1], p.pos[2]);
+  arrange(grid);
+}
+
+// Time to insert all the particles
+template <class Grid> static void BM_Build(benchmark::State &state) {
+  double density = state.range(0), h = state.range(1) / 1000.;
+  auto particles = makeParticles(density, h);
+  for (auto _ : state) {
+    Grid grid(0, 1, 0, 1, 0, 1, h);
+    fill(grid, particles);
+    benchmark::DoNotOptimize(grid.getNoEmptyBuckets().size());
+  }
+  state.SetItemsProcessed(state.iterations() * particles.size());
+}
+
+// Neighbour bucket lookups from every non-empty bucket
+template <class Grid> static void BM_SurroundingBuckets(benchmark::State &state) {
+  double density = state.range(0), h = state.range(1) / 1000.;
+  auto particles = makeParticles(density, h);
+  Grid grid(0, 1, 0, 1, 0, 1, h);
+  fill(grid, particles);
+  auto &buckets = grid.getNoEmptyBuckets();
+  for (auto _ : state) {
+    for (auto &b : buckets)
+      benchmark::DoNotOptimize(grid.getSurroundingBuckets(b.first).size());
+  }
+  state.SetItemsProcessed(state.iterations() * buckets.size());
+}
+
+// Full sweep: every particle tests the distance to all the particles in the 27 surrounding cells
+template <class Grid> static void BM_NeighbourSweep(benchmark::State &state) {
+  double density = state.range(0), h = state.range(1) / 1000.;
+  auto particles = makeParticles(density, h);
+  Grid grid(0, 1, 0, 1, 0, 1, h);
+  fill(grid, particles);
+  auto &buckets = grid.getNoEmptyBuckets();
+  long pairs = 0;
+  for (auto _ : state) {
+    long neighbours = 0;
+    for (auto &b : buckets) {
+      auto sbuckets = grid.getSurroundingBuckets(b.first);
+      for (auto &pi : b.second) {
+        for (auto sb : sbuckets) {
+          pairs += sb->size();
+          for (auto &pj : *sb) {
+            double dx = pi.pos[0] - pj.pos[0], dy = pi.pos[1] - pj.pos[1],
+                   dz = pi.pos[2] - pj.pos[2];
+            neighbours += std::sqrt(dx * dx + dy * dy + dz * dz) <= h;
+          }
+        }
+      }
+    }
+    benchmark::DoNotOptimize(neighbours);
+  }
+  state.SetItemsProcessed(state.iterations() * particles.size());
+  state.counters["pairs/s"] = benchmark::Counter(pairs, benchmark::Counter::kIsRate);
+}
+
+// Point queries, as done for diffuse particles in stages 7 and 8
+template <class Grid>
+static void pointQueries(benchmark::State &state, bool sorted) {
+  double density = state.range(0), h = state.range(1) / 1000.;
+  Grid grid(0, 1, 0, 1, 0, 1, h);
+  fill(grid, makeParticles(density, h));
+
+  auto queries = makeParticles(1, h, 11);
+  if (sorted) {
+    std::sort(queries.begin(), queries.end(), [&grid](bparticle const &a, bparticle const &b) {
+      return cellKey(grid, a.pos) < cellKey(grid, b.pos);
+    });
+  }
+
+  for (auto _ : state) {
+    long neighbours = 0;
+    for (auto &q : queries) {
+      for (auto sb : grid.getSurroundingBuckets(q.pos))
+        for (auto &pj : *sb) {
+          double dx = q.pos[0] - pj.pos[0], dy = q.pos[1] - pj.pos[1],
+                 dz = q.pos[2] - pj.pos[2];
+          neighbours += std::sqrt(dx * dx + dy * dy + dz * dz) <= h;
+        }
+    }
+    benchmark::DoNotOptimize(neighbours);
+  }
+  state.SetItemsProcessed(state.iterations() * queries.size());
+}
+
+template <class Grid> static void BM_QueryRandom(benchmark::State &state) {
+  pointQueries<Grid>(state, false);
+}
+
+template <class Grid> static void BM_QuerySorted(benchmark::State &state) {
+  pointQueries<Grid>(state, true);
+}
+
+// Particles per cell x cell size (thousandths)
+static void gridArgs(benchmark::internal::Benchmark *b) {
+  for (int density : {2, 8, 20})
+    for (int h : {40, 80})
+      b->Args({density, h});
+}
+
+#define REGISTER_GRID(Grid)                                         \
+  BENCHMARK_TEMPLATE(BM_Build, Grid)->Apply(gridArgs);              \
+  BENCHMARK_TEMPLATE(BM_SurroundingBuckets, Grid)->Apply(gridArgs); \
+  BENCHMARK_TEMPLATE(BM_NeighbourSweep, Grid)->Apply(gridArgs);     \
+  BENCHMARK_TEMPLATE(BM_QueryRandom, Grid)->Apply(gridArgs);        \
+  BENCHMARK_TEMPLATE(BM_QuerySorted, Grid)->Apply(gridArgs)
+
+REGISTER_GRID(LinearGrid);
+REGISTER_GRID(MortonGrid);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,65 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#define _SILENCE_EXPERIMENTAL_FILESYSTEM_DEPRECATION_WARNING
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+
+#include "CaseGenerator.h"
+
+/*
+ * Writes a synthetic DualSPHysics case: a sequence of fluid vtk files and a XML file
+ * with the constants needed by the foam simulator.
+ */
+
+int main(int argc, char **argv) {
+  if (argc < 5) {
+    std::cout << "Usage: foam_casegen dambreak|wave|sloshing nparticles nsteps output_dir [prefix] [seed]" << std::endl;
+    return 1;
+  }
+
+  CaseGenerator::Type type;
+  if (!CaseGenerator::parseType(argv[1], type)) {
+    std::cerr << "ERROR: unknown case " << argv[1] << std::endl;
+    return 1;
+  }
+
+  long nparticles = std::atol(argv[2]);
+  int nsteps = std::atoi(argv[3]);
+  std::string path = argv[4], prefix = argc > 5 ? argv[5] : "PartFluid_";
+  unsigned seed = argc > 6 ? std::atoi(argv[6]) : 1;
+
+  CaseGenerator gen(type, nparticles, seed);
+  auto &sc = gen.getCase();
+
+  long total = gen.writeSequence(path, prefix, 4, 0, nsteps - 1);
+  if (total < 0 || !gen.writeXml((fs::path(path) / "case.xml").generic_string())) {
+    std::cerr << "ERROR: the case cannot be written to " << path << std::endl;
+    return 1;
+  }
+
+  std::cout << "Case: " << sc.name << std::endl
+            << "Steps: " << nsteps << " (" << prefix << "0000.vtk ...)" << std::endl
+            << "Mean fluid particles: " << total / std::max(nsteps, 1) << std::endl
+            << "dp: " << sc.dp << " h: " << sc.h << " massfluid: " << sc.mass
+            << " TimeOut: " << sc.timeOut << std::endl;
+  return 0;
+}
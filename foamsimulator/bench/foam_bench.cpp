@@ -0,0 +1,327 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define _SILENCE_EXPERIMENTAL_FILESYSTEM_DEPRECATION_WARNING
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+
+#include <omp.h>
+
+#include "CaseGenerator.h"
+#include "DiffuseCalculator.h"
+#include "FluidData.h"
+
+/*
+ * End-to-end benchmark: runs the whole DiffuseCalculator pipeline on a synthetic case
+ * with an increasing number of threads and reports the throughput of each stage.
+ */
+
+static void usage() {
+  std::cout << "Usage: foam_bench [options]\n"
+            << "  --case dambreak|wave|sloshing  Synthetic case (default: dambreak)\n"
+            << "  --particles N                  Fluid particles (default: 200000)\n"
+            << "  --steps N                      Output steps (default: 5)\n"
+            << "  --threads 1,2,4                Thread counts (default: powers of two up to the maximum)\n"
+            << "  --dir path                     Directory of the generated case (default: foam_bench_case)\n"
+            << "  --report file                  JSON-lines file with the results of each run\n"
+            << "  --reuse                        Do not generate the case if it is already in --dir\n"
+            << "  --write                        Enable the vtk output files\n"
+            << "  --volume                       Enable the foam volume output files\n"
+            << "  --numa off,on                  Runs without and with NUMA first touch (default: off)\n"
+            << "  --incremental                  Updates the grid of each step from the previous one (Idp)\n"
+            << "  --cache                        Loads the steps from fluid cache files, written before the runs\n"
+            << "  --velocity-grid N              Foam and bubbles sample a velocity grid with N nodes per cell edge\n"
+            << "  --substeps N                   Substeps of the diffuse particles per step\n"
+            << "  --order linear,morton          Order of the cells (default: linear)\n"
+            << "  --balance off,on               Runs without and with the cost-balanced scheduler (default: off)\n"
+            << "  --pin compact|spread           Pins the threads to the cores\n"
+            << "  --hw                           Hardware counters: cache, TLB and remote NUMA misses\n"
+            << "  --verbose                      Do not hide the simulator output\n";
+}
+
+int main(int argc, char **argv) {
+  std::string caseName = "dambreak", dir = "foam_bench_case", reportFile;
+  long nparticles = 200000;
+  int nsteps = 5;
+  bool write = false, volume = false, verbose = false, reuse = false, hw = false, incremental = false, cache = false;
+  int velocityGrid = 0, substeps = 1;
+  std::vector<int> threads;
+  std::vector<bool> layouts, balances;
+  std::vector<std::string> orders;
+  std::string pin;
+
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (a == "--case" && hasValue) {
+      caseName = argv[++i];
+    } else if (a == "--particles" && hasValue) {
+      nparticles = std::atol(argv[++i]);
+    } else if (a == "--steps" && hasValue) {
+      nsteps = std::atoi(argv[++i]);
+    } else if (a == "--threads" && hasValue) {
+      std::stringstream ss(argv[++i]);
+      std::string t;
+      while (std::getline(ss, t, ','))
+        threads.push_back(std::atoi(t.c_str()));
+    } else if (a == "--dir" && hasValue) {
+      dir = argv[++i];
+    } else if (a == "--report" && hasValue) {
+      reportFile = argv[++i];
+    } else if (a == "--reuse") {
+      reuse = true;
+    } else if (a == "--write") {
+      write = true;
+    } else if (a == "--volume") {
+      volume = true;
+    } else if (a == "--verbose") {
+      verbose = true;
+    } else if (a == "--numa" && hasValue) {
+      std::stringstream ss(argv[++i]);
+      std::string t;
+      while (std::getline(ss, t, ','))
+        layouts.push_back(t == "on");
+    } else if (a == "--balance" && hasValue) {
+      std::stringstream ss(argv[++i]);
+      std::string t;
+      while (std::getline(ss, t, ','))
+        balances.push_back(t == "on");
+    } else if (a == "--order" && hasValue) {
+      std::stringstream ss(argv[++i]);
+      std::string t;
+      while (std::getline(ss, t, ','))
+        orders.push_back(t);
+    } else if (a == "--pin" && hasValue) {
+      pin = argv[++i];
+    } else if (a == "--hw") {
+      hw = true;
+    } else if (a == "--incremental") {
+      incremental = true;
+    } else if (a == "--cache") {
+      cache = true;
+    } else if (a == "--velocity-grid" && hasValue) {
+      velocityGrid = std::atoi(argv[++i]);
+    } else if (a == "--substeps" && hasValue) {
+      substeps = std::atoi(argv[++i]);
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  if (threads.empty()) {
+    int maxThreads = omp_get_max_threads();
+    for (int t = 1; t < maxThreads; t *= 2)
+      threads.push_back(t);
+    threads.push_back(maxThreads);
+  }
+
+  if (layouts.empty())
+    layouts.push_back(false);
+  if (balances.empty())
+    balances.push_back(false);
+  if (orders.empty())
+    orders.push_back("linear");
+
+  // Every combination of memory layout, cell order and scheduler
+  struct Mode {
+    bool numaOn, balanced;
+    std::string order;
+  };
+  std::vector<Mode> modes;
+  for (bool numaOn : layouts)
+    for (auto &order : orders)
+      for (bool balanced : balances)
+        modes.push_back(Mode{numaOn, balanced, order});
+
+  CaseGenerator::Type type;
+  if (!CaseGenerator::parseType(caseName, type) || nsteps < 1 || velocityGrid < 0 || substeps < 1) {
+    usage();
+    return 1;
+  }
+
+  // Generate the case
+  CaseGenerator gen(type, nparticles);
+  auto &sc = gen.getCase();
+  char lastStep[32];
+  std::sprintf(lastStep, "PartFluid_%.4d.vtk", nsteps - 1);
+  if (reuse && fs::exists(fs::path(dir) / lastStep)) {
+    std::cout << "Using the case in " << dir << std::endl;
+  } else {
+    std::cout << "Generating " << nsteps << " steps of case " << sc.name
+              << " in " << dir << "..." << std::endl;
+    if (gen.writeSequence(dir, "PartFluid_", 4, 0, nsteps - 1) < 0) {
+      std::cerr << "ERROR: the case cannot be written to " << dir << std::endl;
+      return 1;
+    }
+  }
+
+  SimulationParams sp = gen.getSimulationParams(dir, nsteps);
+  sp.pinThreads = pin;
+  sp.hardwareCounters = hw;
+  sp.incrementalGrid = incremental;
+  sp.velocityGrid = velocityGrid > 0;
+  if (velocityGrid > 0)
+    sp.velocityGridResolution = velocityGrid;
+  sp.substeps = substeps;
+  if (cache) {
+    sp.cachePath = (fs::path(dir) / "cache").generic_string();
+    fs::create_directories(sp.cachePath);
+    std::cout << "Writing the fluid cache files to " << sp.cachePath << "..." << std::endl;
+    for (int n = 0; n < nsteps; n++) {
+      char name[32];
+      std::sprintf(name, "PartFluid_%.4d.vtk", n);
+      std::string fileName = (fs::path(dir) / name).generic_string();
+      FluidData file(sp.MINX, sp.MAXX, sp.MINY, sp.MAXY, sp.MINZ, sp.MAXZ, sp.h);
+      if (!file.loadFile(fileName) || file.writeCache(FluidData::cacheFileName(sp.cachePath, fileName), fileName) < 0)
+        return 1;
+    }
+  }
+  if (write || volume) {
+    sp.vtk_files = write;
+    sp.volumeFiles = volume;
+    fs::create_directories(sp.outputPath);
+  }
+
+  std::ofstream report;
+  if (reportFile != "")
+    report.open(reportFile, std::ios::trunc);
+
+  for (auto &mode : modes) {
+    bool numaOn = mode.numaOn, balanced = mode.balanced;
+    sp.numaFirstTouch = numaOn;
+    sp.balancedScheduler = balanced;
+    if (!sp.setOption("CellOrder", mode.order)) {
+      std::cerr << "ERROR: unknown cell order: " << mode.order << std::endl;
+      return 1;
+    }
+    double baseTime = 0;
+
+    for (int nthreads : threads) {
+      omp_set_num_threads(nthreads);
+
+      std::streambuf *coutBuf = std::cout.rdbuf(), *cerrBuf = std::cerr.rdbuf();
+      if (!verbose) {
+        std::cout.rdbuf(nullptr);
+        std::cerr.rdbuf(nullptr);
+      }
+
+      DiffuseCalculator dc(sp);
+      dc.runSimulation();
+
+      std::cout.rdbuf(coutBuf);
+      std::cerr.rdbuf(cerrBuf);
+      std::cout.clear();
+      std::cerr.clear();
+      std::cout.width(0);
+
+      auto &prof = dc.getProfiler();
+      double fluid = 0, total = 0;
+      for (auto &c : prof.getCounterTotals())
+        if (c.name == "fluid_particles")
+          fluid = c.sum;
+      for (auto &s : prof.getStageTotals())
+        total += s.sum;
+      if (baseTime == 0)
+        baseTime = total * threads[0];
+
+      // Hardware counters of a stage, zero if they are not available
+      auto stageHw = [&prof](std::string const &name) {
+        PerfCounters::values v;
+        v.fill(0);
+        for (auto &h : prof.getHardwareTotals())
+          if (h.first == name)
+            v = h.second;
+        return v;
+      };
+
+      // Mean load imbalance of a stage, negative if it is not measured
+      auto stageImbalance = [&prof](std::string const &name) {
+        for (auto &i : prof.getImbalanceTotals())
+          if (i.name == name)
+            return i.sum / i.n;
+        return -1.;
+      };
+
+      std::cout << "\n=== " << nthreads << " threads" << (numaOn ? ", NUMA first touch" : "")
+                << ", " << mode.order << " order" << (balanced ? ", balanced scheduler" : "") << ": " << std::fixed << std::setprecision(3) << total << " s, speedup "
+                << std::setprecision(2) << baseTime / total << ", efficiency "
+                << baseTime / total / nthreads << std::endl
+                << std::left << std::setw(12) << "Stage" << std::right << std::setw(12)
+                << "Time (s)" << std::setw(18) << "Particles/s" << std::setw(13) << "Imbalance %";
+      if (hw)
+        std::cout << std::setw(15) << "LLC misses" << std::setw(15) << "dTLB misses"
+                  << std::setw(17) << "Remote loads" << std::setw(10) << "Remote %";
+      std::cout << std::endl;
+      for (auto &s : prof.getStageTotals()) {
+        std::cout << std::left << std::setw(12) << s.name << std::right
+                  << std::setprecision(4) << std::setw(12) << s.sum
+                  << std::setprecision(0) << std::setw(18)
+                  << (s.sum > 0 ? fluid / s.sum : 0.) << std::setw(13);
+        double imbalance = stageImbalance(s.name);
+        if (imbalance >= 0)
+          std::cout << std::setprecision(1) << 100 * imbalance;
+        else
+          std::cout << "";
+        if (hw) {
+          auto v = stageHw(s.name);
+          std::cout << std::setprecision(0) << std::setw(15) << v[2] << std::setw(15) << v[6]
+                    << std::setw(17) << v[5] << std::setprecision(1)
+                    << std::setw(10) << (v[4] > 0 ? 100. * v[5] / v[4] : 0.);
+        }
+        std::cout << std::endl;
+      }
+
+      if (report.is_open()) {
+        report << "{\"case\": \"" << sc.name << "\", \"particles\": " << (long)(fluid / nsteps)
+               << ", \"steps\": " << nsteps << ", \"threads\": " << nthreads
+               << ", \"numa\": " << (numaOn ? "true" : "false")
+               << ", \"balanced\": " << (balanced ? "true" : "false") << ", \"order\": \""
+               << mode.order << "\", \"cache\": " << (cache ? "true" : "false")
+               << ", \"velocity_grid\": " << velocityGrid << ", \"substeps\": " << substeps
+               << ", \"pin\": \"" << pin
+               << "\", \"time\": " << total << ", \"stages\": {";
+        bool first = true;
+        for (auto &s : prof.getStageTotals()) {
+          report << (first ? "" : ", ") << "\"" << s.name << "\": {\"time\": " << s.sum
+                 << ", \"throughput\": " << (s.sum > 0 ? fluid / s.sum : 0.);
+          if (stageImbalance(s.name) >= 0)
+            report << ", \"imbalance\": " << stageImbalance(s.name);
+          if (hw) {
+            auto v = stageHw(s.name);
+            report << ", \"llc_misses\": " << (long long)v[2] << ", \"dtlb_misses\": "
+                   << (long long)v[6] << ", \"node_loads\": " << (long long)v[4]
+                   << ", \"node_misses\": " << (long long)v[5];
+          }
+          report << "}";
+          first = false;
+        }
+        report << "}}" << std::endl;
+      }
+    }
+  }
+
+  return 0;
+}
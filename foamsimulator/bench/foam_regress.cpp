@@ -0,0 +1,439 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define _SILENCE_EXPERIMENTAL_FILESYSTEM_DEPRECATION_WARNING
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+
+#include <vtkCommand.h>
+#include <vtkDataArray.h>
+#include <vtkPointData.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkPolyDataReader.h>
+#include <vtkSmartPointer.h>
+
+#include "CaseGenerator.h"
+#include "DiffuseCalculator.h"
+#include "FluidData.h"
+
+/*
+ * Golden-output regression harness.
+ *
+ * "record" runs a set of small synthetic cases with a fixed seed and stores the diffuse and
+ * fluid vtk files of every step, together with the time of each stage, in a golden directory.
+ * "check" runs the same cases again and fails (exit code 1) if any point or point array differs
+ * from the golden files beyond the tolerance, or if a stage became slower than the recorded
+ * time by more than the allowed fraction. Timings are only comparable on the same machine, so
+ * the baseline must be recorded where the check runs.
+ * "check" also runs each case in the other ways of loading and processing the fluid that must
+ * give the same output (variants), and compares them with the same golden files.
+ */
+
+#define SEED 1234
+#define TIMINGS_FILE "timings.txt"
+
+struct RegressCase {
+  const char *name;
+  long nparticles;
+  int nsteps;
+};
+
+static const RegressCase cases[] = {
+    {"dambreak", 20000, 4}, {"wave", 20000, 4}, {"sloshing", 20000, 4}};
+
+// A variant sets one advanced option. Directories are created in the output of the variant
+struct RegressVariant {
+  const char *name;
+  const char *key;
+  const char *value;
+  bool fluidFiles; // The slabs and the farm do not write the fluid vtk files
+};
+
+static const RegressVariant variants[] = {
+    {"default", nullptr, nullptr, true},     {"incremental", "IncrementalGrid", "yes", true},
+    {"cache", "CachePath", "cache", true},   {"slabs", "Slabs", "3", false},
+    {"farm", "FarmPath", "farm", false},     {"morton", "CellOrder", "morton", true}};
+
+static void usage() {
+  std::cout << "Usage: foam_regress record|check golden_dir [options]\n"
+            << "  --tolerance x     Relative tolerance of the output values (default: 1e-9)\n"
+            << "  --max-slowdown x  Allowed slowdown of each stage, 0.25 is 25% (default: 0.25)\n"
+            << "  --min-time s      Stages faster than this are not checked (default: 0.01)\n"
+            << "  --repeat n        Runs of each case, the best time is kept (default: 3)\n"
+            << "  --no-timing       Only check the output files\n"
+            << "  --variants a,b    Variants checked (default: all). Only the default one is recorded:\n"
+            << "                    default, incremental, cache, slabs, farm, morton\n"
+            << "  --work path       Working directory (default: foam_regress_work)\n";
+}
+
+// Silences the ErrorEvent of the reader, a missing file is reported by the caller
+class ReadErrorObserver : public vtkCommand {
+public:
+  bool error = false;
+  static ReadErrorObserver *New() { return new ReadErrorObserver; }
+  void Execute(vtkObject *vtkNotUsed(caller), unsigned long vtkNotUsed(event),
+               void *vtkNotUsed(calldata)) {
+    error = true;
+  }
+};
+
+static vtkPolyData *readPolyData(std::string const &fileName,
+                                 vtkSmartPointer<vtkPolyDataReader> &reader) {
+  vtkSmartPointer<ReadErrorObserver> observer = vtkSmartPointer<ReadErrorObserver>::New();
+  reader = vtkSmartPointer<vtkPolyDataReader>::New();
+  reader->AddObserver(vtkCommand::ErrorEvent, observer);
+  reader->SetFileName(fileName.c_str());
+  reader->ReadAllScalarsOn();
+  reader->ReadAllVectorsOn();
+  reader->Update();
+  return observer->error ? nullptr : reader->GetOutput();
+}
+
+static bool equal(double a, double b, double tolerance) {
+  return std::fabs(a - b) <= tolerance * std::max(1., std::max(std::fabs(a), std::fabs(b)));
+}
+
+// Compares a file with its golden version. Prints the first difference found.
+static bool compareFiles(std::string const &fileName, std::string const &goldenName,
+                         double tolerance) {
+  vtkSmartPointer<vtkPolyDataReader> r1, r2;
+  vtkPolyData *out = readPolyData(fileName, r1), *golden = readPolyData(goldenName, r2);
+
+  if (!golden) {
+    std::cout << "  missing golden file " << goldenName << std::endl;
+    return false;
+  }
+  if (!out) {
+    std::cout << "  missing output file " << fileName << std::endl;
+    return false;
+  }
+
+  long npoints = golden->GetNumberOfPoints();
+  if (out->GetNumberOfPoints() != npoints) {
+    std::cout << "  " << fs::path(fileName).filename() << ": " << out->GetNumberOfPoints()
+              << " points, expected " << npoints << std::endl;
+    return false;
+  }
+
+  // Points are compared as one more array
+  std::vector<std::pair<std::string, std::pair<vtkDataArray *, vtkDataArray *>>> arrays;
+  if (npoints > 0)
+    arrays.push_back({"points", {out->GetPoints()->GetData(), golden->GetPoints()->GetData()}});
+
+  vtkPointData *gpd = golden->GetPointData();
+  for (int a = 0; a < gpd->GetNumberOfArrays(); a++) {
+    std::string name = gpd->GetArrayName(a);
+    vtkDataArray *oa = out->GetPointData()->GetArray(name.c_str());
+    if (!oa) {
+      std::cout << "  " << fs::path(fileName).filename() << ": missing array " << name
+                << std::endl;
+      return false;
+    }
+    arrays.push_back({name, {oa, gpd->GetArray(a)}});
+  }
+
+  for (auto &a : arrays) {
+    vtkDataArray *oa = a.second.first, *ga = a.second.second;
+    int ncomp = ga->GetNumberOfComponents();
+    if (oa->GetNumberOfComponents() != ncomp || oa->GetNumberOfTuples() != npoints) {
+      std::cout << "  " << fs::path(fileName).filename() << ": array " << a.first
+                << " has a different size" << std::endl;
+      return false;
+    }
+    for (long i = 0; i < npoints; i++)
+      for (int c = 0; c < ncomp; c++) {
+        double v = oa->GetComponent(i, c), g = ga->GetComponent(i, c);
+        if (!equal(v, g, tolerance)) {
+          std::cout << "  " << fs::path(fileName).filename() << ": " << a.first << "[" << i
+                    << "][" << c << "] = " << std::setprecision(17) << v << ", expected " << g
+                    << std::endl;
+          return false;
+        }
+      }
+  }
+  return true;
+}
+
+// Writes the input files of a case and the parameters to simulate it
+static bool writeCase(RegressCase const &rc, std::string const &work, SimulationParams &sp) {
+  CaseGenerator::Type type;
+  CaseGenerator::parseType(rc.name, type);
+  CaseGenerator gen(type, rc.nparticles);
+
+  std::string dir = (fs::path(work) / rc.name).generic_string();
+  if (gen.writeSequence(dir, "PartFluid_", 4, 0, rc.nsteps - 1) < 0) {
+    std::cerr << "ERROR: the case cannot be written to " << dir << std::endl;
+    return false;
+  }
+
+  sp = gen.getSimulationParams(dir, rc.nsteps);
+  sp.vtk_diffuse_data = 1;
+  sp.vtk_fluid_data = 1;
+  sp.seed = SEED;
+  return true;
+}
+
+// Runs a function with the console output of the simulation silenced
+template <class F>
+static bool silenced(F run) {
+  std::streambuf *coutBuf = std::cout.rdbuf(), *cerrBuf = std::cerr.rdbuf();
+  std::cout.rdbuf(nullptr);
+  std::cerr.rdbuf(nullptr);
+
+  bool ok = run();
+
+  std::cout.rdbuf(coutBuf);
+  std::cerr.rdbuf(cerrBuf);
+  std::cout.clear();
+  std::cerr.clear();
+  std::cout.width(0);
+  return ok;
+}
+
+// Names of the input files of each step
+static std::vector<std::string> inputFiles(SimulationParams const &sp) {
+  std::vector<std::string> files;
+  std::string seqnum(sp.nzeros, '0'),
+      formats = std::string("%.") + std::to_string(sp.nzeros) + std::string("d");
+  for (int n = sp.nstart; n <= sp.nend; n++) {
+    std::sprintf(&seqnum[0], formats.c_str(), n);
+    files.push_back((fs::path(sp.dataPath) / (sp.filePrefix + seqnum + ".vtk")).generic_string());
+  }
+  return files;
+}
+
+// Sets the option of a variant, with an empty output directory of its own, and writes the cache
+// files or runs the farm worker that it needs
+static bool prepareVariant(RegressVariant const &v, SimulationParams &sp) {
+  sp.outputPath = (fs::path(sp.outputPath) / v.name).generic_string();
+  fs::remove_all(sp.outputPath);
+  fs::create_directories(sp.outputPath);
+  if (v.key == nullptr)
+    return true;
+
+  std::string key = v.key, value = v.value;
+  if (key == "CachePath" || key == "FarmPath")
+    value = (fs::path(sp.outputPath) / value).generic_string();
+  if (!sp.setOption(key, value))
+    return false;
+
+  if (sp.cachePath != "") {
+    fs::create_directories(sp.cachePath);
+    for (auto &fileName : inputFiles(sp)) {
+      bool ok = silenced([&]() {
+        FluidData file(sp.MINX, sp.MAXX, sp.MINY, sp.MAXY, sp.MINZ, sp.MAXZ, sp.h);
+        return file.loadFile(fileName) &&
+               file.writeCache(FluidData::cacheFileName(sp.cachePath, fileName), fileName) >= 0;
+      });
+      if (!ok)
+        return false;
+    }
+  }
+
+  if (sp.farmPath != "") {
+    SimulationParams worker = sp;
+    worker.farmWorker = true;
+    if (!silenced([&]() { return DiffuseCalculator(worker).runWorker(); }))
+      return false;
+  }
+  return true;
+}
+
+// Runs a case "repeat" times and keeps the best time of each stage
+static bool runCase(SimulationParams const &sp, int repeat, std::map<std::string, double> &times) {
+  times.clear();
+  for (int r = 0; r < repeat; r++) {
+    DiffuseCalculator dc(sp);
+    if (!silenced([&]() { return dc.runSimulation(); }))
+      return false;
+
+    for (auto &s : dc.getProfiler().getStageTotals())
+      if (times.count(s.name) == 0 || s.sum < times[s.name])
+        times[s.name] = s.sum;
+  }
+  return true;
+}
+
+// Name of the output files of each step
+static std::vector<std::string> outputFiles(SimulationParams const &sp, bool fluidFiles) {
+  std::vector<std::string> files;
+  std::string seqnum(sp.nzeros, '0'),
+      formats = std::string("%.") + std::to_string(sp.nzeros) + std::string("d");
+  for (int n = sp.nstart; n <= sp.nend; n++) {
+    std::sprintf(&seqnum[0], formats.c_str(), n);
+    files.push_back(sp.outputPreffix + seqnum + "_diffuse.vtk");
+    if (fluidFiles)
+      files.push_back(sp.outputPreffix + seqnum + "_fluid.vtk");
+  }
+  return files;
+}
+
+static std::map<std::string, double> readTimings(std::string const &fileName) {
+  std::map<std::string, double> timings;
+  std::ifstream in(fileName);
+  std::string caseName, stage;
+  double t;
+  while (in >> caseName >> stage >> t)
+    timings[caseName + " " + stage] = t;
+  return timings;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    usage();
+    return 1;
+  }
+
+  std::string mode = argv[1], golden = argv[2], work = "foam_regress_work";
+  double tolerance = 1e-9, maxSlowdown = 0.25, minTime = 0.01;
+  int repeat = 3;
+  bool timing = true;
+  std::vector<std::string> selected;
+
+  for (int i = 3; i < argc; i++) {
+    std::string a = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (a == "--tolerance" && hasValue) {
+      tolerance = std::atof(argv[++i]);
+    } else if (a == "--max-slowdown" && hasValue) {
+      maxSlowdown = std::atof(argv[++i]);
+    } else if (a == "--min-time" && hasValue) {
+      minTime = std::atof(argv[++i]);
+    } else if (a == "--repeat" && hasValue) {
+      repeat = std::max(1, std::atoi(argv[++i]));
+    } else if (a == "--no-timing") {
+      timing = false;
+    } else if (a == "--work" && hasValue) {
+      work = argv[++i];
+    } else if (a == "--variants" && hasValue) {
+      std::stringstream list(argv[++i]);
+      std::string name;
+      while (std::getline(list, name, ','))
+        selected.push_back(name);
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  if (mode != "record" && mode != "check") {
+    usage();
+    return 1;
+  }
+  if (!timing)
+    repeat = 1;
+  for (auto &name : selected)
+    if (std::none_of(std::begin(variants), std::end(variants),
+                     [&](RegressVariant const &v) { return name == v.name; })) {
+      std::cerr << "Unknown variant '" << name << "'" << std::endl;
+      return 1;
+    }
+
+  std::map<std::string, double> baseline;
+  if (mode == "check" && timing)
+    baseline = readTimings((fs::path(golden) / TIMINGS_FILE).generic_string());
+
+  std::ofstream timings;
+  if (mode == "record") {
+    fs::create_directories(golden);
+    timings.open((fs::path(golden) / TIMINGS_FILE).generic_string(), std::ios::trunc);
+  }
+
+  bool ok = true;
+
+  for (auto &rc : cases) {
+    std::cout << "== " << rc.name << " (" << rc.nparticles << " particles, " << rc.nsteps
+              << " steps)" << std::endl;
+
+    SimulationParams base;
+    if (!writeCase(rc, work, base))
+      return 1;
+
+    fs::path goldenDir = fs::path(golden) / rc.name;
+    bool caseOk = true;
+
+    for (auto &v : variants) {
+      bool isDefault = v.key == nullptr;
+      if (mode == "record" ? !isDefault
+                           : !selected.empty() && std::find(selected.begin(), selected.end(),
+                                                            v.name) == selected.end())
+        continue;
+
+      // Only the default variant is timed
+      SimulationParams sp = base;
+      std::map<std::string, double> times;
+      if (!prepareVariant(v, sp) || !runCase(sp, isDefault ? repeat : 1, times)) {
+        std::cout << "  " << v.name << ": the simulation FAILED" << std::endl;
+        caseOk = false;
+        continue;
+      }
+
+      if (mode == "record") {
+        fs::create_directories(goldenDir);
+        for (auto &file : outputFiles(sp, v.fluidFiles))
+          fs::copy_file(fs::path(sp.outputPath) / file, goldenDir / file,
+                        fs::copy_options::overwrite_existing);
+        timings << std::setprecision(6);
+        for (auto &t : times)
+          timings << rc.name << " " << t.first << " " << t.second << std::endl;
+        std::cout << "  recorded " << outputFiles(sp, v.fluidFiles).size() << " files" << std::endl;
+        continue;
+      }
+
+      // Check the results
+      bool outputOk = true;
+      for (auto &file : outputFiles(sp, v.fluidFiles))
+        outputOk = compareFiles((fs::path(sp.outputPath) / file).generic_string(),
+                                (goldenDir / file).generic_string(), tolerance) &&
+                   outputOk;
+      std::cout << "  " << v.name << " output: " << (outputOk ? "OK" : "FAILED") << std::endl;
+      caseOk = caseOk && outputOk;
+
+      // Check the timings
+      for (auto &t : times) {
+        auto b = baseline.find(std::string(rc.name) + " " + t.first);
+        if (!isDefault || b == baseline.end() || b->second < minTime)
+          continue;
+        double slowdown = t.second / b->second - 1;
+        if (slowdown > maxSlowdown) {
+          std::cout << "  " << t.first << ": " << std::fixed << std::setprecision(4) << t.second
+                    << " s, baseline " << b->second << " s (" << std::setprecision(0)
+                    << slowdown * 100 << "% slower) FAILED" << std::endl;
+          std::cout.unsetf(std::ios::fixed);
+          caseOk = false;
+        }
+      }
+    }
+
+    ok = ok && caseOk;
+  }
+
+  if (mode == "check")
+    std::cout << (ok ? "All the cases passed" : "Some cases FAILED") << std::endl;
+  return ok ? 0 : 1;
+}
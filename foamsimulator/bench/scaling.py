@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+# VisualSPHysics
+# Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+## Strong and weak scaling study of the foam simulator. It runs foam_bench
+# with different numbers of threads, pinning policies and problem sizes, and
+# writes the time, speedup and parallel efficiency of every stage to a CSV file
+# with one row per (mode, binding, threads, stage).
+#
+# Strong scaling keeps the number of particles fixed. Weak scaling grows it
+# with the number of threads, so the ideal time is constant. The Karp-Flatt
+# metric estimates the serial fraction of each stage: a value that grows with
+# the number of threads points to overheads, a constant one to serial code.
+
+import argparse
+import csv
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+#
+# Functions
+#
+
+def threadList(text):
+    return [int(t) for t in text.split(",")]
+
+def defaultThreads():
+    maxThreads = os.cpu_count() or 1
+    threads = []
+    t = 1
+    while t < maxThreads:
+        threads.append(t)
+        t *= 2
+    threads.append(maxThreads)
+    return threads
+
+def runBench(args, nthreads, bind, particles):
+    """Runs foam_bench once and returns its report: a dict with the total time,
+    the time of each stage and the number of particles."""
+    env = dict(os.environ)
+    env["OMP_NUM_THREADS"] = str(nthreads)
+    env.pop("OMP_PROC_BIND", None)
+    env.pop("OMP_PLACES", None)
+    if bind != "none":
+        env["OMP_PROC_BIND"] = bind
+        env["OMP_PLACES"] = args.places
+
+    caseDir = os.path.join(args.dir, "%s_%d" % (args.case, particles))
+    best = None
+
+    for r in range(args.repeat):
+        with tempfile.NamedTemporaryFile(suffix=".jsonl", delete=False) as tmp:
+            reportFile = tmp.name
+        try:
+            cmd = [args.bench, "--case", args.case, "--particles", str(particles),
+                   "--steps", str(args.steps), "--threads", str(nthreads),
+                   "--dir", caseDir, "--report", reportFile, "--reuse"]
+            res = subprocess.run(cmd, env=env, stdout=subprocess.DEVNULL)
+            if res.returncode != 0:
+                sys.exit("Error running: " + " ".join(cmd))
+            with open(reportFile) as f:
+                report = json.loads(f.readlines()[-1])
+        finally:
+            os.remove(reportFile)
+
+        # Keep the best time of each stage
+        if best is None:
+            best = report
+        else:
+            best["time"] = min(best["time"], report["time"])
+            for name, s in report["stages"].items():
+                best["stages"][name]["time"] = min(best["stages"][name]["time"], s["time"])
+    return best
+
+def stageTimes(report):
+    times = dict((name, s["time"]) for name, s in report["stages"].items())
+    times["total"] = report["time"]
+    return times
+
+#
+# Main
+#
+
+parser = argparse.ArgumentParser(description="Strong and weak scaling study of the foam simulator.")
+parser.add_argument("--bench", default="./foam_bench", help="foam_bench executable (default: ./foam_bench)")
+parser.add_argument("--case", default="dambreak", choices=["dambreak", "wave", "sloshing"])
+parser.add_argument("--particles", type=int, default=1000000,
+                    help="particles of the strong study, and per thread of the weak study multiplied by the first thread count (default: 1000000)")
+parser.add_argument("--steps", type=int, default=3, help="output steps of each run (default: 3)")
+parser.add_argument("--threads", type=threadList, default=defaultThreads(),
+                    help="comma separated thread counts (default: powers of two up to the number of cores)")
+parser.add_argument("--bind", default="none,close,spread",
+                    help="comma separated OMP_PROC_BIND policies, none leaves it unset (default: none,close,spread)")
+parser.add_argument("--places", default="cores", help="OMP_PLACES used with a binding policy (default: cores)")
+parser.add_argument("--mode", default="both", choices=["strong", "weak", "both"])
+parser.add_argument("--repeat", type=int, default=1, help="runs of each configuration, the best time is kept (default: 1)")
+parser.add_argument("--dir", default="scaling_cases", help="directory of the generated cases (default: scaling_cases)")
+parser.add_argument("--csv", default="scaling.csv", help="output CSV file (default: scaling.csv)")
+args = parser.parse_args()
+
+modes = ["strong", "weak"] if args.mode == "both" else [args.mode]
+binds = args.bind.split(",")
+threads = sorted(args.threads)
+base = threads[0]
+
+rows = []
+
+for mode in modes:
+    for bind in binds:
+        baseTimes = baseParticles = None
+
+        for nthreads in threads:
+            particles = args.particles if mode == "strong" else args.particles * nthreads // base
+            print("%s scaling, bind %s: %d threads, %d particles..." % (mode, bind, nthreads, particles), flush=True)
+
+            report = runBench(args, nthreads, bind, particles)
+            times = stageTimes(report)
+            if baseTimes is None:
+                baseTimes, baseParticles = times, report["particles"]
+
+            p = nthreads / base
+            for stage, t in times.items():
+                t0 = baseTimes.get(stage, 0)
+                if t <= 0 or t0 <= 0:
+                    speedup = efficiency = karpFlatt = ""
+                elif mode == "strong":
+                    speedup = t0 / t
+                    efficiency = speedup / p
+                    karpFlatt = (1 / speedup - 1 / p) / (1 - 1 / p) if p > 1 else ""
+                else:
+                    # Time per particle, so that the real particle counts are taken into account. The
+                    # particle ratio already grows with the threads: ideal weak scaling gives speedup p
+                    speedup = (t0 / baseParticles) / (t / report["particles"])
+                    efficiency = speedup / p
+                    karpFlatt = ""
+                rows.append({"mode": mode, "case": args.case, "bind": bind, "places": args.places if bind != "none" else "",
+                             "threads": nthreads, "particles": report["particles"], "stage": stage, "time": t,
+                             "share": t / times["total"] if times["total"] > 0 else 0,
+                             "speedup": speedup, "efficiency": efficiency, "karp_flatt": karpFlatt})
+
+with open(args.csv, "w", newline="") as f:
+    writer = csv.DictWriter(f, fieldnames=list(rows[0].keys()))
+    writer.writeheader()
+    writer.writerows(rows)
+print("Results written to", args.csv)
+
+# Stages that limit the scaling at the largest thread count: low efficiency and a large share of the time
+print("\nLimiting stages with %d threads (efficiency, share of the total time):" % threads[-1])
+for mode in modes:
+    for bind in binds:
+        last = [r for r in rows if r["mode"] == mode and r["bind"] == bind and
+                r["threads"] == threads[-1] and r["stage"] != "total" and r["efficiency"] != ""]
+        last.sort(key=lambda r: (1 - r["efficiency"]) * r["share"], reverse=True)
+        print("  %s, bind %s: " % (mode, bind) +
+              ", ".join("%s (%.2f, %.0f%%)" % (r["stage"], r["efficiency"], 100 * r["share"]) for r in last[:4]))
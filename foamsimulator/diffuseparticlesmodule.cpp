@@ -28,9 +28,10 @@ extern "C"
 
   static PyObject * diffuseparticles_run(PyObject *self, PyObject *args){
     const char * dataPath, * filePrefix, * outputPath, * outputPreffix, * exclusionZoneFile;
+    PyObject * options = NULL;
     SimulationParams sp;
 
-    if(!PyArg_ParseTuple(args, "sssssiiippppdddddddddddddddddddddd",
+    if(!PyArg_ParseTuple(args, "sssssiiippppdddddddddddddddddddddd|O!",
 			 &dataPath,
 			 &filePrefix,
 			 &outputPath,
@@ -47,11 +48,29 @@ extern "C"
 			 &sp.MINX, &sp.MINY, &sp.MINZ, &sp.MAXX, &sp.MAXY, &sp.MAXZ,
 			 &sp.MINTA, &sp.MAXTA, &sp.MINWC, &sp.MAXWC,
 			 &sp.MINK, &sp.MAXK, &sp.KTA, &sp.KWC,
-			 &sp.SPRAY, &sp.BUBBLES, &sp.LIFEFIME, &sp.KB, &sp.KD
+			 &sp.SPRAY, &sp.BUBBLES, &sp.LIFEFIME, &sp.KB, &sp.KD,
+			 &PyDict_Type, &options
 			 )){
       return NULL;
     }
 
+    // Optional dictionary with the advanced options
+    if(options != NULL){
+      PyObject * key, * value;
+      Py_ssize_t pos = 0;
+      while(PyDict_Next(options, &pos, &key, &value)){
+	PyObject * skey = PyObject_Str(key), * svalue = PyObject_Str(value);
+	bool ok = skey != NULL && svalue != NULL &&
+	  sp.setOption(PyUnicode_AsUTF8(skey), PyUnicode_AsUTF8(svalue));
+	if(!ok && !PyErr_Occurred())
+	  PyErr_Format(PyExc_ValueError, "Invalid advanced option '%S'", key);
+	Py_XDECREF(skey);
+	Py_XDECREF(svalue);
+	if(!ok)
+	  return NULL;
+      }
+    }
+
     
     sp.dataPath = dataPath;
     sp.filePrefix = filePrefix;
@@ -60,9 +79,15 @@ extern "C"
     sp.exclusionZoneFile = exclusionZoneFile;
       
     DiffuseCalculator dc(sp);
-    dc.runSimulation();
+    bool ok;
+    if(sp.analyze)
+      ok = dc.runAnalysis();
+    else if(sp.farmWorker)
+      ok = dc.runWorker();
+    else
+      ok = dc.runSimulation();
     
-    return Py_True;
+    return PyBool_FromLong(ok);
   }
 
   static PyMethodDef DiffuseParticlesMethods[] = {
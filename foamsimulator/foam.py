@@ -105,6 +105,9 @@ try:
             print("Error: domain not valid.")
             exit()
 
+    # Read ADVANCED (optional). Values are parsed by the simulator.
+    Advanced = dict(config['ADVANCED']) if config.has_section('ADVANCED') else {}
+
 except KeyError as ke :
     print("Error reading '", ke.args[0], "' parameter.")
     exit()
@@ -136,7 +139,7 @@ if not CustomDomain:
     DomainMaxy = float(pmax.get("y"))
     DomainMaxz = float(pmax.get("z"))
 
-diffuseparticles.run(InputDataPath,
+ok = diffuseparticles.run(InputDataPath,
                      InputFilesPrefix,
                      OutputDataPath,
                      FilesOutputPrefix,
@@ -155,5 +158,8 @@ diffuseparticles.run(InputDataPath,
                      MinKineticEnergyThreshold, MaxKineticEnergyThreshold,
                      DiffuseTrappedAirMultiplier, DiffuseWaveCrestsMultiplier,
                      SprayDensity, BubblesDensity, LifefimeMultiplier,
-                     BuoyancyControl, DragControl)
+                     BuoyancyControl, DragControl,
+                     Advanced)
+if not ok:
+    sys.exit(1)
 
@@ -0,0 +1,91 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#define _SILENCE_EXPERIMENTAL_FILESYSTEM_DEPRECATION_WARNING
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+
+#include "ConfigFile.h"
+#include "FluidData.h"
+#include "SimulationParams.h"
+
+/*
+ * Converts the fluid vtk files of a case into fluid cache files, once, so that the simulations
+ * of the same case load each step without parsing the vtk file or sorting the particles by cell.
+ * It reads the same configuration file as foamsim, and writes the cache files to CachePath.
+ */
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cout << "Usage: " << argv[0] << " config_file.ini [Option=value ...]" << std::endl;
+    return 1;
+  }
+
+  SimulationParams sp;
+  if (!config::readParams(argv[1], sp))
+    return 1;
+
+  for (int i = 2; i < argc; i++) {
+    std::string arg(argv[i]);
+    size_t sep = arg.find('=');
+    if (sep == std::string::npos || !sp.setOption(arg.substr(0, sep), arg.substr(sep + 1))) {
+      std::cerr << "Invalid advanced option '" << arg << "'" << std::endl;
+      return 1;
+    }
+  }
+
+  if (sp.cachePath == "") {
+    std::cerr << "ERROR: CachePath is not set." << std::endl;
+    return 1;
+  }
+  std::error_code ec;
+  fs::create_directories(sp.cachePath, ec);
+
+  std::string seqnum(sp.nzeros, '0'),
+      formats = std::string("%.") + std::to_string(sp.nzeros) + std::string("d");
+
+  long nwritten = 0;
+  for (int nstep = sp.nstart; nstep <= sp.nend; nstep++) {
+    std::sprintf(&seqnum[0], formats.c_str(), nstep);
+    std::string fileName = (fs::path(sp.dataPath) / (sp.filePrefix + seqnum + ".vtk")).generic_string();
+    if (!fs::exists(fileName)) {
+      std::cerr << "WARNING: missing step " << nstep << ": " << fileName << std::endl;
+      continue;
+    }
+
+    FluidData file(sp.MINX, sp.MAXX, sp.MINY, sp.MAXY, sp.MINZ, sp.MAXZ, sp.h);
+    if (!file.loadFile(fileName))
+      return 1;
+
+    std::string cacheName = FluidData::cacheFileName(sp.cachePath, fileName);
+    long rounded = file.writeCache(cacheName, fileName);
+    if (rounded < 0)
+      return 1;
+    std::cout << cacheName << ": " << file.getBucketContainer()->getNElements() << " particles"
+              << std::endl;
+    if (rounded > 0) // The input files are in double precision
+      std::cerr << "WARNING: " << rounded << " values were rounded to single precision." << std::endl;
+    nwritten++;
+  }
+
+  std::cout << "Cache files written: " << nwritten << std::endl;
+  return 0;
+}
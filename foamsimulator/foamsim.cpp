@@ -0,0 +1,68 @@
+// VisualSPHysics
+// Copyright (C) 2020 Orlando Garcia-Feal orlando@uvigo.es
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <iostream>
+#include <string>
+
+#include "ConfigFile.h"
+#include "DiffuseCalculator.h"
+#include "Parallel.h"
+#include "SimulationParams.h"
+
+/*
+ * Runs the foam simulation without Python. It reads the same configuration file as foam.py.
+ * Advanced options given as Key=Value after the file name override the [ADVANCED] section.
+ * When it is built with MPI and launched with mpirun, the domain is split among the processes.
+ */
+
+static int run(int argc, char **argv) {
+  if (argc < 2) {
+    std::cout << "Usage: " << argv[0] << " config_file.ini [Option=value ...]" << std::endl;
+    return 1;
+  }
+
+  SimulationParams sp;
+  if (!config::readParams(argv[1], sp))
+    return 1;
+
+  for (int i = 2; i < argc; i++) {
+    std::string arg(argv[i]);
+    size_t sep = arg.find('=');
+    if (sep == std::string::npos || !sp.setOption(arg.substr(0, sep), arg.substr(sep + 1))) {
+      std::cerr << "Invalid advanced option '" << arg << "'" << std::endl;
+      return 1;
+    }
+  }
+
+  // The exit status tells job scripts whether the run failed
+  DiffuseCalculator dc(sp);
+  bool ok;
+  if (sp.analyze)
+    ok = dc.runAnalysis();
+  else if (sp.farmWorker)
+    ok = dc.runWorker();
+  else
+    ok = dc.runSimulation();
+
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  parallel::init(&argc, &argv);
+  int status = run(argc, argv);
+  parallel::finalize();
+  return status;
+}
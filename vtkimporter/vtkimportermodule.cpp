@@ -22,6 +22,11 @@
 #include <vtkCellArray.h>
 #include <Python.h>
 #include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
 #include <array>
 
 
@@ -297,12 +302,116 @@ extern "C"
     return ret;
   }
 
+  /**
+     Load a grid of a foam volume file (.fvol), written by the foam simulator with VolumeFiles enabled.
+     The file stores the density of the spray, foam and bubbles in sparse blocks of 8x8x8 voxels. Only the
+     active voxels are returned, so the size of the result depends on the volume covered by the foam and not
+     on its number of particles. A volume object can be made from them, for example with the Points to Volume
+     node of Blender, using the voxel size as radius and the density as attribute.
+     \param self Pointer to the associated Python object.
+     \param args Pointer to the Python object that contains the parameters of the function, in this case, the
+     string with the file name and, optionally, the name of the grid: "spray", "foam" (default) or "bubbles".
+     \return Pointer to a Python object that contains a tuple with the list of voxel centres, the list of their
+     densities and the voxel size.
+   */
+  static PyObject * vtkimporter_loadvolume(PyObject *self, PyObject *args){
+    const char * FILE_NAME;
+    const char * GRID_NAME = "foam";
+
+    if(!PyArg_ParseTuple(args, "s|s", &FILE_NAME, &GRID_NAME))
+      return NULL;
+
+    std::ifstream in(FILE_NAME, std::ios::binary);
+    char magic[8];
+    double origin[3], voxelSize;
+    int32_t ngrids, padding;
+    in.read(magic, 8);
+    in.read((char *)origin, sizeof(origin));
+    in.read((char *)&voxelSize, sizeof(voxelSize));
+    in.read((char *)&ngrids, sizeof(ngrids));
+    in.read((char *)&padding, sizeof(padding));
+    if(!in || std::memcmp(magic, "VSPHFV01", 8) != 0){
+      PyErr_SetString(PyExc_IOError, "Not a foam volume file.");
+      return NULL;
+    }
+
+    PyObject *vertices = PyList_New(0),
+      *values = PyList_New(0);
+    bool found = false;
+
+    for(int g = 0; g < ngrids && !found; g++){
+      char name[16];
+      int64_t nblocks;
+      in.read(name, sizeof(name));
+      in.read((char *)&nblocks, sizeof(nblocks));
+      name[15] = 0;
+      found = std::string(name) == GRID_NAME;
+
+      for(int64_t b = 0; b < nblocks && in; b++){
+        int32_t corner[3];
+        uint64_t mask[8];
+        in.read((char *)corner, sizeof(corner));
+        in.read((char *)mask, sizeof(mask));
+
+        long nactive = 0;
+        for(int n = 0; n < 512; n++)
+          nactive += (mask[n >> 6] >> (n & 63)) & 1;
+
+        if(!found){ /* Skip the values of the other grids */
+          in.seekg(nactive * sizeof(float), std::ios::cur);
+          continue;
+        }
+
+        std::vector<float> density(nactive);
+        in.read((char *)density.data(), nactive * sizeof(float));
+
+        /* Voxel n of a block is x * 64 + y * 8 + z */
+        for(int n = 0, k = 0; n < 512; n++){
+          if(!((mask[n >> 6] >> (n & 63)) & 1))
+            continue;
+          double px = origin[0] + (corner[0] + (n >> 6)) * voxelSize,
+            py = origin[1] + (corner[1] + ((n >> 3) & 7)) * voxelSize,
+            pz = origin[2] + (corner[2] + (n & 7)) * voxelSize;
+          PyObject *p = Py_BuildValue("(ddd)", px, py, pz),
+            *v = PyFloat_FromDouble(density[k++]);
+          PyList_Append(vertices, p);
+          PyList_Append(values, v);
+          Py_DECREF(p);
+          Py_DECREF(v);
+        }
+      }
+
+      if(!in){
+        Py_DECREF(vertices);
+        Py_DECREF(values);
+        PyErr_SetString(PyExc_IOError, "Truncated foam volume file.");
+        return NULL;
+      }
+    }
+
+    if(!found){
+      Py_DECREF(vertices);
+      Py_DECREF(values);
+      PyErr_SetString(PyExc_KeyError, "Grid not found in the foam volume file.");
+      return NULL;
+    }
+
+    PyObject *ret = PyTuple_New(3);
+
+    PyTuple_SET_ITEM(ret, 0, vertices);
+    PyTuple_SET_ITEM(ret, 1, values);
+    PyTuple_SET_ITEM(ret, 2, PyFloat_FromDouble(voxelSize));
+
+    return ret;
+  }
+
 
   static PyMethodDef VtkImporterMethods[] = {
     {"load", vtkimporter_load, METH_VARARGS, "Load a vtk file."},
     {"loadvel", vtkimporter_loadvel, METH_VARARGS, "Load a vtk file with velocity vectors."},
     {"loadrope", vtkimporter_loadrope, METH_VARARGS, "Load a vtk file with rope data."},
     {"loaddiffuse", vtkimporter_loaddiffuse, METH_VARARGS, "Load a vtk file with diffuse particles data."},
+    {"loadvolume", vtkimporter_loadvolume, METH_VARARGS, "Load a grid of a foam volume file."},
     {NULL, NULL, 0, NULL}        /* Sentinel */
   };
 